@@ -0,0 +1,96 @@
+#include "autocorrelation.h"
+
+#include <algorithm>
+#include <complex>
+
+#include "simd_kernels.h"
+
+namespace dsp {
+
+fft_autocorrelation::fft_autocorrelation() : window(0) {}
+
+void fft_autocorrelation::prepare(std::size_t max_window) {
+    // Zero padding to 2W avoids the circular wrap of the lags
+    const std::size_t size = next_pow2(2 * std::max<std::size_t>(max_window, 1));
+    if (size <= fft.size())
+        return;
+    fft.resize(size);
+    padded.assign(fft.size(), 0.0);
+    spectrum.assign(fft.size() / 2 + 1, 0.0);
+    result.assign(fft.size(), 0.0);
+}
+
+void fft_autocorrelation::compute_padded(std::size_t w) {
+    window = w;
+    std::fill(padded.begin() + w, padded.end(), 0.0);
+
+    fft.forward(padded.data(), spectrum.data());
+    for (auto &bin : spectrum)
+        bin = std::norm(bin);
+    fft.inverse(spectrum.data(), result.data());
+}
+
+// Samples added to the history at a time
+static constexpr std::size_t sliding_chunk = 1024;
+
+// Windows between two recomputations of the sliding sums
+static constexpr std::size_t sliding_refresh = 16;
+
+sliding_autocorrelation::sliding_autocorrelation()
+    : length(0), longest(0), ends(0), since_refresh(0) {}
+
+void sliding_autocorrelation::prepare(std::size_t length_, std::size_t max_lag) {
+    length = std::max<std::size_t>(length_, 1);
+    longest = max_lag;
+    // The end leaving the window still needs its own max_lag history
+    // when a whole chunk has just been appended
+    history.reset(length + longest + sliding_chunk);
+    sums.assign(longest + 1, 0.0f);
+    ends = since_refresh = 0;
+}
+
+void sliding_autocorrelation::clear() {
+    if (ends == 0 && history.size() == 0)
+        return;
+    history.clear();
+    std::fill(sums.begin(), sums.end(), 0.0f);
+    ends = since_refresh = 0;
+}
+
+void sliding_autocorrelation::push(const float *const src, std::size_t n) {
+    for (std::size_t done = 0; done < n;) {
+        const std::size_t m = std::min(n - done, sliding_chunk);
+        history.push(src + done, m);
+        done += m;
+
+        const std::span<const float> x = history.samples();
+        for (std::size_t p = x.size() - m; p < x.size(); ++p) {
+            // Not enough predecessors yet since the last clear()
+            if (p < longest)
+                continue;
+            mac(x.data() + p - longest, x[p], sums.data(), longest + 1);
+            ++since_refresh;
+            if (ends < length) {
+                ++ends;
+                continue;
+            }
+            const std::size_t leaving = p - length;
+            mac(x.data() + leaving - longest, -x[leaving], sums.data(), longest + 1);
+        }
+    }
+    if (since_refresh >= sliding_refresh * length) {
+        refresh();
+    }
+}
+
+void sliding_autocorrelation::refresh() {
+    since_refresh = 0;
+    const std::span<const float> x = samples();
+    for (std::size_t k = 0; k <= longest && ends > 0; ++k) {
+        // Lag longest - k: the ends paired with the samples k after the
+        // start of the history
+        sums[k] = dot(x.data() + k, x.data() + longest, ends);
+    }
+}
+
+}  // namespace dsp
@@ -0,0 +1,131 @@
+#ifndef _AUTOCORRELATION_H
+#define _AUTOCORRELATION_H
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "fft.h"
+#include "mirrored_ring.h"
+
+namespace dsp {
+
+/**
+ * Autocorrelation by the Wiener-Khinchin theorem.
+ *
+ * The window is zero padded to at least twice its length, so that the
+ * inverse transform of the power spectrum yields the linear (not
+ * circular) autocorrelation:
+ *
+ *   r[lag] = sum_{m=0}^{W-1-lag} x[m] x[m+lag],  0 <= lag <= W
+ *
+ * All buffers are allocated in prepare(), so compute() does not touch
+ * the heap as long as the window does not grow.
+ */
+class fft_autocorrelation {
+   public:
+    fft_autocorrelation();
+
+    /**
+     * Allocate plan and scratch buffers for windows of up to
+     * max_window samples.
+     */
+    void prepare(std::size_t max_window);
+
+    /**
+     * Compute the autocorrelation of the samples in [first, last)
+     */
+    template <class Iterator>
+    void compute(Iterator first, Iterator last) {
+        std::size_t w = 0;
+        prepare(static_cast<std::size_t>(last - first));
+        for (; first != last; ++first)
+            padded[w++] = *first;
+        compute_padded(w);
+    }
+
+    /**
+     * Autocorrelation at the given lag of the last computed window
+     */
+    double lag(std::size_t l) const { return l < window ? result[l] : 0.0; }
+
+    std::size_t window_size() const { return window; }
+
+   private:
+    real_fft fft;
+    std::size_t window;
+    std::vector<double> padded;
+    std::vector<real_fft::complex_t> spectrum;
+    std::vector<double> result;
+
+    void compute_padded(std::size_t w);
+};
+
+/**
+ * Autocorrelation of a stream, updated sample by sample.
+ *
+ * Keeps, for every lag 0 <= tau <= max_lag,
+ *
+ *   r[tau] = sum_{e} x[e] x[e-tau]
+ *
+ * over the pair ends e of the last length samples.  Each new sample
+ * adds the products with its max_lag predecessors, and the sample that
+ * leaves the window subtracts its own, so that a block of B samples
+ * costs 2 B (max_lag + 1) multiply-adds instead of a whole window.
+ * Every pair spans the same number of ends, whatever the lag.
+ *
+ * Both updates are one vectorized mac() over a contiguous history.
+ * The sums are float, so they are recomputed from the samples every
+ * few windows to keep the rounding errors of the updates from adding
+ * up.
+ *
+ * prepare() allocates; push() does not.
+ */
+class sliding_autocorrelation {
+   public:
+    sliding_autocorrelation();
+
+    /**
+     * Allocate for windows of length pair ends and lags up to max_lag
+     */
+    void prepare(std::size_t length, std::size_t max_lag);
+
+    // Forget the stream
+    void clear();
+
+    void push(const float *const src, std::size_t n);
+
+    // Sum at the given lag, up to max_lag()
+    double lag(std::size_t l) const { return sums[longest - l]; }
+
+    std::size_t max_lag() const { return longest; }
+
+    // Pair ends in the sums, up to length
+    std::size_t size() const { return ends; }
+
+    bool full() const { return ends == length; }
+
+    /**
+     * Samples of the sums: the max_lag predecessors of the first end,
+     * then the size() ends
+     */
+    std::span<const float> samples() const {
+        if (ends == 0)
+            return {};
+        return history.window(history.size() - ends - longest, ends + longest);
+    }
+
+   private:
+    mirrored_ring history;
+    std::vector<float> sums;  // sums[k] is r[longest - k]
+    std::size_t length;
+    std::size_t longest;      // max_lag
+    std::size_t ends;
+    std::size_t since_refresh;  // Ends added since the last recompute
+
+    void refresh();
+};
+
+}  // namespace dsp
+
+#endif
@@ -0,0 +1,117 @@
+#include "callback_stats.h"
+
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+
+namespace jack {
+
+  callback_stats::callback_stats() {
+    reset();
+  }
+
+  std::int64_t callback_stats::now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return std::int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+  void callback_stats::record(std::int64_t start_ns,
+                              std::int64_t duration_ns,
+                              jack_nframes_t nframes,
+                              jack_nframes_t sample_rate) {
+    const auto relaxed = std::memory_order_relaxed;
+
+    const std::int64_t budget_ns
+      = std::int64_t(nframes) * 1000000000 / std::max<jack_nframes_t>(sample_rate,1);
+    const std::size_t b = std::min<std::int64_t>(
+      buckets - 1,
+      duration_ns * buckets_per_period / std::max<std::int64_t>(budget_ns,1));
+
+    // Single writer: plain load/store instead of read-modify-write
+    _histogram[b].store(_histogram[b].load(relaxed) + 1, relaxed);
+    if (duration_ns > _worst_ns.load(relaxed)) {
+      _worst_ns.store(duration_ns, relaxed);
+    }
+    const double load = 100.0 * duration_ns / std::max<std::int64_t>(budget_ns,1);
+    _load.store(0.9 * _load.load(relaxed) + 0.1 * load, relaxed);
+    _last_ns.store(duration_ns, relaxed);
+    _budget_ns.store(budget_ns, relaxed);
+    _last_start_ns.store(start_ns, relaxed);
+    _cycles.store(_cycles.load(relaxed) + 1, std::memory_order_release);
+  }
+
+  void callback_stats::xrun() {
+    _xruns.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void callback_stats::reset() {
+    for (auto& h : _histogram) {
+      h.store(0, std::memory_order_relaxed);
+    }
+    _cycles.store(0, std::memory_order_relaxed);
+    _xruns.store(0, std::memory_order_relaxed);
+    _last_ns.store(0, std::memory_order_relaxed);
+    _worst_ns.store(0, std::memory_order_relaxed);
+    _budget_ns.store(0, std::memory_order_relaxed);
+    _last_start_ns.store(0, std::memory_order_relaxed);
+    _load.store(0.0, std::memory_order_relaxed);
+  }
+
+  std::uint64_t callback_stats::bucket(unsigned int i) const {
+    return i < buckets ? _histogram[i].load(std::memory_order_relaxed) : 0;
+  }
+
+  double callback_stats::percentile(double p, std::uint64_t total) const {
+    const std::uint64_t target = static_cast<std::uint64_t>(p * total);
+    std::uint64_t count = 0;
+    for (unsigned int i = 0; i < buckets; ++i) {
+      count += bucket(i);
+      if (count > target) {
+        // Upper edge of the bucket
+        return 100.0 * (i + 1) / buckets_per_period;
+      }
+    }
+    return 100.0 * buckets / buckets_per_period;
+  }
+
+  callback_stats::summary callback_stats::read() const {
+    const auto relaxed = std::memory_order_relaxed;
+    summary s;
+    s.cycles = _cycles.load(std::memory_order_acquire);
+    s.xruns = _xruns.load(relaxed);
+    s.last_us = _last_ns.load(relaxed) / 1e3;
+    s.worst_us = _worst_ns.load(relaxed) / 1e3;
+    s.budget_us = _budget_ns.load(relaxed) / 1e3;
+    s.load = _load.load(relaxed);
+    s.worst_load = s.budget_us > 0 ? 100.0 * s.worst_us / s.budget_us : 0.0;
+
+    std::uint64_t total = 0;
+    for (unsigned int i = 0; i < buckets; ++i) {
+      total += bucket(i);
+    }
+    s.p50_load = total > 0 ? percentile(0.50, total) : 0.0;
+    s.p99_load = total > 0 ? percentile(0.99, total) : 0.0;
+
+    const std::int64_t last = _last_start_ns.load(relaxed);
+    s.since_last_ms = last > 0 ? (now_ns() - last) / 1e6 : -1.0;
+    return s;
+  }
+
+} // namespace jack
+
+std::ostream& operator<<(std::ostream& os,
+                         const jack::callback_stats::summary& s) {
+  const auto flags = os.flags();
+  const auto precision = os.precision();
+  os << std::fixed << std::setprecision(1)
+     << "cycles " << s.cycles
+     << ", xruns " << s.xruns
+     << ", DSP load " << s.load << "% (p50 < " << s.p50_load
+     << "%, p99 < " << s.p99_load << "%, worst " << s.worst_load << "%)"
+     << ", worst " << s.worst_us << " us of " << s.budget_us << " us"
+     << ", last callback " << s.since_last_ms << " ms ago";
+  os.flags(flags);
+  os.precision(precision);
+  return os;
+}
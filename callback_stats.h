@@ -0,0 +1,90 @@
+#ifndef _CALLBACK_STATS_H
+#define _CALLBACK_STATS_H
+
+#include <jack/jack.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+namespace jack {
+
+  /**
+   * Timing statistics of the process callback.
+   *
+   * The backend records every call to client::process() from the
+   * real-time thread; any other thread may read the statistics at any
+   * time.  All counters are preallocated atomics written by a single
+   * thread, so recording never locks, allocates or makes system calls
+   * (the clock is read through the vDSO).
+   *
+   * Cycle times are kept in a histogram relative to the period budget
+   * (buffer_size / sample_rate), in buckets of 2.5% of the budget.  The
+   * last bucket collects everything above 157.5%.
+   */
+  class callback_stats {
+  public:
+    static constexpr unsigned int buckets = 64;
+    static constexpr unsigned int buckets_per_period = 40;
+
+    /// Values derived from the counters at the time of reading
+    struct summary {
+      std::uint64_t cycles;   ///< process() calls recorded
+      std::uint64_t xruns;    ///< xruns reported by the server
+      double last_us;         ///< duration of the last cycle
+      double worst_us;        ///< longest cycle so far
+      double budget_us;       ///< period length
+      double load;            ///< smoothed DSP load, % of the budget
+      double worst_load;      ///< worst cycle, % of the budget
+      double p50_load;        ///< median cycle, % of the budget
+      double p99_load;        ///< 99th percentile, % of the budget
+      double since_last_ms;   ///< time since the last callback started
+    };
+
+    callback_stats();
+
+    /// Monotonic time in nanoseconds
+    static std::int64_t now_ns();
+
+    /**
+     * Record a process() call of nframes that started at start_ns and
+     * lasted duration_ns.  Only to be called from the process thread.
+     */
+    void record(std::int64_t start_ns,
+                std::int64_t duration_ns,
+                jack_nframes_t nframes,
+                jack_nframes_t sample_rate);
+
+    /// Count an xrun.  Safe from any thread.
+    void xrun();
+
+    /// Clear all counters.  Not synchronized with record().
+    void reset();
+
+    /// Lock-free read of the current values
+    summary read() const;
+
+    /// Number of cycles in the given histogram bucket
+    std::uint64_t bucket(unsigned int i) const;
+
+  private:
+    std::array<std::atomic<std::uint64_t>, buckets> _histogram;
+    std::atomic<std::uint64_t> _cycles;
+    std::atomic<std::uint64_t> _xruns;
+    std::atomic<std::int64_t>  _last_ns;
+    std::atomic<std::int64_t>  _worst_ns;
+    std::atomic<std::int64_t>  _budget_ns;
+    std::atomic<std::int64_t>  _last_start_ns;
+    std::atomic<double>        _load;
+
+    /// Load of the given percentile, from the histogram
+    double percentile(double p, std::uint64_t total) const;
+  };
+
+} // namespace jack
+
+std::ostream& operator<<(std::ostream& os,
+                         const jack::callback_stats::summary& s);
+
+#endif
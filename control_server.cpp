@@ -0,0 +1,277 @@
+#include "control_server.h"
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace dsp {
+
+control_server::control_server()
+    : epoll(-1), listener(-1), results(-1), timer(-1), signals(-1) {}
+
+control_server::~control_server() {
+    close();
+}
+
+void control_server::open(const std::string &path, double tick_seconds) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Invalid control socket path: " + path);
+    }
+    if (!(tick_seconds > 0)) {
+        throw std::runtime_error("The control tick must be positive");
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0) {
+        throw std::runtime_error("Cannot create the control epoll set");
+    }
+
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        throw std::runtime_error("Cannot create the control socket");
+    }
+    // A socket file left by an instance that was killed would make
+    // bind() fail.  Nobody accepts on it, but a running instance would
+    // lose its socket: only a refused connection removes the file
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+        throw std::runtime_error("Cannot create the control socket");
+    }
+    const int connected = connect(probe, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+    const int error = errno;
+    ::close(probe);
+    struct stat status;
+    if (connected == 0) {
+        throw std::runtime_error("The control socket " + path + " is in use by another instance");
+    } else if (error == ECONNREFUSED && lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(path.c_str());
+    } else if (error != ENOENT) {
+        throw std::runtime_error("Cannot use the control socket " + path + ": " +
+                                 (error == ECONNREFUSED ? "not a socket" : std::strerror(error)));
+    }
+    if (bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listener, 16) != 0) {
+        throw std::runtime_error("Cannot bind the control socket " + path +
+                                 ": " + std::strerror(errno));
+    }
+    socket_path = path;
+    watch(listener);
+
+    results = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (results < 0) {
+        throw std::runtime_error("Cannot create the results eventfd");
+    }
+    watch(results);
+
+    timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer < 0) {
+        throw std::runtime_error("Cannot create the control timer");
+    }
+    itimerspec period{};
+    period.it_interval.tv_sec = static_cast<time_t>(tick_seconds);
+    period.it_interval.tv_nsec = static_cast<long>(std::fmod(tick_seconds, 1.0) * 1e9);
+    if (period.it_interval.tv_sec == 0 && period.it_interval.tv_nsec == 0) {
+        period.it_interval.tv_nsec = 1;
+    }
+    period.it_value = period.it_interval;
+    timerfd_settime(timer, 0, &period, nullptr);
+    watch(timer);
+
+    // Delivered through the epoll set instead of a handler
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    signals = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signals < 0) {
+        throw std::runtime_error("Cannot create the control signalfd");
+    }
+    watch(signals);
+}
+
+void control_server::watch(int fd) {
+    epoll_event e{};
+    e.events = EPOLLIN;
+    e.data.fd = fd;
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &e) != 0) {
+        throw std::runtime_error("Cannot watch a control descriptor");
+    }
+}
+
+control_server::event control_server::wait() {
+    while (pending.empty()) {
+        epoll_event ready[16];
+        const int n = epoll_wait(epoll, ready, 16, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            pending.push_back({event_type::Stop, -1, ""});
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            const int fd = ready[i].data.fd;
+            std::uint64_t count;
+            if (fd == listener) {
+                accept_connections();
+            } else if (fd == results) {
+                if (read(results, &count, sizeof(count)) == sizeof(count)) {
+                    pending.push_back({event_type::Results, -1, ""});
+                }
+            } else if (fd == timer) {
+                if (read(timer, &count, sizeof(count)) == sizeof(count)) {
+                    pending.push_back({event_type::Tick, -1, ""});
+                }
+            } else if (fd == signals) {
+                signalfd_siginfo info;
+                while (read(signals, &info, sizeof(info)) == sizeof(info)) {
+                }
+                pending.push_back({event_type::Stop, -1, ""});
+            } else {
+                read_commands(fd);
+            }
+        }
+    }
+    event next = std::move(pending.front());
+    pending.pop_front();
+    return next;
+}
+
+void control_server::notify() {
+    const std::uint64_t one = 1;
+    // Only fails if the counter would overflow, which it cannot
+    [[maybe_unused]] const ssize_t written = write(results, &one, sizeof(one));
+}
+
+void control_server::accept_connections() {
+    for (;;) {
+        const int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        if (connections.size() >= max_connections) {
+            send_line(fd, "error too many connections");
+            ::close(fd);
+            continue;
+        }
+        connections[fd] = connection{};
+        watch(fd);
+    }
+}
+
+void control_server::read_commands(int fd) {
+    const auto found = connections.find(fd);
+    if (found == connections.end()) {
+        return;
+    }
+    std::string &input = found->second.input;
+    char buffer[4096];
+    for (;;) {
+        const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            drop(fd);
+            return;
+        }
+        if (n < 0) {
+            break;
+        }
+        input.append(buffer, n);
+    }
+
+    std::size_t start = 0;
+    for (std::size_t end; (end = input.find('\n', start)) != std::string::npos; start = end + 1) {
+        std::string line = input.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        pending.push_back({event_type::Command, fd, std::move(line)});
+    }
+    input.erase(0, start);
+    if (input.size() > max_line) {
+        send_line(fd, "error line too long");
+        drop(fd);
+    }
+}
+
+void control_server::reply(int connection, const std::string &line) {
+    if (connections.count(connection) != 0 && !send_line(connection, line)) {
+        drop(connection);
+    }
+}
+
+void control_server::subscribe(int connection, bool subscribed) {
+    const auto found = connections.find(connection);
+    if (found != connections.end()) {
+        found->second.subscribed = subscribed;
+    }
+}
+
+void control_server::broadcast(const std::string &line) {
+    for (auto c = connections.begin(); c != connections.end();) {
+        const int fd = c->first;
+        const bool keep = !c->second.subscribed || send_line(fd, line);
+        ++c;
+        if (!keep) {
+            drop(fd);
+        }
+    }
+}
+
+std::size_t control_server::subscribers() const {
+    std::size_t n = 0;
+    for (const auto &c : connections) {
+        n += c.second.subscribed;
+    }
+    return n;
+}
+
+bool control_server::send_line(int fd, const std::string &line) {
+    // A partial line would corrupt the stream, so it counts as a failure
+    const std::string data = line + '\n';
+    return send(fd, data.data(), data.size(), MSG_DONTWAIT | MSG_NOSIGNAL) ==
+           static_cast<ssize_t>(data.size());
+}
+
+void control_server::drop(int fd) {
+    epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    connections.erase(fd);
+    // Its commands not handled yet refer to a closed descriptor
+    std::erase_if(pending, [fd](const event &e) {
+        return e.type == event_type::Command && e.connection == fd;
+    });
+}
+
+void control_server::close() {
+    while (!connections.empty()) {
+        drop(connections.begin()->first);
+    }
+    for (int *fd : {&listener, &results, &timer, &signals, &epoll}) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+    if (!socket_path.empty()) {
+        unlink(socket_path.c_str());
+        socket_path.clear();
+    }
+}
+
+}  // namespace dsp
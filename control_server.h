@@ -0,0 +1,98 @@
+#ifndef _CONTROL_SERVER_H
+#define _CONTROL_SERVER_H
+
+#include <deque>
+#include <map>
+#include <string>
+
+namespace dsp {
+
+/**
+ * Local control socket of a headless dsp1.
+ *
+ * Listens on a UNIX stream socket and reads one command per line from
+ * every connection.  wait() also returns when notify() signals new
+ * analysis results, once per tick and on SIGINT or SIGTERM, all of them
+ * from a single epoll set, so commands take effect as soon as they
+ * arrive and results go out as soon as they are ready.
+ *
+ * Writes never block the server: a connection that does not keep up
+ * with its replies and events is closed.
+ */
+class control_server {
+   public:
+    enum class event_type {
+        Command,  // A line from connection
+        Results,  // notify() was called, maybe several times
+        Tick,     // The period given to open() elapsed
+        Stop      // SIGINT or SIGTERM
+    };
+    struct event {
+        event_type type;
+        int connection;    // Of a command
+        std::string text;  // The command, without the line end
+    };
+
+    static constexpr std::size_t max_connections = 64;
+    static constexpr std::size_t max_line = 1024;
+
+    control_server();
+    ~control_server();
+
+    control_server(const control_server &) = delete;
+    control_server &operator=(const control_server &) = delete;
+
+    /**
+     * Listen on path and tick every tick_seconds.  A socket file left
+     * by a dead instance is replaced; one still accepting connections
+     * is not.  SIGINT and SIGTERM are blocked in this thread and in the
+     * threads it creates afterwards, so call it before starting the
+     * client.  Throws std::runtime_error on failure.
+     */
+    void open(const std::string &path, double tick_seconds);
+
+    // Wait for the next event
+    event wait();
+
+    /**
+     * Wake up wait() with a Results event.  Lock-free and safe from any
+     * thread; notifications not waited for yet are merged.
+     */
+    void notify();
+
+    // Send a line (the line end is added) to one connection
+    void reply(int connection, const std::string &line);
+
+    // Connections subscribed receive every broadcast()
+    void subscribe(int connection, bool subscribed);
+    void broadcast(const std::string &line);
+    std::size_t subscribers() const;
+
+    // Stop listening and remove the socket file
+    void close();
+
+   private:
+    struct connection {
+        std::string input;  // Bytes after the last complete line
+        bool subscribed = false;
+    };
+
+    int epoll;
+    int listener;
+    int results;  // eventfd written by notify()
+    int timer;
+    int signals;
+    std::string socket_path;
+    std::map<int, connection> connections;
+    std::deque<event> pending;
+
+    void watch(int fd);
+    void accept_connections();
+    void read_commands(int fd);
+    bool send_line(int fd, const std::string &line);
+    void drop(int fd);
+};
+
+}  // namespace dsp
+
+#endif
@@ -0,0 +1,84 @@
+#include "decimator.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#include "simd_kernels.h"
+
+namespace dsp {
+
+decimator::decimator() : d(1), block(0), offset(0) {}
+
+unsigned int decimator::factor_for(float sample_rate, float max_frequency,
+                                   unsigned int limit) {
+    if (!(max_frequency > 0)) {
+        return 1;
+    }
+    const float factor = std::floor(sample_rate / (8 * max_frequency));
+    return static_cast<unsigned int>(std::clamp(factor, 1.0f, static_cast<float>(std::min(limit, max_factor))));
+}
+
+void decimator::prepare(unsigned int factor, std::size_t block_) {
+    if (factor < 1 || factor > max_factor) {
+        throw std::invalid_argument("The decimation factor must be between 1 and " +
+                                    std::to_string(max_factor));
+    }
+    d = factor;
+    block = std::max<std::size_t>(block_, 1);
+    if (d == 1) {
+        taps.clear();
+        line.clear();
+        out.clear();
+        return;
+    }
+
+    // Windowed sinc, cut at 0.8 of the new Nyquist and scaled to unit
+    // gain at DC
+    const std::size_t length = taps_per_phase * d;
+    const double cutoff = 0.8 * 0.5 / d;
+    const double middle = 0.5 * (length - 1);
+    taps.resize(length);
+    double sum = 0;
+    for (std::size_t i = 0; i < length; ++i) {
+        const double t = i - middle;
+        const double sinc = t == 0 ? 2 * cutoff : std::sin(2 * M_PI * cutoff * t) / (M_PI * t);
+        const double w = 0.42 - 0.5 * std::cos(2 * M_PI * i / (length - 1)) +
+                         0.08 * std::cos(4 * M_PI * i / (length - 1));
+        taps[i] = static_cast<float>(sinc * w);
+        sum += taps[i];
+    }
+    for (float &h : taps) {
+        h = static_cast<float>(h / sum);
+    }
+    // Reversed, so that an output is a dot product with the inputs in
+    // the order they came (the filter is symmetric anyway)
+    std::reverse(taps.begin(), taps.end());
+
+    line.assign(length - 1 + block, 0.0f);
+    out.assign(block / d + 1, 0.0f);
+    reset();
+}
+
+void decimator::reset() {
+    std::fill(line.begin(), line.end(), 0.0f);
+    offset = 0;
+}
+
+std::size_t decimator::filter(const float *in, std::size_t n) {
+    const std::size_t history = taps.size() - 1;
+    std::copy(in, in + n, line.begin() + history);
+
+    // The output of new input j uses line[j, j + taps.size())
+    std::size_t m = 0;
+    std::size_t j = offset;
+    for (; j < n; j += d) {
+        out[m++] = dot(line.data() + j, taps.data(), taps.size());
+    }
+    offset = j - n;
+
+    // Keep the inputs the next outputs still need
+    std::copy(line.begin() + n, line.begin() + n + history, line.begin());
+    return m;
+}
+
+}  // namespace dsp
@@ -0,0 +1,86 @@
+#ifndef _DECIMATOR_H
+#define _DECIMATOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * Polyphase anti-alias decimator.
+ *
+ * Low-pass filters the input with a Blackman windowed sinc and keeps
+ * one sample out of factor().  Only the kept samples are computed: each
+ * one is the sum of the factor() polyphase branches of the filter at
+ * that instant, which amounts to one dot product of taps_per_phase *
+ * factor() taps, or taps_per_phase multiplications per input sample.
+ *
+ * The cutoff is at 0.8 times the new Nyquist frequency.  A factor of 1
+ * passes the input through untouched.
+ */
+class decimator {
+   public:
+    static constexpr std::size_t taps_per_phase = 16;
+    static constexpr unsigned int max_factor = 16;
+
+    decimator();
+
+    /**
+     * Largest factor, up to max_factor, that keeps a sample rate of at
+     * least eight times max_frequency.  With fewer samples per period,
+     * the lags next to a period can fall below 0.9 of its peak (cos(pi/N)),
+     * and the detectors would take one of its multiples.
+     */
+    static unsigned int factor_for(float sample_rate, float max_frequency,
+                                   unsigned int limit = max_factor);
+
+    /**
+     * Design the filter for the given factor (1 to max_factor).  Inputs
+     * are handled in pieces of up to block samples.  Not real-time safe.
+     */
+    void prepare(unsigned int factor, std::size_t block = 4096);
+
+    // Forget the filter history
+    void reset();
+
+    unsigned int factor() const { return d; }
+
+    /**
+     * Filter n samples, calling output(samples, count) with the
+     * decimated ones.  Never allocates.
+     */
+    template <typename Output>
+    void process(const float *in, std::size_t n, Output &&output) {
+        if (d <= 1) {
+            if (n > 0) {
+                output(in, n);
+            }
+            return;
+        }
+        while (n > 0) {
+            const std::size_t k = std::min(n, block);
+            const std::size_t m = filter(in, k);
+            if (m > 0) {
+                output(static_cast<const float *>(out.data()), m);
+            }
+            in += k;
+            n -= k;
+        }
+    }
+
+   private:
+    unsigned int d;
+    std::size_t block;
+    std::vector<float> taps;  // Impulse response, reversed
+    std::vector<float> line;  // The last taps - 1 inputs, then the new ones
+    std::vector<float> out;
+    std::size_t offset;       // New input whose output is computed next
+
+    // Filter up to block samples into out, returning how many came out
+    std::size_t filter(const float *in, std::size_t n);
+};
+
+}  // namespace dsp
+
+#endif
@@ -0,0 +1,560 @@
+/** @file dsp_accuracy.cpp
+ *
+ * @brief Accuracy regression of the pitch analysis and the tuner.
+ *
+ * Synthesizes signals of known pitch (pure and harmonic rich tones
+ * from do3 to si5, a sweep, vibrato, noise and silence) and feeds them
+ * through dsp_client::process() and analyze(), block by block as the
+ * offline backend does, for several sample rates, block sizes and
+ * detectors.  Every estimate is compared with the pitch of the window
+ * it was taken from: frequency, note and cents of the tuner.  The
+ * thread CPU time of the analysis is measured too.
+ *
+ * One JSON record per case goes to stdout, as with dsp_bench.  The exit
+ * status is a failure if any case is out of tolerance or above the
+ * analysis load limit, so that `ninja accuracy` fails on a regression.
+ */
+
+#include <time.h>
+
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dsp_client.h"
+#include "file_backend.h"
+#include "note_table.h"
+
+namespace po = boost::program_options;
+
+// Discards what dsp_client::init() and the offline backend report, once
+// per signal, keeping the JSON output and the failures readable
+class quiet_output {
+   public:
+    quiet_output()
+        : saved_out(std::cout.rdbuf(sink.rdbuf())), saved_err(std::cerr.rdbuf(sink.rdbuf())) {}
+    ~quiet_output() {
+        std::cout.rdbuf(saved_out);
+        std::cerr.rdbuf(saved_err);
+    }
+
+   private:
+    std::ostringstream sink;
+    std::streambuf *saved_out;
+    std::streambuf *saved_err;
+};
+
+// CPU time of the calling thread, in seconds: the analysis runs here,
+// so other load on the machine does not count
+static double thread_seconds() {
+    timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/**
+ * A synthesized signal and its pitch at every sample (0 where it has
+ * none).  What is expected from the analysis is set by its kind.
+ */
+struct test_signal {
+    enum class kind {
+        Steady,    // Every estimate within tolerance, with the right note
+        Note,      // Every estimate with the right note
+        Tracking,  // Most estimates within tolerance of a moving pitch
+        Unpitched  // No confident estimate
+    };
+    std::string name;
+    kind expect;
+    std::vector<float> samples;
+    std::vector<float> pitch;
+};
+
+class signal_generator {
+   public:
+    explicit signal_generator(jack_nframes_t sample_rate)
+        : sample_rate(sample_rate), seed(0x2545f491) {}
+
+    // Sum of harmonics, with amplitudes[k] for harmonic k + 1; the
+    // frequency of each sample comes from f(t)
+    template <class Frequency>
+    test_signal harmonics(const std::string &name, test_signal::kind expect,
+                          double seconds, const std::vector<float> &amplitudes,
+                          Frequency &&f) const {
+        test_signal s{name, expect, {}, {}};
+        const std::size_t n = static_cast<std::size_t>(seconds * sample_rate);
+        s.samples.resize(n);
+        s.pitch.resize(n);
+        double phase = 0;  // In cycles, integrated so that f can move
+        for (std::size_t i = 0; i < n; i++) {
+            const double frequency = f(static_cast<double>(i) / sample_rate);
+            double x = 0;
+            for (std::size_t k = 0; k < amplitudes.size(); k++) {
+                x += amplitudes[k] * std::sin(2 * M_PI * (k + 1) * phase);
+            }
+            s.samples[i] = static_cast<float>(x);
+            s.pitch[i] = static_cast<float>(frequency);
+            phase += frequency / sample_rate;
+            phase -= std::floor(phase);
+        }
+        return s;
+    }
+
+    test_signal tone(const std::string &name, double frequency,
+                     const std::vector<float> &amplitudes,
+                     test_signal::kind expect = test_signal::kind::Steady) const {
+        return harmonics(name, expect, 1.5, amplitudes, [frequency](double) { return frequency; });
+    }
+
+    // White noise from a fixed xorshift, the same on every platform
+    test_signal noise(float amplitude) {
+        test_signal s{"noise", test_signal::kind::Unpitched, {}, {}};
+        s.samples.resize(static_cast<std::size_t>(1.5 * sample_rate));
+        s.pitch.assign(s.samples.size(), 0.0f);
+        for (float &x : s.samples) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            x = amplitude * (static_cast<float>(seed) / 2147483648.0f - 1);
+        }
+        return s;
+    }
+
+    test_signal silence() const {
+        const std::size_t n = static_cast<std::size_t>(1.5 * sample_rate);
+        return {"silence", test_signal::kind::Unpitched, std::vector<float>(n, 0.0f),
+                std::vector<float>(n, 0.0f)};
+    }
+
+   private:
+    jack_nframes_t sample_rate;
+    std::uint32_t seed;
+};
+
+struct tolerance {
+    float cents;           // Of every estimate of a steady pitch
+    float tracking_cents;  // Of the 95th percentile of a moving pitch
+    float voiced;          // Least share of the estimates with a period
+    float confidence;      // Most an unpitched signal may reach
+    double load_pct;       // Of the analysis thread, over the signal length
+    double slack;          // Analysis time allowed above the baseline, relative
+};
+
+struct accuracy_case {
+    std::string detector;
+    std::string engine;
+    float window;  // Analysis window and ring, in seconds
+    jack_nframes_t sample_rate;
+    jack_nframes_t buffer_size;
+};
+
+// Shorter than the longest period, 1/60 s at the default minimum
+// frequency, so that the lags in range do not all fit in the window
+static constexpr float short_window = 0.01f;
+
+class dsp_accuracy {
+   public:
+    dsp_accuracy(const tolerance &limits, float window, const std::string &engine,
+                 unsigned int decimation)
+        : limits(limits), window(window), engine(engine), decimation(decimation),
+          first(true), failures(0) {}
+
+    void run(const std::vector<jack_nframes_t> &buffer_sizes,
+             const std::vector<jack_nframes_t> &sample_rates,
+             const std::vector<std::string> &detectors);
+
+    /**
+     * Compare the analysis time of every case with the one of an earlier
+     * run (the JSON printed by this program)
+     */
+    void read_baseline(const std::string &path);
+
+    void finish() { std::cout << "\n]}" << std::endl; }
+    unsigned int get_failures() const { return failures; }
+
+   private:
+    // What the harness checks of one signal
+    struct outcome {
+        unsigned int decimation = 1;  // Chosen by the client
+        std::size_t estimates = 0;  // Blocks analyzed after the settling time
+        std::size_t voiced = 0;     // With a period
+        std::size_t wrong_notes = 0;
+        float max_cents = 0;        // Of the frequency, against the window pitch
+        float p95_cents = 0;
+        float max_tuner_cents = 0;  // Of the cents the tuner reported
+        float max_confidence = 0;
+        double analysis_ms = 0;     // Thread CPU time of analyze()
+        double load_pct = 0;        // The same over the signal length
+    };
+
+    tolerance limits;
+    float window;  // Analysis window and ring, in seconds
+    std::string engine;
+    unsigned int decimation;  // Of the pitch analysis, 0 for automatic
+    bool first;
+    unsigned int failures;
+    dsp::note_table reference;
+    std::map<std::string, double> baseline;  // analysis_ms by case_key()
+
+    static std::string case_key(const std::string &signal, const std::string &detector,
+                                const std::string &engine, const std::string &window,
+                                const std::string &sample_rate, const std::string &buffer_size);
+    std::vector<test_signal> make_signals(jack_nframes_t sample_rate);
+    std::vector<test_signal> make_short_signals(jack_nframes_t sample_rate);
+    // Measure, judge and report every signal; returns the failures
+    unsigned int run_case(const accuracy_case &c, const std::vector<test_signal> &signals);
+    outcome measure(const accuracy_case &c, const test_signal &s);
+    bool judge(const accuracy_case &c, const test_signal &s, const outcome &o) const;
+    void report(const accuracy_case &c, const test_signal &s, const outcome &o, bool passed);
+};
+
+static dsp_client::CorrelationEngine correlation_engine(const std::string &name) {
+    if (name == "direct")
+        return dsp_client::CorrelationEngine::Direct;
+    if (name == "sliding")
+        return dsp_client::CorrelationEngine::Sliding;
+    if (name == "fft")
+        return dsp_client::CorrelationEngine::FFT;
+    throw std::invalid_argument("Unknown autocorrelation engine: " + name);
+}
+
+static dsp_client::PitchDetector pitch_detector(const std::string &name) {
+    if (name == "yin")
+        return dsp_client::PitchDetector::YIN;
+    if (name == "mpm")
+        return dsp_client::PitchDetector::MPM;
+    if (name == "autocorrelation")
+        return dsp_client::PitchDetector::Autocorrelation;
+    throw std::invalid_argument("Unknown pitch detector: " + name);
+}
+
+std::vector<test_signal> dsp_accuracy::make_signals(jack_nframes_t sample_rate) {
+    signal_generator generator(sample_rate);
+    std::vector<test_signal> signals;
+
+    // Every note from do3 to si5, alternately in tune and 20 cents above
+    // or below, so that the sign of the cents is checked too
+    const std::vector<float> pure = {0.5f};
+    for (int note = 48; note <= 83; note++) {
+        const float detune = (note % 3 - 1) * 20.0f;
+        const double frequency = reference.frequency(note) * std::exp2(detune / 1200);
+        signals.push_back(generator.tone(std::string("tone ") + dsp::note_table::name(note) +
+                                             (detune > 0 ? " +20" : detune < 0 ? " -20" : ""),
+                                         frequency, pure));
+    }
+
+    // Sawtooth-like tones, whose fundamental is weaker than the sum of
+    // its harmonics: the usual source of octave errors
+    const std::vector<float> rich = {0.3f, 0.15f, 0.1f, 0.075f, 0.06f, 0.05f};
+    for (int note : {48, 57, 64, 69, 74}) {
+        signals.push_back(generator.tone(std::string("harmonics ") + dsp::note_table::name(note),
+                                         reference.frequency(note), rich));
+    }
+
+    // An octave per two seconds, from do3 up to do5
+    const double low = reference.frequency(48);
+    signals.push_back(generator.harmonics("sweep", test_signal::kind::Tracking, 4.0, pure,
+                                          [low](double t) { return low * std::exp2(t / 2); }));
+
+    // la4 with +-50 cents of vibrato at 5.5 Hz
+    const double la4 = reference.frequency(69);
+    signals.push_back(generator.harmonics("vibrato", test_signal::kind::Tracking, 2.0, rich,
+                                          [la4](double t) {
+                                              return la4 * std::exp2(0.5 / 12 * std::sin(2 * M_PI * 5.5 * t));
+                                          }));
+
+    signals.push_back(generator.noise(0.5f));
+    signals.push_back(generator.silence());
+    return signals;
+}
+
+std::vector<test_signal> dsp_accuracy::make_short_signals(jack_nframes_t sample_rate) {
+    signal_generator generator(sample_rate);
+    std::vector<test_signal> signals;
+
+    // Notes with a few periods in the short window.  So few bias the
+    // autocorrelation by up to 25 cents: only the note is checked
+    const std::vector<float> pure = {0.5f};
+    for (int note : {69, 76, 81}) {
+        signals.push_back(generator.tone(std::string("short tone ") + dsp::note_table::name(note),
+                                         reference.frequency(note), pure, test_signal::kind::Note));
+    }
+    signals.push_back(generator.silence());
+    return signals;
+}
+
+dsp_accuracy::outcome dsp_accuracy::measure(const accuracy_case &c, const test_signal &s) {
+    jack::file_backend backend(s.samples, c.sample_rate, c.buffer_size);
+    dsp_client client;
+    client.set_energy_window_size(c.window);
+    client.set_period_window_size(c.window);
+    client.set_period_ringsize(c.window);
+    client.set_period_decimation(decimation);
+    // Above si5, 20 cents sharp
+    client.set_period_maxfreq(1200);
+    client.set_correlation_engine(correlation_engine(c.engine));
+    client.set_pitch_detector(pitch_detector(c.detector));
+    client.set_period_mode(true);
+    client.change_mode(dsp_client::Mode::Tuner);
+    jack::client_state state;
+    {
+        quiet_output quiet;
+        state = client.init(backend);
+    }
+    if (state != jack::client_state::Running) {
+        throw std::runtime_error("Could not initialize the offline client");
+    }
+
+    // Running sums of log2 of the pitch, to compare every estimate
+    // with the mean pitch of the window it was taken from
+    std::vector<double> log_pitch(s.pitch.size() + 1, 0.0);
+    std::vector<std::size_t> unpitched(s.pitch.size() + 1, 0);
+    for (std::size_t i = 0; i < s.pitch.size(); i++) {
+        log_pitch[i + 1] = log_pitch[i] + (s.pitch[i] > 0 ? std::log2(s.pitch[i]) : 0.0);
+        unpitched[i + 1] = unpitched[i] + (s.pitch[i] > 0 ? 0 : 1);
+    }
+    const std::size_t span = static_cast<std::size_t>(c.window * c.sample_rate);
+    // The ring is full and every estimate comes from a whole window
+    // once a ring length and a block have gone by
+    const std::size_t settled = span + c.buffer_size;
+
+    outcome o;
+    o.decimation = client.get_period_decimation();
+    std::vector<float> errors;
+    std::vector<float> out(c.buffer_size);
+    double cpu = 0;
+    for (std::size_t pos = 0; pos + c.buffer_size <= s.samples.size(); pos += c.buffer_size) {
+        client.process(c.buffer_size, s.samples.data() + pos, out.data());
+        const double t0 = thread_seconds();
+        client.analyze();
+        cpu += thread_seconds() - t0;
+
+        const std::size_t end = pos + c.buffer_size;
+        if (end < settled) {
+            continue;
+        }
+        const dsp_client::PeriodResult result = client.get_results();
+        o.estimates++;
+        o.max_confidence = std::max(o.max_confidence, result.confidence);
+        if (!(result.period > 0) || result.note_tuned < 0) {
+            continue;
+        }
+        o.voiced++;
+        const std::size_t begin = end - span;
+        if (unpitched[end] - unpitched[begin] > 0) {
+            continue;
+        }
+        const double expected = std::exp2((log_pitch[end] - log_pitch[begin]) / span);
+        const float error = static_cast<float>(std::abs(1200 * std::log2(1 / result.period / expected)));
+        errors.push_back(error);
+        o.max_cents = std::max(o.max_cents, error);
+
+        const dsp::note_match note = reference.nearest(static_cast<float>(expected));
+        if (note.note != result.note_tuned) {
+            o.wrong_notes++;
+        } else {
+            o.max_tuner_cents = std::max(o.max_tuner_cents, std::abs(result.cents - note.cents));
+        }
+    }
+    if (!errors.empty()) {
+        std::sort(errors.begin(), errors.end());
+        o.p95_cents = errors[static_cast<std::size_t>(0.95 * (errors.size() - 1) + 0.5)];
+    }
+    o.analysis_ms = 1e3 * cpu;
+    o.load_pct = 100 * cpu * c.sample_rate / s.samples.size();
+    return o;
+}
+
+std::string dsp_accuracy::case_key(const std::string &signal, const std::string &detector,
+                                   const std::string &engine, const std::string &window,
+                                   const std::string &sample_rate,
+                                   const std::string &buffer_size) {
+    return signal + "/" + detector + "/" + engine + "/" + window + "/" + sample_rate + "/" +
+           buffer_size;
+}
+
+// Value of "name": in a record of one line, without the quotes of a string
+static std::string json_field(const std::string &line, const std::string &name) {
+    const std::string key = "\"" + name + "\": ";
+    const std::size_t start = line.find(key);
+    if (start == std::string::npos) {
+        return "";
+    }
+    const std::size_t begin = start + key.size();
+    if (line[begin] == '"') {
+        return line.substr(begin + 1, line.find('"', begin + 1) - begin - 1);
+    }
+    return line.substr(begin, line.find_first_of(",}", begin) - begin);
+}
+
+void dsp_accuracy::read_baseline(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Cannot read the baseline " + path);
+    }
+    for (std::string line; std::getline(file, line);) {
+        const std::string ms = json_field(line, "analysis_ms");
+        if (!ms.empty()) {
+            baseline[case_key(json_field(line, "signal"), json_field(line, "detector"),
+                              json_field(line, "engine"), json_field(line, "window_s"),
+                              json_field(line, "sample_rate"), json_field(line, "buffer_size"))] =
+                std::stod(ms);
+        }
+    }
+}
+
+bool dsp_accuracy::judge(const accuracy_case &c, const test_signal &s, const outcome &o) const {
+    if (o.load_pct > limits.load_pct || o.estimates == 0) {
+        return false;
+    }
+    // Allow a millisecond on top, for the cases that hardly analyze
+    std::ostringstream window;
+    window << c.window;
+    const auto base = baseline.find(case_key(s.name, c.detector, c.engine, window.str(),
+                                             std::to_string(c.sample_rate),
+                                             std::to_string(c.buffer_size)));
+    if (base != baseline.end() &&
+        o.analysis_ms > std::max((1 + limits.slack) * base->second, base->second + 1)) {
+        return false;
+    }
+    switch (s.expect) {
+        case test_signal::kind::Steady:
+            return o.voiced >= limits.voiced * o.estimates && o.wrong_notes == 0 &&
+                   o.max_cents <= limits.cents && o.max_tuner_cents <= limits.cents;
+        case test_signal::kind::Note:
+            return o.voiced >= limits.voiced * o.estimates && o.wrong_notes == 0;
+        case test_signal::kind::Tracking:
+            return o.voiced >= limits.voiced * o.estimates && o.p95_cents <= limits.tracking_cents;
+        case test_signal::kind::Unpitched:
+            return o.voiced == 0 || o.max_confidence <= limits.confidence;
+    }
+    return false;
+}
+
+void dsp_accuracy::report(const accuracy_case &c, const test_signal &s, const outcome &o,
+                          bool passed) {
+    if (first) {
+        std::cout << "{\"cases\": [\n";
+    } else {
+        std::cout << ",\n";
+    }
+    first = false;
+    std::cout << "  {\"signal\": \"" << s.name << "\""
+              << ", \"detector\": \"" << c.detector << "\""
+              << ", \"engine\": \"" << c.engine << "\""
+              << ", \"window_s\": " << c.window
+              << ", \"sample_rate\": " << c.sample_rate
+              << ", \"buffer_size\": " << c.buffer_size
+              << ", \"decimation\": " << o.decimation
+              << ", \"estimates\": " << o.estimates
+              << ", \"voiced\": " << o.voiced
+              << ", \"wrong_notes\": " << o.wrong_notes
+              << ", \"max_cents\": " << o.max_cents
+              << ", \"p95_cents\": " << o.p95_cents
+              << ", \"max_tuner_cents\": " << o.max_tuner_cents
+              << ", \"max_confidence\": " << o.max_confidence
+              << ", \"analysis_ms\": " << o.analysis_ms
+              << ", \"analysis_load_pct\": " << o.load_pct
+              << ", \"passed\": " << (passed ? "true" : "false") << "}";
+    if (!passed) {
+        std::cerr << "E> " << s.name << ", " << c.detector << " " << c.engine << " "
+                  << c.window << " s " << c.sample_rate << " Hz "
+                  << c.buffer_size << " frames: " << o.voiced << "/" << o.estimates
+                  << " voiced, " << o.wrong_notes << " wrong notes, max " << o.max_cents
+                  << " cents (p95 " << o.p95_cents << "), confidence " << o.max_confidence
+                  << ", analysis " << o.analysis_ms << " ms (" << o.load_pct << "%)" << std::endl;
+    }
+}
+
+void dsp_accuracy::run(const std::vector<jack_nframes_t> &buffer_sizes,
+                       const std::vector<jack_nframes_t> &sample_rates,
+                       const std::vector<std::string> &detectors) {
+    // A misspelt name fails before any case is run
+    correlation_engine(engine);
+    for (const std::string &detector : detectors) {
+        pitch_detector(detector);
+    }
+    for (jack_nframes_t sample_rate : sample_rates) {
+        const std::vector<test_signal> signals = make_signals(sample_rate);
+        const std::vector<test_signal> short_signals = make_short_signals(sample_rate);
+        for (jack_nframes_t buffer_size : buffer_sizes)
+            for (const std::string &detector : detectors) {
+                failures += run_case({detector, engine, window, sample_rate, buffer_size}, signals);
+                // Every engine, as each one bounds the lags on its own
+                for (const char *short_engine : {"fft", "direct", "sliding"}) {
+                    failures += run_case({detector, short_engine, short_window, sample_rate, buffer_size},
+                                         short_signals);
+                }
+            }
+    }
+}
+
+unsigned int dsp_accuracy::run_case(const accuracy_case &c, const std::vector<test_signal> &signals) {
+    unsigned int failed = 0;
+    for (const test_signal &s : signals) {
+        const outcome o = measure(c, s);
+        const bool passed = judge(c, s, o);
+        failed += !passed;
+        report(c, s, o, passed);
+    }
+    std::cerr << "I> " << c.detector << " " << c.engine << " " << c.window << " s "
+              << c.sample_rate << " Hz " << c.buffer_size << " frames: " << signals.size() - failed
+              << "/" << signals.size() << " passed" << std::endl;
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    po::options_description desc("Options");
+    desc.add_options()("help,h", "Show help message")("quick,q", "Run a reduced set of configurations")("detectors", po::value<std::vector<std::string>>()->multitoken(), "Set pitch detectors to check (autocorrelation, yin, mpm)")("engine", po::value<std::string>()->default_value("fft"), "Set autocorrelation engine (fft, direct, sliding)")("window", po::value<float>()->default_value(0.5f), "Set analysis window and ring in seconds")("cents", po::value<float>()->default_value(5.0f), "Set largest pitch error of steady tones in cents")("tracking-cents", po::value<float>()->default_value(10.0f), "Set largest pitch error of the sweep and vibrato in cents (95th percentile)")("voiced", po::value<float>()->default_value(0.95f), "Set least share of pitched signal estimates with a period")("confidence", po::value<float>()->default_value(0.5f), "Set largest confidence of an unpitched signal")("max-load", po::value<double>()->default_value(100.0), "Set largest analysis CPU time, in percent of the signal length")("baseline", po::value<std::string>(), "Compare the analysis CPU time with this earlier output")("slack", po::value<double>()->default_value(0.5), "Set analysis CPU time allowed above the baseline, relative")("decimate", po::value<unsigned int>()->default_value(0), "Set decimation of the pitch analysis (0 chooses it, 1 disables it)");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    std::vector<jack_nframes_t> buffer_sizes = {64, 256, 1024};
+    std::vector<jack_nframes_t> sample_rates = {44100, 48000, 96000};
+    std::vector<std::string> detectors = {"autocorrelation", "yin", "mpm"};
+
+    if (vm.count("quick")) {
+        buffer_sizes = {256};
+        sample_rates = {44100, 48000};
+    }
+    if (vm.count("detectors")) {
+        detectors = vm["detectors"].as<std::vector<std::string>>();
+    }
+
+    const tolerance limits{vm["cents"].as<float>(), vm["tracking-cents"].as<float>(),
+                           vm["voiced"].as<float>(),
+                           vm["confidence"].as<float>(), vm["max-load"].as<double>(), vm["slack"].as<double>()};
+    try {
+        dsp_accuracy accuracy(limits, vm["window"].as<float>(), vm["engine"].as<std::string>(),
+                              vm["decimate"].as<unsigned int>());
+        if (vm.count("baseline")) {
+            accuracy.read_baseline(vm["baseline"].as<std::string>());
+        }
+        accuracy.run(buffer_sizes, sample_rates, detectors);
+        accuracy.finish();
+        if (accuracy.get_failures() > 0) {
+            std::cerr << argv[0] << ": Error: " << accuracy.get_failures()
+                      << " cases out of tolerance" << std::endl;
+            return EXIT_FAILURE;
+        }
+    } catch (std::exception &exc) {
+        std::cerr << argv[0] << ": Error: " << exc.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
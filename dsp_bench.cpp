@@ -0,0 +1,503 @@
+/** @file dsp_bench.cpp
+ *
+ * @brief Micro-benchmarks of the DSP hot paths of dsp_client.
+ *
+ * The client is driven through the offline backend, so no JACK server
+ * is needed.  Results are printed as JSON on stdout, one record per
+ * kernel and configuration, to be kept as a regression baseline.
+ */
+
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dsp_client.h"
+#include "file_backend.h"
+#include "pipeline.h"
+#include "simd_kernels.h"
+
+namespace po = boost::program_options;
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Discards what dsp_client::init() reports on std::cout, keeping the
+// JSON output clean
+class quiet_cout {
+   public:
+    quiet_cout() : saved(std::cout.rdbuf(sink.rdbuf())) {}
+    ~quiet_cout() { std::cout.rdbuf(saved); }
+
+   private:
+    std::ostringstream sink;
+    std::streambuf *saved;
+};
+
+struct bench_case {
+    std::string kernel;
+    std::string mode;
+    jack_nframes_t sample_rate;
+    jack_nframes_t buffer_size;
+    float window;               // Analysis window in seconds
+    std::size_t samples;        // Samples handled per call
+    std::string detector = "";  // Pitch detector of the analysis kernels
+    unsigned int decimation = 1;  // Of the input of the analysis kernels
+};
+
+class dsp_bench {
+   public:
+    dsp_bench(double budget, unsigned int decimation)
+        : budget(budget), decimation(decimation), first(true) {}
+
+    void run(const std::vector<jack_nframes_t> &buffer_sizes,
+             const std::vector<jack_nframes_t> &sample_rates,
+             const std::vector<float> &windows,
+             const std::vector<std::string> &engines,
+             const std::vector<std::string> &detectors);
+
+    void finish() { std::cout << "\n]}" << std::endl; }
+
+   private:
+    double budget;  // Seconds per case
+    unsigned int decimation;  // Of the pitch analysis, 0 for automatic
+    bool first;
+    std::vector<float> signal;
+
+    void make_signal(jack_nframes_t sample_rate);
+    std::unique_ptr<dsp_client> make_client(jack::file_backend &backend,
+                                            float window);
+
+    template <class Function>
+    void measure(const bench_case &c, std::size_t min_calls, Function &&f);
+
+    void begin_record();
+    void report(const bench_case &c, std::vector<double> &ns);
+    void report_latency(const bench_case &c, double ms);
+
+    void bench_block_kernels(jack_nframes_t sample_rate,
+                             jack_nframes_t buffer_size);
+    void bench_spectrum(jack_nframes_t sample_rate);
+    void bench_analysis(jack_nframes_t sample_rate, float window,
+                        const std::string &engine,
+                        const std::string &detector);
+    void bench_stable_estimate(jack_nframes_t sample_rate, float window,
+                               const std::string &engine,
+                               const std::string &detector);
+};
+
+void dsp_bench::make_signal(jack_nframes_t sample_rate) {
+    // One second of a harmonic rich 220 Hz tone
+    signal.resize(sample_rate);
+    for (std::size_t i = 0; i < signal.size(); i++) {
+        const double t = static_cast<double>(i) / sample_rate;
+        signal[i] = 0.5f * std::sin(2 * M_PI * 220.0 * t) +
+                    0.25f * std::sin(2 * M_PI * 440.0 * t) +
+                    0.125f * std::sin(2 * M_PI * 660.0 * t);
+    }
+}
+
+static dsp_client::CorrelationEngine correlation_engine(const std::string &name) {
+    if (name == "direct")
+        return dsp_client::CorrelationEngine::Direct;
+    if (name == "sliding")
+        return dsp_client::CorrelationEngine::Sliding;
+    if (name == "fft")
+        return dsp_client::CorrelationEngine::FFT;
+    throw std::invalid_argument("Unknown autocorrelation engine: " + name);
+}
+
+static dsp_client::PitchDetector pitch_detector(const std::string &name) {
+    if (name == "yin")
+        return dsp_client::PitchDetector::YIN;
+    if (name == "mpm")
+        return dsp_client::PitchDetector::MPM;
+    if (name == "autocorrelation")
+        return dsp_client::PitchDetector::Autocorrelation;
+    throw std::invalid_argument("Unknown pitch detector: " + name);
+}
+
+std::unique_ptr<dsp_client> dsp_bench::make_client(jack::file_backend &backend,
+                                                   float window) {
+    auto client = std::make_unique<dsp_client>();
+    client->set_energy_window_size(window);
+    client->set_period_window_size(window);
+    client->set_period_ringsize(window);
+    client->set_period_decimation(decimation);
+
+    quiet_cout quiet;
+    if (client->init(backend) != jack::client_state::Running) {
+        throw std::runtime_error("Could not initialize the offline client");
+    }
+    return client;
+}
+
+template <class Function>
+void dsp_bench::measure(const bench_case &c, std::size_t min_calls,
+                        Function &&f) {
+    // Group fast calls in batches of at least ~2 us, so that the clock
+    // resolution does not dominate the measurement
+    std::size_t batch = 1;
+    for (;;) {
+        auto t0 = bench_clock::now();
+        for (std::size_t k = 0; k < batch; k++)
+            f();
+        auto dt = bench_clock::now() - t0;
+        if (dt >= std::chrono::microseconds(2) || batch >= (1u << 20))
+            break;
+        batch *= 2;
+    }
+
+    std::vector<double> ns;
+    const auto deadline = bench_clock::now() +
+                          std::chrono::duration<double>(budget);
+    while (ns.size() < min_calls || bench_clock::now() < deadline) {
+        auto t0 = bench_clock::now();
+        for (std::size_t k = 0; k < batch; k++)
+            f();
+        std::chrono::duration<double, std::nano> dt = bench_clock::now() - t0;
+        ns.push_back(dt.count() / batch);
+        if (ns.size() >= 100000)
+            break;
+    }
+    report(c, ns);
+}
+
+void dsp_bench::begin_record() {
+    if (first) {
+        std::cout << "{\"kernels\": \"" << dsp::kernels().name << "\",\n"
+                  << " \"benchmarks\": [\n";
+    } else {
+        std::cout << ",\n";
+    }
+    first = false;
+}
+
+void dsp_bench::report(const bench_case &c, std::vector<double> &ns) {
+    std::sort(ns.begin(), ns.end());
+    auto percentile = [&ns](double p) {
+        return ns[static_cast<std::size_t>(p * (ns.size() - 1) + 0.5)];
+    };
+    double mean = 0;
+    for (double v : ns)
+        mean += v;
+    mean /= ns.size();
+
+    const double ns_per_sample = mean / std::max<std::size_t>(c.samples, 1);
+    // Share of the JACK period used by a block kernel
+    const double period_ns = 1e9 * c.buffer_size / c.sample_rate;
+
+    begin_record();
+    std::cout << "  {\"kernel\": \"" << c.kernel << "\""
+              << ", \"mode\": \"" << c.mode << "\""
+              << ", \"detector\": \"" << c.detector << "\""
+              << ", \"sample_rate\": " << c.sample_rate
+              << ", \"buffer_size\": " << c.buffer_size
+              << ", \"window_s\": " << c.window
+              << ", \"decimation\": " << c.decimation
+              << ", \"samples_per_call\": " << c.samples
+              << ", \"calls\": " << ns.size()
+              << ", \"mean_ns\": " << mean
+              << ", \"p50_ns\": " << percentile(0.50)
+              << ", \"p90_ns\": " << percentile(0.90)
+              << ", \"p99_ns\": " << percentile(0.99)
+              << ", \"max_ns\": " << ns.back()
+              << ", \"ns_per_sample\": " << ns_per_sample
+              << ", \"msamples_per_s\": " << 1e3 / ns_per_sample
+              << ", \"period_load_pct\": "
+              << (c.buffer_size > 0 ? 100.0 * mean / period_ns : 0.0) << "}";
+    std::cerr << "I> " << c.kernel << " " << c.detector << (c.detector.empty() ? "" : " ")
+              << c.mode << " " << c.sample_rate
+              << " Hz " << c.buffer_size << " frames " << c.window
+              << " s: " << ns_per_sample << " ns/sample" << std::endl;
+}
+
+void dsp_bench::report_latency(const bench_case &c, double ms) {
+    begin_record();
+    std::cout << "  {\"kernel\": \"" << c.kernel << "\""
+              << ", \"mode\": \"" << c.mode << "\""
+              << ", \"detector\": \"" << c.detector << "\""
+              << ", \"sample_rate\": " << c.sample_rate
+              << ", \"buffer_size\": " << c.buffer_size
+              << ", \"window_s\": " << c.window
+              << ", \"decimation\": " << c.decimation
+              << ", \"latency_ms\": " << ms << "}";
+    std::cerr << "I> " << c.kernel << " " << c.detector << " " << c.mode
+              << " " << c.sample_rate << " Hz " << c.window << " s: "
+              << ms << " ms" << std::endl;
+}
+
+void dsp_bench::bench_block_kernels(jack_nframes_t sample_rate,
+                                    jack_nframes_t buffer_size) {
+    jack::file_backend backend(signal, sample_rate, buffer_size);
+    auto client = make_client(backend, 0.5);
+
+    std::vector<float> out(buffer_size);
+    std::size_t pos = 0;
+    // Walk through the test signal, one block per call
+    auto next_block = [&]() {
+        pos += buffer_size;
+        if (pos + buffer_size > signal.size())
+            pos = 0;
+        return signal.data() + pos;
+    };
+    bench_case c{"", "", sample_rate, buffer_size, 0.5f, buffer_size};
+
+    const std::pair<const char *, dsp_client::Mode> modes[] = {
+        {"passthrough", dsp_client::Mode::Passthrough},
+        {"volume", dsp_client::Mode::VolumeChange},
+        {"repeater", dsp_client::Mode::Repeater},
+        {"tuner", dsp_client::Mode::Tuner},
+        {"autotune", dsp_client::Mode::Autotune}};
+
+    for (const auto &mode : modes) {
+        client->change_mode(mode.second);
+        // The analysis modes need the period capture, as in dsp1
+        client->set_period_mode(mode.second == dsp_client::Mode::Repeater ||
+                                mode.second == dsp_client::Mode::Tuner ||
+                                mode.second == dsp_client::Mode::Autotune);
+        c.kernel = "process";
+        c.mode = mode.first;
+        measure(c, 10, [&]() {
+            client->process(buffer_size, next_block(), out.data());
+            client->stream->sample_ring[0].consume([](const float *, std::size_t) {});
+        });
+    }
+    client->change_mode(dsp_client::Mode::Passthrough);
+
+    // The spectrum only adds a copy of the input to process(); the
+    // transform runs on the analysis thread (stft_frame)
+    client->set_spectrum_mode(true);
+    c.kernel = "process";
+    c.mode = "passthrough+spectrum";
+    measure(c, 10, [&]() {
+        client->process(buffer_size, next_block(), out.data());
+        client->stream->spectrum_ring[0].consume([](const float *, std::size_t) {});
+    });
+    client->set_spectrum_mode(false);
+
+    // The loudness meter runs inside process(), for all the channels
+    client->set_loudness_mode(true);
+    c.mode = "passthrough+loudness";
+    measure(c, 10, [&]() { client->process(buffer_size, next_block(), out.data()); });
+    client->set_loudness_mode(false);
+
+    // The same chain (meter, volume, capture) fused into one pass and
+    // put together at run time, one pass per stage
+    std::vector<float> captured(buffer_size);
+    const float volume = 0.5f;
+    c.kernel = "pipeline";
+    c.mode = "fused";
+    measure(c, 10, [&]() {
+        dsp::energy_meter meter;
+        dsp::run(next_block(), out.data(), buffer_size, meter,
+                 dsp::gain_stage(volume), dsp::capture_stage(captured.data()));
+        captured[0] += meter.energy();
+    });
+    dsp::stage_chain chain;
+    dsp::energy_meter &meter = chain.add(dsp::energy_meter());
+    chain.add(dsp::gain_stage(volume));
+    chain.add(dsp::capture_stage(captured.data()));
+    c.mode = "runtime";
+    measure(c, 10, [&]() {
+        chain.process(next_block(), out.data(), buffer_size);
+        captured[0] += meter.energy();
+    });
+
+    // Apply the setting as process() would
+    client->set_energy_mode(true);
+    client->drain_commands();
+    c.kernel = "calculate_energy_and_power";
+    c.mode = "energy";
+    measure(c, 10, [&]() {
+        const float *const block = next_block();
+        client->calculate_energy_and_power(0, buffer_size,
+                                           dsp::sum_squares(block, buffer_size));
+    });
+
+    client->set_period_mode(true);
+    client->drain_commands();
+    c.kernel = "get_data_period";
+    c.mode = "period";
+    measure(c, 10, [&]() {
+        const float *const block = next_block();
+        client->get_data_period(0, buffer_size, block,
+                                dsp::sum_squares(block, buffer_size));
+        client->stream->sample_ring[0].consume([](const float *, std::size_t) {});
+    });
+}
+
+void dsp_bench::bench_spectrum(jack_nframes_t sample_rate) {
+    // One frame per call: the hop is the whole FFT
+    for (std::size_t size : {1024, 4096, 8192}) {
+        dsp::stft_analyzer stft;
+        stft.prepare(sample_rate, size, size, 3);
+        std::size_t pos = 0;
+        bench_case c{"stft_frame", "third", sample_rate, 0,
+                     static_cast<float>(size) / sample_rate, size};
+        measure(c, 10, [&]() {
+            pos = (pos + size) % (signal.size() - size);
+            stft.push(signal.data() + pos, size);
+        });
+    }
+}
+
+void dsp_bench::bench_analysis(jack_nframes_t sample_rate, float window,
+                               const std::string &engine,
+                               const std::string &detector) {
+    const jack_nframes_t buffer_size = 256;
+    jack::file_backend backend(signal, sample_rate, buffer_size);
+    auto client = make_client(backend, window);
+    client->set_correlation_engine(correlation_engine(engine));
+    client->set_pitch_detector(pitch_detector(detector));
+    client->set_period_mode(true);
+    client->change_mode(dsp_client::Mode::Tuner);
+
+    // Fill the ring buffer (and the sliding sums, which also need the
+    // history of their first lags) before timing the analysis alone
+    std::vector<float> out(buffer_size);
+    const std::size_t ring = static_cast<std::size_t>(window * sample_rate);
+    std::size_t pos = 0;
+    auto next_block = [&]() {
+        const float *const block = signal.data() + pos % (signal.size() - buffer_size);
+        pos += buffer_size;
+        return block;
+    };
+    while (pos < 2 * ring + buffer_size) {
+        client->process(buffer_size, next_block(), out.data());
+        client->analyze();
+    }
+
+    bench_case c{"calculate_period", engine, sample_rate, buffer_size,
+                 window, static_cast<std::size_t>(window * sample_rate),
+                 detector, client->get_period_decimation()};
+    measure(c, 3, [&]() { client->calculate_period(); });
+
+    // What a new block costs the analysis thread: the sliding engine
+    // updates its sums here, the others recompute the window
+    c.kernel = "analyze";
+    c.samples = buffer_size;
+    measure(c, 3, [&]() {
+        client->process(buffer_size, next_block(), out.data());
+        client->analyze();
+    });
+
+    if (detector != "autocorrelation")
+        return;
+    c.kernel = "process_tuner";
+    c.mode = "tuner";
+    c.detector = "";
+    c.samples = 1;
+    measure(c, 10, [&]() { client->process_tuner(); });
+}
+
+void dsp_bench::bench_stable_estimate(jack_nframes_t sample_rate,
+                                      float window,
+                                      const std::string &engine,
+                                      const std::string &detector) {
+    const jack_nframes_t buffer_size = 256;
+    jack::file_backend backend(signal, sample_rate, buffer_size);
+    auto client = make_client(backend, window);
+    client->set_correlation_engine(correlation_engine(engine));
+    client->set_pitch_detector(pitch_detector(detector));
+    client->set_period_mode(true);
+    client->change_mode(dsp_client::Mode::Tuner);
+
+    // Feed the tone from an empty ring, analyzing after every block as
+    // the offline backend does.  The estimate is stable from the first
+    // block after which it stays within 1% of 220 Hz.
+    std::vector<float> out(buffer_size);
+    std::size_t stable = 0;
+    bool locked = false;
+    std::size_t pos = 0;
+    for (; pos + buffer_size <= signal.size(); pos += buffer_size) {
+        client->process(buffer_size, signal.data() + pos, out.data());
+        client->analyze();
+        const bool close = std::abs(client->get_freq() / 220.0f - 1) < 0.01f;
+        if (close && !locked) {
+            stable = pos + buffer_size;
+        }
+        locked = close;
+    }
+
+    bench_case c{"time_to_stable", engine, sample_rate, buffer_size,
+                 window, 0, detector, client->get_period_decimation()};
+    report_latency(c, locked ? 1e3 * stable / sample_rate : -1.0);
+}
+
+void dsp_bench::run(const std::vector<jack_nframes_t> &buffer_sizes,
+                    const std::vector<jack_nframes_t> &sample_rates,
+                    const std::vector<float> &windows,
+                    const std::vector<std::string> &engines,
+                    const std::vector<std::string> &detectors) {
+    // A misspelt name fails before any case is timed
+    for (const std::string &engine : engines) {
+        correlation_engine(engine);
+    }
+    for (const std::string &detector : detectors) {
+        pitch_detector(detector);
+    }
+    for (jack_nframes_t sample_rate : sample_rates) {
+        make_signal(sample_rate);
+        for (jack_nframes_t buffer_size : buffer_sizes)
+            bench_block_kernels(sample_rate, buffer_size);
+        bench_spectrum(sample_rate);
+        for (float window : windows)
+            for (const std::string &detector : detectors)
+                for (const std::string &engine : engines) {
+                    bench_analysis(sample_rate, window, engine, detector);
+                    bench_stable_estimate(sample_rate, window, engine, detector);
+                }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    po::options_description desc("Options");
+    desc.add_options()("help,h", "Show help message")("time,t", po::value<double>()->default_value(0.05), "Set seconds spent per benchmark case")("quick,q", "Run a reduced set of configurations")("engines", po::value<std::vector<std::string>>()->multitoken(), "Set autocorrelation engines to time (fft, direct, sliding)")("detectors", po::value<std::vector<std::string>>()->multitoken(), "Set pitch detectors to time (autocorrelation, yin, mpm)")("isa", po::value<std::string>(), "Force a kernel set (scalar, sse2, avx2, avx512)")("decimate", po::value<unsigned int>()->default_value(0), "Set decimation of the pitch analysis (0 chooses it, 1 disables it)");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    std::vector<jack_nframes_t> buffer_sizes = {32, 64, 128, 256, 512, 1024, 2048, 4096};
+    std::vector<jack_nframes_t> sample_rates = {44100, 48000, 96000};
+    std::vector<float> windows = {0.1f, 0.25f, 0.5f};
+    std::vector<std::string> engines = {"fft", "direct", "sliding"};
+    std::vector<std::string> detectors = {"autocorrelation", "yin", "mpm"};
+
+    if (vm.count("quick")) {
+        buffer_sizes = {64, 256, 1024};
+        sample_rates = {48000};
+        windows = {0.1f, 0.5f};
+    }
+    if (vm.count("isa") && !dsp::select_kernels(vm["isa"].as<std::string>())) {
+        std::cerr << argv[0] << ": Error: kernel set not supported" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (vm.count("engines")) {
+        engines = vm["engines"].as<std::vector<std::string>>();
+    }
+    if (vm.count("detectors")) {
+        detectors = vm["detectors"].as<std::vector<std::string>>();
+    }
+
+    try {
+        dsp_bench bench(vm["time"].as<double>(), vm["decimate"].as<unsigned int>());
+        bench.run(buffer_sizes, sample_rates, windows, engines, detectors);
+        bench.finish();
+    } catch (std::exception &exc) {
+        std::cerr << argv[0] << ": Error: " << exc.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
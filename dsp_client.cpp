@@ -1,220 +1,740 @@
 #include "dsp_client.h"
 
+#include <algorithm>
 #include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
 
-static std::unordered_map<std::string, double> notas = {
-    {"do3", 130.8127827},
-    {"do3#", 138.5913155},
-    {"re3", 146.832384},
-    {"re3#", 155.5634919},
-    {"mi3", 164.8137785},
-    {"fa3", 174.6141157},
-    {"fa3#", 184.9972114},
-    {"sol3", 195.997718},
-    {"sol3#", 207.6523488},
-    {"la3", 220},
-    {"la3#", 233.0818808},
-    {"si3", 246.9416506},
-
-    {"do4", 261.6255653},
-    {"do4#", 277.182631},
-    {"re4", 293.6647679},
-    {"re4#", 311.1269837},
-    {"mi4", 329.6275569},
-    {"fa4", 349.2282314},
-    {"fa4#", 369.9944227},
-    {"sol4", 391.995436},
-    {"sol4#", 415.3046976},
-    {"la4", 440},
-    {"la4#", 466.1637615},
-    {"si4", 493.8833013},
-
-    {"do5", 523.2511306},
-    {"do5#", 554.365262},
-    {"re5", 587.3295358},
-    {"re5#", 622.2539674},
-    {"mi5", 659.2551138},
-    {"fa5", 698.4564629},
-    {"fa5#", 739.9888454},
-    {"sol5", 783.990872},
-    {"sol5#", 830.6093952},
-    {"la5", 880},
-    {"la5#", 932.327523},
-    {"si5", 987.7666025}};
-
-dsp_client::dsp_client() : current_mode(Mode::Passthrough), volume(1.0), energy_window_size(0.5), energy_mode(false), period_mode(false), period_minfreq(60.0), period_maxfreq(600.0), period_minlevel(0.5), period_window_size(0.5), period_ringsize(0.5), period(-1), second_period(-1), freq_tuned(-1), note_tuned(""), frequency_difference(0.5) {}
-
-dsp_client::~dsp_client() {}
+#include "simd_kernels.h"
+
+// Time to reach a new volume, in seconds
+static constexpr float volume_ramp_time = 0.02f;
+
+// Crossfade between modes, in seconds
+static constexpr float mode_fade_time = 0.01f;
+
+// Pending control commands
+static constexpr std::size_t command_capacity = 256;
+
+// Stream buffers dropped by process() and not freed yet
+static constexpr std::size_t retired_capacity = 8;
+
+// Largest decimation chosen for the pitch analysis
+static constexpr unsigned int max_decimation = 8;
+
+// Highest frequency left by the decimator, relative to the analysis rate.
+// A maximum frequency raised above it while running is searched up to it.
+static constexpr float passband = 0.4f;
+
+// The autocorrelation takes the first peak at least this fraction of the
+// highest one, which may be at a multiple of the period
+static constexpr float key_peak = 0.9f;
+
+// Samples waiting for the STFT, in seconds (at least two FFT lengths)
+static constexpr float spectrum_ring_time = 0.25f;
+
+dsp_client::dsp_client() : requested{Mode::Passthrough, 1.0, false, false, 0.5, 60.0, 600.0, 0.5, CorrelationEngine::FFT, PitchDetector::Autocorrelation, 440.0, false, false, 0}, active(requested), sizing(requested), gain(1.0), fade_mode(Mode::Passthrough), fade_length(0), fade_position(0), num_channels(0), stream(nullptr), live(nullptr), pending(nullptr), autotune_latency(0), period_window_size(0.5), period_ringsize(0.5), period_decimation(0), decimation(1), analysis_rate(0), capturing_frames(false), data_ready(0), analysis_running(false), analysis_threads(1), scratch(1), spectrum_size(4096), spectrum_hop(1024), spectrum_bands(3) {
+    commands.reset(command_capacity);
+    retired.reset(retired_capacity);
+    analysis_settings.publish(active);
+    resize_channels(1);
+}
+
+dsp_client::~dsp_client() {
+    stop_analysis();
+}
+
+void dsp_client::resize_channels(unsigned int channels) {
+    // The analysis threads hold references to the per-channel state
+    stop_analysis();
+    num_channels = channels;
+
+    accumulated_energy.assign(channels, 0);
+    accumulated_power.assign(channels, 0);
+    energy_updates.assign(channels, 0);
+    energy_results = std::make_unique<dsp::snapshot<EnergyResult>[]>(channels);
+    for (unsigned int c = 0; c < channels; ++c)
+        energy_results[c].publish({0, 0});
+
+    period.assign(channels, -1);
+    second_period.assign(channels, -1);
+    confidence.assign(channels, 0);
+    ring_buffer = std::make_unique<dsp::mirrored_ring[]>(channels);
+    decimators = std::make_unique<dsp::decimator[]>(channels);
+    sliding_correlation = std::make_unique<dsp::sliding_autocorrelation[]>(channels);
+    correlation_signal.resize(channels);
+    // Nothing is captured before the first block above the level
+    fail_counter_energy.assign(channels, std::numeric_limits<unsigned int>::max());
+    ring_reset = std::make_unique<std::atomic<bool>[]>(channels);
+
+    synth.assign(channels, dsp::oscillator());
+    ring_buffer_energy.assign(channels, 0);
+    freq_tuned.assign(channels, -1);
+    note_tuned.assign(channels, -1);
+    frequency_difference.assign(channels, 0.5);
+    cents.assign(channels, 0);
+
+    results = std::make_unique<dsp::snapshot<PeriodResult>[]>(channels);
+    for (unsigned int c = 0; c < channels; ++c)
+        results[c].publish({-1, -1, 0, 0, -1, -1, 0.5, 0});
+    spectrum = std::make_unique<dsp::stft_analyzer[]>(channels);
+    spectra = std::make_unique<dsp::snapshot<dsp::spectrum_frame>[]>(channels);
+    loudness.prepare(channels);
+    loudness_result.publish(loudness.reading());
+
+    // Nothing calls process() yet: start over with empty stream
+    // buffers, sized by prepare()
+    pending.store(nullptr, std::memory_order_relaxed);
+    retired.consume([](StreamBuffers *const *, std::size_t) {});
+    streams.clear();
+    streams.push_back(make_stream(0, 0));
+    stream = streams.back().get();
+    live.store(stream, std::memory_order_release);
+}
+
+std::unique_ptr<dsp_client::StreamBuffers> dsp_client::make_stream(jack_nframes_t sample_rate,
+                                                                   jack_nframes_t nframes) const {
+    auto next = std::make_unique<StreamBuffers>();
+    next->sample_rate = sample_rate;
+    next->buffer_size = nframes;
+    next->energy_queue.resize(num_channels);
+    next->power_queue.resize(num_channels);
+    next->fade_buffer.resize(num_channels);
+    next->sample_ring = std::make_unique<dsp::spsc_ring<float>[]>(num_channels);
+    next->spectrum_ring = std::make_unique<dsp::spsc_ring<float>[]>(num_channels);
+    next->shifter.resize(num_channels);
+    if (sample_rate == 0 || nframes == 0) {
+        return next;
+    }
+
+    const int size_buffer = sizing.energy_window_size * sample_rate / nframes;
+    // A ring shorter than a block would drop its end, and the analysis
+    // would find the period of the splice; two leave the analysis a
+    // block to catch up
+    const std::size_t capacity_ring_buffer =
+        std::max(static_cast<std::size_t>(period_ringsize * sample_rate), 2 * static_cast<std::size_t>(nframes));
+    // Longest period that calculate_period() can find
+    const std::size_t max_lag = static_cast<std::size_t>(sample_rate / sizing.period_minfreq);
+    const std::size_t capacity_spectrum = std::max(static_cast<std::size_t>(spectrum_ring_time * sample_rate),
+                                                   2 * spectrum_size);
+    for (unsigned int c = 0; c < num_channels; ++c) {
+        next->energy_queue[c].set_capacity(size_buffer);
+        next->power_queue[c].set_capacity(size_buffer);
+        next->fade_buffer[c].assign(nframes, 0.0f);
+        next->sample_ring[c].reset(capacity_ring_buffer);
+        next->spectrum_ring[c].reset(capacity_spectrum);
+        next->shifter[c].prepare(max_lag);
+    }
+    next->fade_length = static_cast<std::size_t>(mode_fade_time * sample_rate);
+    return next;
+}
+
+void dsp_client::prepare_analysis(jack_nframes_t sample_rate) {
+    // The detector never looks above period_maxfreq: analyze at a rate
+    // just high enough for it
+    decimation = period_decimation > 0
+                     ? period_decimation
+                     : dsp::decimator::factor_for(sample_rate, sizing.period_maxfreq, max_decimation);
+    analysis_rate = static_cast<float>(sample_rate) / decimation;
+
+    const int capacity_ring_buffer = static_cast<int>(period_ringsize * analysis_rate);
+    const int window_size = static_cast<int>(period_window_size * analysis_rate);
+    const std::size_t max_lag = static_cast<std::size_t>(analysis_rate / sizing.period_minfreq);
+    for (unsigned int c = 0; c < num_channels; ++c) {
+        decimators[c].prepare(decimation);
+        ring_buffer[c].reset(capacity_ring_buffer);
+        correlation_signal[c].assign(window_size, 0.0f);
+        // One more lag for the interpolation of the detectors
+        sliding_correlation[c].prepare(window_size, max_lag + 1);
+        spectrum[c].prepare(sample_rate, spectrum_size, spectrum_hop, spectrum_bands);
+        // Readers get the bands before the first frame
+        spectra[c].publish(spectrum[c].frame());
+    }
+    for (AnalysisScratch &work : scratch) {
+        work.fft_correlation.prepare(window_size);
+        // With the sliding engine they also read the history of the
+        // first pair ends
+        work.yin.prepare(window_size + max_lag + 1);
+        work.mpm.prepare(window_size + max_lag + 1);
+    }
+}
+
+void dsp_client::install_stream(std::unique_ptr<StreamBuffers> next) {
+    StreamBuffers *const incoming = next.get();
+    autotune_latency.store(incoming->shifter.empty() ? 0 : incoming->shifter[0].latency(),
+                           std::memory_order_relaxed);
+    streams.push_back(std::move(next));
+
+    // A set that process() did not take yet is replaced and freed here
+    StreamBuffers *const stale = pending.exchange(incoming, std::memory_order_acq_rel);
+    if (stale != nullptr) {
+        std::erase_if(streams, [stale](const std::unique_ptr<StreamBuffers> &s) { return s.get() == stale; });
+    }
+    if (!realtime()) {
+        // process() runs on this same thread, between these calls
+        adopt_stream();
+        reclaim_streams();
+    }
+}
+
+void dsp_client::adopt_stream() {
+    StreamBuffers *const next = pending.exchange(nullptr, std::memory_order_acq_rel);
+    if (next == nullptr) {
+        return;
+    }
+    // A new buffer size alone keeps the loudness filters going
+    if (next->sample_rate != 0 && (stream == nullptr || next->sample_rate != stream->sample_rate)) {
+        loudness.set_sample_rate(next->sample_rate);
+    }
+    // The analysis threads must see the new set before the old one can
+    // be freed.  If retired is full the set is only freed with the
+    // client, but never here
+    live.store(next, std::memory_order_release);
+    if (stream != nullptr) {
+        retired.push(&stream, 1);
+    }
+    stream = next;
+
+    // The energy windows start empty
+    std::fill(accumulated_energy.begin(), accumulated_energy.end(), 0.0);
+    std::fill(accumulated_power.begin(), accumulated_power.end(), 0.0);
+    std::fill(energy_updates.begin(), energy_updates.end(), 0);
+    for (unsigned int c = 0; c < num_channels; ++c)
+        energy_results[c].publish({0, 0});
+    fade_length = next->fade_length;
+    fade_position = fade_length;
+}
+
+void dsp_client::reclaim_streams() {
+    retired.consume([this](StreamBuffers *const *const old, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            std::erase_if(streams, [old, i](const std::unique_ptr<StreamBuffers> &s) { return s.get() == old[i]; });
+        }
+    });
+}
+
+void dsp_client::format_changed() {
+    std::lock_guard<std::mutex> lock(reconfiguration);
+    // Before prepare() there is nothing to resize
+    if (capturing_frames.load(std::memory_order_acquire)) {
+        reconfigure();
+    }
+}
+
+void dsp_client::update_sizing() {
+    std::lock_guard<std::mutex> lock(reconfiguration);
+    sizing = requested;
+    // Until the new buffers are in, process() and the analysis cap the
+    // new values to the old sizes
+    if (capturing_frames.load(std::memory_order_acquire)) {
+        reconfigure();
+    }
+}
+
+void dsp_client::reconfigure() {
+    const jack_nframes_t sample_rate = jack::client::get_sample_rate();
+    const jack_nframes_t nframes = jack::client::get_buffer_size();
+
+    // The analysis threads may still read the sets dropped by process()
+    // and own the analysis buffers; process() keeps running meanwhile,
+    // its captured samples just wait in the sample rings
+    const bool threaded = analysis_running.load(std::memory_order_acquire);
+    stop_analysis();
+    reclaim_streams();
+    prepare_analysis(sample_rate);
+    install_stream(make_stream(sample_rate, nframes));
+    if (threaded) {
+        start_analysis();
+    }
+}
 
 jack::client_state dsp_client::init() {
-    jack::client_state state = jack::client::init();
+    resize_channels(get_channels());
+    return prepare(jack::client::init());
+}
+
+jack::client_state dsp_client::init(jack::backend &backend) {
+    resize_channels(get_channels());
+    return prepare(jack::client::init(backend));
+}
+
+jack::client_state dsp_client::prepare(jack::client_state state) {
 
-    std::cout << "energia " << energy_window_size << std::endl;
-    std::cout << "freq min " << period_minfreq << std::endl;
-    std::cout << "freq max " << period_maxfreq << std::endl;
-    std::cout << "min level " << period_minlevel << std::endl;
+    std::cout << "energia " << active.energy_window_size << std::endl;
+    std::cout << "freq min " << active.period_minfreq << std::endl;
+    std::cout << "freq max " << active.period_maxfreq << std::endl;
+    std::cout << "min level " << active.period_minlevel << std::endl;
     std::cout << "window size " << period_window_size << std::endl;
     std::cout << "ring size " << period_ringsize << std::endl;
+    std::cout << "channels " << num_channels << std::endl;
 
     jack_nframes_t sample_rate = jack::client::get_sample_rate();
     jack_nframes_t nframes = jack::client::get_buffer_size();
 
     if (state == jack::client_state::Running) {
-        int size_buffer = energy_window_size * sample_rate / nframes;
-        int capacity_ring_buffer = static_cast<int>(
-            period_ringsize * sample_rate);
-        int window_size = static_cast<int>(
-            period_window_size * sample_rate);
+        int size_buffer = active.energy_window_size * sample_rate / nframes;
         std::cout << "Buffer size Energy and Power: "
                   << size_buffer << std::endl;
+        // No more threads than channels: a channel is never split
+        analysis_threads = std::clamp(analysis_threads, 1u, num_channels);
+        scratch.resize(analysis_threads);
+        // A format change from now on waits for the analysis to start
+        std::lock_guard<std::mutex> lock(reconfiguration);
+        reconfigure();
+        std::cout << "Period decimation: " << decimation << " ("
+                  << analysis_rate << " Hz)" << std::endl;
         std::cout << "Capacity ring buffer Period: "
-                  << capacity_ring_buffer << std::endl;
-        std::cout << "Window size Period: " << window_size << std::endl;
-        energy_queue.set_capacity(size_buffer);
-        power_queue.set_capacity(size_buffer);
-        ring_buffer.set_capacity(capacity_ring_buffer);
-        correlation_signal.set_capacity(window_size);
+                  << ring_buffer[0].capacity() << std::endl;
+        std::cout << "Window size Period: " << correlation_signal[0].size() << std::endl;
+        std::cout << "Autotune latency: " << get_autotune_latency()
+                  << " samples" << std::endl;
+        capturing_frames.store(true, std::memory_order_release);
+        // Offline backends call analyze() themselves, in step with process()
+        if (realtime()) {
+            start_analysis();
+        }
     }
     return state;
 }
 
-void ::dsp_client::process_passthrough(jack_nframes_t nframes,
-                                       const sample_t *const in,
-                                       sample_t *const out) {
-    memcpy(out, in, sizeof(sample_t) * nframes);
-}
-
-void dsp_client::process_volume_change(jack_nframes_t nframes,
-                                       const sample_t *const in,
-                                       sample_t *const out) {
-    for (jack_nframes_t i = 0; i < nframes; i++) {
-        out[i] = in[i] * volume;
+template <typename... Analysis>
+void dsp_client::render(Mode mode,
+                        unsigned int channel,
+                        jack_nframes_t nframes,
+                        const sample_t *const in,
+                        sample_t *const out,
+                        Analysis &...analysis) {
+    switch (mode) {
+        case Mode::Passthrough:
+            dsp::run(in, out, nframes, analysis...);
+            break;
+        case Mode::VolumeChange:
+        case Mode::Tuner:
+            // The constant gain is the common case, and the cheaper chain
+            if (gain.ramping()) {
+                dsp::run(in, out, nframes, analysis..., dsp::ramp_stage(gain));
+            } else {
+                dsp::run(in, out, nframes, analysis..., dsp::gain_stage(gain.value()));
+            }
+            break;
+        case Mode::Repeater:
+            dsp::measure(in, nframes, analysis...);
+            process_repeater(channel, nframes, out);
+            break;
+        case Mode::Autotune:
+            // The shifter works on whole blocks
+            dsp::measure(in, nframes, analysis...);
+            process_autotune(channel, nframes, in, out);
+            break;
+        default:
+            break;
     }
 }
 
-void dsp_client::calculate_energy_and_power(jack_nframes_t nframes,
-                                            const sample_t *const signal) {
+void dsp_client::calculate_energy_and_power(unsigned int channel,
+                                            jack_nframes_t nframes,
+                                            float energy) {
     // Check if energy mode is on
-    if (!energy_mode)
+    if (!active.energy_mode)
         return;
-    //  Caculate energy
-    float energy = 0.0;
-    for (jack_nframes_t i = 0; i < nframes; i++)
-        energy += signal[i] * signal[i];
+
+    boost::circular_buffer<float> &energies = stream->energy_queue[channel];
+    boost::circular_buffer<float> &powers = stream->power_queue[channel];
+    if (energies.capacity() == 0) {
+        return;  // Not prepared yet
+    }
+
+    // Until a new format is swapped in, the window may be longer than
+    // the queue: drop the oldest block before it is overwritten
+    if (energies.full()) {
+        accumulated_energy[channel] -= energies.front();
+        energies.pop_front();
+        accumulated_power[channel] -= powers.front();
+        powers.pop_front();
+    }
 
     // Add the actual energy to queue and update the accumalated energy
-    energy_queue.push_back(energy);
+    energies.push_back(energy);
 
-    accumulated_energy += energy;
-    power_queue.push_back(energy / nframes);
-    accumulated_power += energy / nframes;
+    accumulated_energy[channel] += energy;
+    powers.push_back(energy / nframes);
+    accumulated_power[channel] += energy / nframes;
 
     // Get the sample rate
     jack_nframes_t sample_rate = jack::client::get_sample_rate();
 
     // If the queue is full, remove the first element
-    while (energy_queue.size() + 1 > energy_window_size * sample_rate / nframes) {
-        accumulated_energy -= energy_queue.front();
-        energy_queue.pop_front();
-        accumulated_power -= power_queue.front();
-        power_queue.pop_front();
+    while (!energies.empty() && energies.size() + 1 > active.energy_window_size * sample_rate / nframes) {
+        accumulated_energy[channel] -= energies.front();
+        energies.pop_front();
+        accumulated_power[channel] -= powers.front();
+        powers.pop_front();
+    }
+
+    // Once per window, start the sums over from what the queues hold
+    if (++energy_updates[channel] >= energies.capacity()) {
+        energy_updates[channel] = 0;
+        accumulated_energy[channel] = std::accumulate(energies.begin(), energies.end(), 0.0);
+        accumulated_power[channel] = std::accumulate(powers.begin(), powers.end(), 0.0);
     }
+    energy_results[channel].publish({static_cast<float>(accumulated_energy[channel]),
+                                     static_cast<float>(accumulated_power[channel])});
 }
 
 bool dsp_client::process(jack_nframes_t nframes, const sample_t *const in,
                          sample_t *const out) {
-    switch (current_mode) {
-        case Mode::Passthrough:
-            process_passthrough(nframes, in, out);
+    return process(nframes, 1, &in, &out);
+}
+
+bool dsp_client::process(jack_nframes_t nframes, unsigned int channels,
+                         const sample_t *const *const in,
+                         sample_t *const *const out) {
+    // Channels without state (more ports than configured) are silenced
+    for (unsigned int c = num_channels; c < channels; ++c) {
+        memset(out[c], 0, sizeof(sample_t) * nframes);
+    }
+    channels = std::min(channels, num_channels);
+
+    adopt_stream();
+    drain_commands();
+
+    // The previous mode fades out over the first blocks of a new one
+    const bool fading = fade_position < fade_length &&
+                        channels > 0 && nframes <= stream->fade_buffer[0].size();
+
+    // The block energy is shared by both measurements
+    const bool measuring = active.energy_mode || active.period_mode;
+    for (unsigned int c = 0; c < channels; ++c) {
+        dsp::energy_meter meter;
+        if (measuring) {
+            render(active.mode, c, nframes, in[c], out[c], meter);
+        } else {
+            render(active.mode, c, nframes, in[c], out[c]);
+        }
+        if (fading) {
+            float *const previous = stream->fade_buffer[c].data();
+            render(fade_mode, c, nframes, in[c], previous);
+            for (jack_nframes_t i = 0; i < nframes; ++i) {
+                const float w = std::min(1.0f, static_cast<float>(fade_position + i + 1) / fade_length);
+                out[c][i] = previous[i] + w * (out[c][i] - previous[i]);
+            }
+        }
+        const float energy = measuring ? meter.energy() : 0.0f;
+        calculate_energy_and_power(c, nframes, energy);
+        get_data_period(c, nframes, in[c], energy);
+        if (active.spectrum_mode && capturing_frames.load(std::memory_order_acquire)) {
+            stream->spectrum_ring[c].push(in[c], nframes);
+        }
+    }
+    if (active.loudness_mode && stream->sample_rate != 0 &&
+        loudness.process(in, channels, nframes) > 0) {
+        loudness_result.publish(loudness.reading());
+    }
+    recorder.record(nframes, channels, in, out);
+    gain.advance(nframes);
+    fade_position = fading ? std::min<std::size_t>(fade_position + nframes, fade_length)
+                           : fade_length;
+
+    // One wake-up for all the channels
+    if ((active.period_mode || active.spectrum_mode) &&
+        capturing_frames.load(std::memory_order_acquire)) {
+        wake_analysis();
+    }
+    return true;  // false if an error occurred
+}
+
+void dsp_client::update(Settings &settings, const Command &command) {
+    const float value = command.value;
+    switch (command.type) {
+        case Command::Type::Mode:
+            settings.mode = static_cast<Mode>(static_cast<int>(value));
             break;
-        case Mode::VolumeChange:
-            process_volume_change(nframes, in, out);
+        case Command::Type::Volume:
+            settings.volume = value;
             break;
-        case Mode::Repeater:
-            process_repeater(nframes, out);
+        case Command::Type::EnergyMode:
+            settings.energy_mode = value != 0;
+            settings.period_mode = false;
             break;
-        case Mode::Tuner:
-            process_passthrough(nframes, in, out);
+        case Command::Type::PeriodMode:
+            settings.period_mode = value != 0;
+            settings.energy_mode = false;
             break;
-        case Mode::Autotune:
-            process_autotune(nframes, out);
+        case Command::Type::EnergyWindow:
+            settings.energy_window_size = value;
             break;
-        default:
+        case Command::Type::MinFreq:
+            settings.period_minfreq = value;
+            break;
+        case Command::Type::MaxFreq:
+            settings.period_maxfreq = value;
+            break;
+        case Command::Type::MinLevel:
+            settings.period_minlevel = value;
+            break;
+        case Command::Type::Engine:
+            settings.correlation_engine = static_cast<CorrelationEngine>(static_cast<int>(value));
+            break;
+        case Command::Type::Detector:
+            settings.detector = static_cast<PitchDetector>(static_cast<int>(value));
+            break;
+        case Command::Type::ReferencePitch:
+            settings.reference_pitch = value;
+            break;
+        case Command::Type::SpectrumMode:
+            settings.spectrum_mode = value != 0;
+            break;
+        case Command::Type::LoudnessMode:
+            settings.loudness_mode = value != 0;
+            break;
+        case Command::Type::LoudnessReset:
+            ++settings.loudness_resets;
             break;
     }
-    calculate_energy_and_power(nframes, in);
-    get_data_period(nframes, in);
-    return true;  // false if an error occurred
+}
+
+void dsp_client::control(Command::Type type, float value) {
+    const Command command{type, value};
+    update(requested, command);
+
+    if (state() != jack::client_state::Running) {
+        // Nobody calls process(): take the change right away
+        const Settings previous = active;
+        update(active, command);
+        gain.reset(active.volume);
+        apply_settings(previous);
+        fade_position = fade_length;
+        return;
+    }
+    if (commands.push(&command, 1) == 0) {
+        std::cerr << "W> Control queue full, command dropped" << std::endl;
+    }
+}
+
+void dsp_client::drain_commands() {
+    const Settings previous = active;
+    const std::size_t n = commands.consume([this](const Command *const queued, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i)
+            update(active, queued[i]);
+    });
+    if (n == 0) {
+        return;
+    }
+
+    jack_nframes_t sample_rate = jack::client::get_sample_rate();
+    if (active.volume != gain.target()) {
+        gain.set_target(active.volume, static_cast<std::size_t>(volume_ramp_time * sample_rate));
+    }
+    if (active.mode != previous.mode) {
+        fade_mode = previous.mode;
+        fade_position = 0;
+    }
+    apply_settings(previous);
+    // Let the analysis threads publish the new state, e.g. no period
+    // once the period mode is off
+    wake_analysis();
+}
+
+void dsp_client::apply_settings(const Settings &previous) {
+    if (active.reference_pitch != previous.reference_pitch) {
+        tuning.set_reference(active.reference_pitch);
+    }
+    if ((active.loudness_mode && !previous.loudness_mode) ||
+        active.loudness_resets != previous.loudness_resets) {
+        loudness.reset();
+        loudness_result.publish(loudness.reading());
+    }
+    analysis_settings.publish(active);
 }
 
 void dsp_client::change_mode(Mode new_mode) {
-    current_mode = new_mode;
+    control(Command::Type::Mode, static_cast<float>(new_mode));
 }
 
 void dsp_client::adjust_volume(float delta) {
-    volume += delta;
-    if (volume > 10.0f)
-        volume = 10.0f;
-    if (volume < 0.0f)
-        volume = 0.0f;
+    control(Command::Type::Volume, std::clamp(requested.volume + delta, 0.0f, 10.0f));
+}
+
+void dsp_client::set_volume(float volume) {
+    control(Command::Type::Volume, std::clamp(volume, 0.0f, 10.0f));
 }
 
-void dsp_client::get_data_period(jack_nframes_t nframes,
-                                 const sample_t *const signal) {
+void dsp_client::reset_volume() {
+    control(Command::Type::Volume, 1.0f);
+}
+
+void dsp_client::get_data_period(unsigned int channel,
+                                 jack_nframes_t nframes,
+                                 const sample_t *const signal,
+                                 float energy) {
     // Si no estamos en el modo de cálculo del período, salimos de la función
-    if (!period_mode) {
-        if (ring_buffer.size() > 0) {
-            ring_buffer.clear();
-        }
+    // (el hilo de análisis vacía el ring buffer por su cuenta)
+    if (!active.period_mode || !capturing_frames.load(std::memory_order_acquire)) {
         return;
     }
-    jack_nframes_t sample_rate = jack::client::get_sample_rate();
-    // Cálculo de la energía de la señal actual
-    float energy = 0.0;
-    for (jack_nframes_t i = 0; i < nframes; i++)
-        energy += signal[i] * signal[i];
-    // Verificación del nivel mínimo de energía para comenzar la captura
-    if (energy >= period_minlevel) {
-        // Store the signal in bufer circular
-        for (jack_nframes_t i = 0; i < nframes; ++i)
-            ring_buffer.push_back(signal[i]);
-        fail_counter_energy = 0;
+    // Verificación del nivel mínimo de energía para comenzar la captura.
+    // Quiet blocks are captured for 0.1 s after the last loud one: a
+    // small block can fall on the quiet part of a long period, and
+    // leaving it out would splice the waveform in the ring
+    const unsigned int hold = jack::client::get_sample_rate() / 10;
+    if (energy >= active.period_minlevel) {
+        fail_counter_energy[channel] = 0;
+    } else if (fail_counter_energy[channel] <= hold) {
+        fail_counter_energy[channel] += nframes;
+    }
+    if (fail_counter_energy[channel] <= hold) {
+        // Hand the samples over to the analysis thread
+        stream->sample_ring[channel].push(signal, nframes);
     } else {
-        fail_counter_energy += nframes;
+        ring_reset[channel].store(true, std::memory_order_relaxed);
     }
-    if (fail_counter_energy / sample_rate > 0.1) {
-        ring_buffer.clear();
+}
+
+void dsp_client::wake_analysis() {
+    data_ready.fetch_add(1, std::memory_order_release);
+    data_ready.notify_all();
+}
+
+void dsp_client::analysis_loop(unsigned int worker) {
+    unsigned int seen = data_ready.load(std::memory_order_acquire);
+    while (analysis_running.load(std::memory_order_acquire)) {
+        // Sleep until process() signals new samples
+        data_ready.wait(seen, std::memory_order_acquire);
+        seen = data_ready.load(std::memory_order_acquire);
+        analyze(worker, analysis_threads, scratch[worker]);
+        if (results_listener && scratch[worker].settings.period_mode) {
+            results_listener();
+        }
     }
 }
 
-void dsp_client::set_energy_mode(bool mode) {
-    energy_mode = mode;
-    if (period_mode) {
-        period_mode = false;
+void dsp_client::start_analysis() {
+    if (analysis_running.exchange(true)) {
+        return;
+    }
+    for (unsigned int w = 0; w < analysis_threads; ++w) {
+        analysis_pool.emplace_back(&dsp_client::analysis_loop, this, w);
     }
 }
 
-void dsp_client::set_period_mode(bool mode) {
-    period_mode = mode;
-    if (energy_mode) {
-        energy_mode = false;
+void dsp_client::stop_analysis() {
+    if (!analysis_running.exchange(false)) {
+        return;
+    }
+    wake_analysis();
+    for (std::thread &t : analysis_pool) {
+        t.join();
+    }
+    analysis_pool.clear();
+}
+
+void dsp_client::set_analysis_threads(unsigned int threads) {
+    analysis_threads = std::max(threads, 1u);
+}
+
+void dsp_client::analyze() {
+    analyze(0, 1, scratch[0]);
+}
+
+void dsp_client::analyze(unsigned int first_channel, unsigned int step,
+                         AnalysisScratch &work) {
+    work.settings = analysis_settings.read();
+    if (work.tuning.get_reference() != work.settings.reference_pitch) {
+        work.tuning.set_reference(work.settings.reference_pitch);
+    }
+    StreamBuffers *const input = live.load(std::memory_order_acquire);
+
+    for (unsigned int c = first_channel; c < num_channels; c += step) {
+        // Too long without sound: start capturing from scratch
+        if (ring_reset[c].exchange(false, std::memory_order_relaxed)) {
+            ring_buffer[c].clear();
+            sliding_correlation[c].clear();
+            decimators[c].reset();
+        }
+
+        // The sliding sums follow every block, or start over once the
+        // engine is selected again
+        dsp::mirrored_ring &ring = ring_buffer[c];
+        dsp::sliding_autocorrelation &sums = sliding_correlation[c];
+        const bool sliding = work.settings.correlation_engine == CorrelationEngine::Sliding;
+        if (!sliding) {
+            sums.clear();
+        }
+        input->sample_ring[c].consume([&](const float *const data, std::size_t n) {
+            decimators[c].process(data, n, [&](const float *const decimated, std::size_t m) {
+                ring.push(decimated, m);
+                if (sliding) {
+                    sums.push(decimated, m);
+                }
+            });
+        });
+
+        calculate_period(c, work);
+        process_tuner(c, work);
+
+        results[c].publish({period[c], second_period[c], confidence[c], ring_buffer_energy[c],
+                            freq_tuned[c], note_tuned[c], frequency_difference[c],
+                            cents[c]});
+
+        analyze_spectrum(c, work.settings, input);
+    }
+}
+
+void dsp_client::analyze_spectrum(unsigned int channel, const Settings &settings,
+                                  StreamBuffers *input) {
+    dsp::stft_analyzer &stft = spectrum[channel];
+    dsp::snapshot<dsp::spectrum_frame> &published = spectra[channel];
+    if (!settings.spectrum_mode) {
+        // Drop what was captured before the mode went off, and start
+        // with a fresh history when it comes back
+        input->spectrum_ring[channel].consume([](const float *const, std::size_t) {});
+        stft.clear();
+        return;
     }
+    input->spectrum_ring[channel].consume([&](const float *const data, std::size_t n) {
+        stft.push(data, n, [&published](const dsp::spectrum_frame &frame) {
+            published.publish(frame);
+        });
+    });
+}
+
+void dsp_client::set_energy_mode(bool mode) {
+    control(Command::Type::EnergyMode, mode);
+}
+
+void dsp_client::set_period_mode(bool mode) {
+    control(Command::Type::PeriodMode, mode);
 }
 
 void dsp_client::calculate_period() {
-    if (!period_mode) {
-        period = -1;
-        second_period = -1;
-        correlation_signal.clear();
-        ring_buffer.clear();
-        counter_repeater = 0;
-        ring_buffer_energy = 0;
+    scratch[0].settings = analysis_settings.read();
+    for (unsigned int c = 0; c < num_channels; ++c)
+        calculate_period(c, scratch[0]);
+}
+
+void dsp_client::calculate_period(unsigned int channel, AnalysisScratch &work) {
+    dsp::mirrored_ring &ring = ring_buffer[channel];
+    std::vector<float> &correlation = correlation_signal[channel];
+    const Settings &settings = work.settings;
+
+    if (!settings.period_mode) {
+        period[channel] = -1;
+        second_period[channel] = -1;
+        confidence[channel] = 0;
+        ring.clear();
+        sliding_correlation[channel].clear();
+        ring_buffer_energy[channel] = 0;
+        return;
+    }
+    if (settings.detector != PitchDetector::Autocorrelation) {
+        detect_period(channel, work);
         return;
     }
     // Get the size of the ring buffer
-    int ring_buffer_size = ring_buffer.size();
-    // Get the capacity of the correlation signal
-    int windowsize = correlation_signal.capacity();
+    int ring_buffer_size = ring.size();
+    // Get the size of the correlation signal
+    int windowsize = correlation.size();
 
     // Get the i and n values for the autocorrelation
     int i = ring_buffer_size / 2;
@@ -226,42 +746,65 @@ void dsp_client::calculate_period() {
         n = ring_buffer_size;
     }
 
+    // The sliding sums cover the last windowsize samples on their own
+    const bool sliding = settings.correlation_engine == CorrelationEngine::Sliding;
+    const dsp::sliding_autocorrelation &sums = sliding_correlation[channel];
+
     // If even that is not enough, exit
-    if (i < 0) {
-        period = -1;
-        second_period = -1;
-        correlation_signal.clear();
-        counter_repeater = 0;
-        ring_buffer_energy = 0;
+    if (sliding ? !sums.full() : i < 0) {
+        period[channel] = -1;
+        second_period[channel] = -1;
+        confidence[channel] = 0;
+        ring_buffer_energy[channel] = 0;
         return;
     }
 
     // energy_buffer ring_buffer
-    for (int k = 0; k < ring_buffer.size(); k++) {
-        ring_buffer_energy += ring_buffer[k] * ring_buffer[k];
-    }
+    // Scaled back to the input rate, so that the repeater plays at the
+    // same level whatever the decimation
+    const std::span<const float> stored = ring.samples();
+    ring_buffer_energy[channel] = decimation * dsp::sum_squares(stored.data(), stored.size());
 
-    float sample_rate = jack::client::get_sample_rate();
+    const float sample_rate = analysis_rate;
+    const float max_frequency = std::min(settings.period_maxfreq, passband * sample_rate);
     // Store the first and second peaks
     float first_peak_value = -1.0f;
     int first_peak_lag = -1;
     float second_peak_value = -1.0f;
     int second_peak_lag = -1;
 
+    // The window is contiguous even if it wraps around the ring.  With
+    // the FFT engine all lags are computed at once; with the direct
+    // engine each lag is a single vectorized dot product.  The sliding
+    // engine has them ready, up to the longest period in range.
+    const std::span<const float> window = sliding ? sums.samples() : ring.window(i, n - i);
+    if (settings.correlation_engine == CorrelationEngine::FFT) {
+        work.fft_correlation.compute(window.begin(), window.end());
+    }
+    // correlation has a lag per sample of the window, which can be
+    // shorter than the longest period the sliding sums keep
+    const int last_lag = sliding ? std::min(static_cast<int>(sums.max_lag()), windowsize) : n - i;
+
     // Calculate the autocorrelation starting at 'i' and ending at 'n'
     // Init in lag=1 to avoid the peak in lag=0
-    for (int lag = 1; lag <= n - i; ++lag) {
+    for (int lag = 1; lag <= last_lag; ++lag) {
         float sum = 0.0f;
-        for (int j = i; j < n - lag; ++j) {
-            sum += ring_buffer[j] * ring_buffer[j + lag];
+        if (settings.correlation_engine == CorrelationEngine::FFT) {
+            sum = static_cast<float>(work.fft_correlation.lag(lag));
+        } else if (sliding) {
+            // Every lag of the sums has windowsize pairs; taper them as
+            // the window ones so that the first peak still wins
+            sum = static_cast<float>(sums.lag(lag) * (windowsize - lag) / windowsize);
+        } else {
+            sum = dsp::dot(window.data(), window.data() + lag, n - i - lag);
         }
-        correlation_signal.push_back(sum);  // Push correlation signal
+        correlation[lag - 1] = sum;  // Store correlation signal
 
         // Calculate the frequency of the peak
         float freq = sample_rate / static_cast<float>(lag);
 
         // Check if frq is in range
-        if (period_minfreq <= freq && freq <= period_maxfreq) {
+        if (settings.period_minfreq <= freq && freq <= max_frequency) {
             // Find the first peak
             if (first_peak_value < 0 || sum > first_peak_value) {
                 second_peak_value = first_peak_value;
@@ -277,112 +820,230 @@ void dsp_client::calculate_period() {
         }
     }
 
+    // When the period falls between two lags, the peak at its double or
+    // triple can come out higher than its own: prefer the first local
+    // maximum near the highest, as the MPM detector does.  The highest
+    // becomes the second peak then, so second_period is the multiple of
+    // the period that won rather than the runner-up
+    if (first_peak_lag > 1 && first_peak_value > 0) {
+        const float threshold = key_peak * first_peak_value;
+        for (int lag = std::max(2, static_cast<int>(std::ceil(sample_rate / max_frequency)));
+             lag < first_peak_lag; ++lag) {
+            const float value = correlation[lag - 1];
+            if (value >= threshold && value >= correlation[lag - 2] && value >= correlation[lag]) {
+                second_peak_value = first_peak_value;
+                second_peak_lag = first_peak_lag;
+                first_peak_value = value;
+                first_peak_lag = lag;
+                break;
+            }
+        }
+    }
+
     //  Check if the two peaks are "more or less equal"
+    confidence[channel] = 0;
     if (first_peak_value >= 0 && second_peak_value >= 0) {
         float ratio = second_peak_value / first_peak_value;
         if (ratio >= 0.8 && ratio <= 1.2) {
-            period = static_cast<float>(first_peak_lag) / sample_rate;
-            second_period = static_cast<float>(second_peak_lag) / sample_rate;
+            // Parabola through the peak and its neighbours: at a
+            // decimated rate a whole lag is too coarse a period
+            float lag = static_cast<float>(first_peak_lag);
+            if (first_peak_lag > 1 && first_peak_lag < last_lag) {
+                const float before = correlation[first_peak_lag - 2];
+                const float peak = correlation[first_peak_lag - 1];
+                const float after = correlation[first_peak_lag];
+                const float curvature = before - 2 * peak + after;
+                if (curvature < 0) {
+                    lag += std::clamp(0.5f * (before - after) / curvature, -0.5f, 0.5f);
+                }
+            }
+            period[channel] = lag / sample_rate;
+            second_period[channel] = static_cast<float>(second_peak_lag) / sample_rate;
+            // Peak normalized by the energy at lag 0
+            const float zero_lag = settings.correlation_engine == CorrelationEngine::FFT ? work.fft_correlation.lag(0)
+                                   : sliding                                    ? sums.lag(0)
+                                                                                : dsp::dot(window.data(), window.data(), n - i);
+            confidence[channel] = zero_lag > 0
+                                      ? std::clamp(first_peak_value / zero_lag, 0.0f, 1.0f)
+                                      : 0.0f;
         }
     }
 }
 
-void dsp_client::process_repeater(jack_nframes_t nframes,
+void dsp_client::detect_period(unsigned int channel, AnalysisScratch &work) {
+    dsp::mirrored_ring &ring = ring_buffer[channel];
+    const Settings &settings = work.settings;
+    const float sample_rate = analysis_rate;
+    const float max_frequency = std::min(settings.period_maxfreq, passband * sample_rate);
+
+    // Lags of the frequency range
+    const std::size_t min_lag = static_cast<std::size_t>(std::ceil(sample_rate / max_frequency));
+    const std::size_t max_lag = static_cast<std::size_t>(sample_rate / settings.period_minfreq);
+
+    // The most recent samples, as soon as two periods of the lowest
+    // frequency (or a whole window) are stored
+    const std::size_t windowsize = correlation_signal[channel].size();
+    const dsp::sliding_autocorrelation &sums = sliding_correlation[channel];
+    const bool sliding = settings.correlation_engine == CorrelationEngine::Sliding;
+    if ((sliding ? sums.size() : ring.size()) < std::min(2 * max_lag, windowsize)) {
+        period[channel] = -1;
+        second_period[channel] = -1;
+        confidence[channel] = 0;
+        ring_buffer_energy[channel] = 0;
+        return;
+    }
+    const std::size_t length = std::min(ring.size(), windowsize);
+
+    // Scaled back to the input rate, so that the repeater plays at the
+    // same level whatever the decimation
+    const std::span<const float> stored = ring.samples();
+    ring_buffer_energy[channel] = decimation * dsp::sum_squares(stored.data(), stored.size());
+
+    dsp::pitch_detector &estimator = settings.detector == PitchDetector::YIN
+                                         ? static_cast<dsp::pitch_detector &>(work.yin)
+                                         : work.mpm;
+    const dsp::pitch_estimate estimate =
+        sliding ? estimator.detect(sums, min_lag, max_lag)
+                : estimator.detect(ring.window(ring.size() - length, length),
+                                   min_lag, max_lag,
+                                   settings.correlation_engine == CorrelationEngine::Direct);
+
+    // As with the autocorrelation, a window without pitch keeps the
+    // last period
+    confidence[channel] = estimate.confidence;
+    if (estimate.period > 0) {
+        period[channel] = estimate.period / sample_rate;
+        second_period[channel] = -1;
+    }
+}
+
+void dsp_client::set_correlation_engine(CorrelationEngine engine) {
+    control(Command::Type::Engine, static_cast<float>(engine));
+}
+
+void dsp_client::set_pitch_detector(PitchDetector detector) {
+    control(Command::Type::Detector, static_cast<float>(detector));
+}
+
+void dsp_client::set_spectrum_mode(bool mode) {
+    control(Command::Type::SpectrumMode, mode);
+}
+
+void dsp_client::set_loudness_mode(bool mode) {
+    control(Command::Type::LoudnessMode, mode);
+}
+
+void dsp_client::reset_loudness() {
+    control(Command::Type::LoudnessReset, 0);
+}
+
+void dsp_client::set_spectrum_size(std::size_t size, std::size_t hop) {
+    dsp::stft_analyzer::validate(size, hop, spectrum_bands);
+    spectrum_size = size;
+    spectrum_hop = hop;
+}
+
+void dsp_client::set_spectrum_bands(unsigned int bands_per_octave) {
+    dsp::stft_analyzer::validate(spectrum_size, spectrum_hop, bands_per_octave);
+    spectrum_bands = bands_per_octave;
+}
+
+float dsp_client::get_spectrum_rate() {
+    return static_cast<float>(get_sample_rate()) / spectrum_hop;
+}
+
+void dsp_client::process_repeater(unsigned int channel,
+                                  jack_nframes_t nframes,
                                   sample_t *const out) {
-    if (!period_mode) {
+    if (!active.period_mode) {
+        memset(out, 0, sizeof(sample_t) * nframes);
         return;
     }
 
-    float frequency = get_freq();
-    jack_nframes_t sample_rate = jack::client::get_sample_rate();
+    // The oscillator ramps the amplitude by itself
+    const PeriodResult result = results[channel].read();
+    synthesize(channel, nframes, 1 / result.period,
+               active.volume * result.ring_buffer_energy, out);
+}
+
+void dsp_client::synthesize(unsigned int channel,
+                            jack_nframes_t nframes,
+                            float frequency,
+                            float amplitude,
+                            sample_t *const out) {
+    dsp::oscillator &osc = synth[channel];
 
     if (frequency <= 0) {
-        for (jack_nframes_t i = 0; i < nframes; i++) {
-            out[i] = 0;
-        }
-        counter_repeater = 0;
+        // Fade out at the last frequency instead of cutting the sine
+        osc.set_amplitude(0);
     } else {
-        const float multiplier = 2 * M_PI * frequency / sample_rate;
-        int n = nframes;
-        n += counter_repeater;
-        int i = counter_repeater;
-        for (i; i < n; i++) {
-            out[i] = volume * ring_buffer_energy * std::sin(i * multiplier);
-        }
-        counter_repeater = i;
+        osc.set_frequency(frequency, jack::client::get_sample_rate());
+        osc.set_amplitude(amplitude);
     }
+    osc.render(out, nframes);
 }
 
 void dsp_client::process_tuner() {
-    float frequency = get_freq();
-
-    if (frequency <= 0) {
-        freq_tuned = -1;
-        note_tuned = "Sin sonido";
-        frequency_difference = 0;
-        return;
+    AnalysisScratch &work = scratch[0];
+    work.settings = analysis_settings.read();
+    if (work.tuning.get_reference() != work.settings.reference_pitch) {
+        work.tuning.set_reference(work.settings.reference_pitch);
     }
+    for (unsigned int c = 0; c < num_channels; ++c)
+        process_tuner(c, work);
+}
 
-    std::string closest_note;
-    float closest_frequency;
-    float min_frequency_difference = 200.0;
-    float actual_frequency_difference;
+void dsp_client::process_tuner(unsigned int channel, AnalysisScratch &work) {
+    float frequency = 1 / period[channel];
 
-    // diferencia 0 para indicar que esta afinado
-    for (const auto &note_entry : notas) {
-        const std::string &note_name = note_entry.first;
-        float note_frequency = note_entry.second;
-        float abs_frequency_difference = std::abs(note_frequency - frequency);
-
-        if (abs_frequency_difference < min_frequency_difference) {
-            min_frequency_difference = abs_frequency_difference;
-            actual_frequency_difference = (note_frequency - frequency);
-            closest_note = note_name;
-            closest_frequency = note_frequency;
-        }
-    }
+    // A frequency <= 0 (no period) has no note
+    const dsp::note_match closest = work.tuning.nearest(frequency);
+    freq_tuned[channel] = closest.frequency;
+    note_tuned[channel] = closest.note;
+    cents[channel] = closest.cents;
 
-    freq_tuned = closest_frequency;
-    note_tuned = closest_note;
-    frequency_difference = actual_frequency_difference;
+    // diferencia 0 para indicar que esta afinado
+    frequency_difference[channel] = closest.note < 0 ? 0 : closest.frequency - frequency;
 }
 
-void dsp_client::process_autotune(jack_nframes_t nframes,
+void dsp_client::process_autotune(unsigned int channel,
+                                  jack_nframes_t nframes,
+                                  const sample_t *const in,
                                   sample_t *const out) {
-    float frequency = get_freq_tuned();
+    const PeriodResult result = results[channel].read();
     jack_nframes_t sample_rate = jack::client::get_sample_rate();
 
-    if (frequency <= 0) {
-        for (jack_nframes_t i = 0; i < nframes; i++) {
-            out[i] = 0;
-        }
-        counter_repeater = 0;
-    } else {
-        const float multiplier = 2 * M_PI * frequency / sample_rate;
-        int n = nframes;
-        n += counter_repeater;
-        int i = counter_repeater;
-        for (i; i < n; i++) {
-            out[i] = volume * ring_buffer_energy * std::sin(i * multiplier);
-        }
-        counter_repeater = i;
+    // Shift the input from its period to the one of the closest note,
+    // looked up here for every block; without a period the shifter just
+    // delays the input
+    float period = -1;
+    float ratio = 1;
+    const dsp::note_match closest = tuning.nearest(1 / result.period);
+    if (closest.note >= 0) {
+        period = result.period * sample_rate;
+        ratio = closest.frequency * result.period;
     }
+    stream->shifter[channel].process(in, out, nframes, period, ratio);
+    gain.apply(out, out, nframes);
 }
 
 void dsp_client::set_energy_window_size(float energy_window_size_) {
-    energy_window_size = energy_window_size_;
+    control(Command::Type::EnergyWindow, energy_window_size_);
+    update_sizing();
 }
 
 void dsp_client::set_period_minfreq(int period_minfreq_) {
-    period_minfreq = period_minfreq_;
+    control(Command::Type::MinFreq, period_minfreq_);
+    update_sizing();
 }
 
 void dsp_client::set_period_maxfreq(int period_maxfreq_) {
-    period_maxfreq = period_maxfreq_;
+    control(Command::Type::MaxFreq, period_maxfreq_);
+    update_sizing();
 }
 
 void dsp_client::set_period_minlevel(float period_minlevel_) {
-    period_minlevel = period_minlevel_;
+    control(Command::Type::MinLevel, period_minlevel_);
 }
 
 void dsp_client::set_period_window_size(float period_window_size_) {
@@ -392,3 +1053,85 @@ void dsp_client::set_period_window_size(float period_window_size_) {
 void dsp_client::set_period_ringsize(float period_ringsize_) {
     period_ringsize = period_ringsize_;
 }
+
+void dsp_client::resize_period_window(float window, float ringsize) {
+    if (!(window > 0) || !(ringsize > 0)) {
+        throw std::invalid_argument("The analysis window and ring must be positive");
+    }
+    std::lock_guard<std::mutex> lock(reconfiguration);
+    period_window_size = window;
+    period_ringsize = ringsize;
+    if (capturing_frames.load(std::memory_order_acquire)) {
+        reconfigure();
+    }
+}
+
+void dsp_client::set_period_decimation(unsigned int factor) {
+    if (factor > dsp::decimator::max_factor) {
+        throw std::invalid_argument("The decimation must be between 0 (automatic) and " +
+                                    std::to_string(dsp::decimator::max_factor));
+    }
+    period_decimation = factor;
+}
+
+void dsp_client::set_reference_pitch(float reference) {
+    control(Command::Type::ReferencePitch, reference);
+}
+
+void dsp_client::start_recording(const std::string &path) {
+    recorder.start(path, get_sample_rate(), num_channels);
+}
+
+void dsp_client::stop_recording() {
+    recorder.stop();
+}
+
+void dsp_client::get_telemetry(dsp::telemetry_frame &frame) {
+    static const char *const mode_names[] = {"passthrough", "volume", "repeater",
+                                             "tuner", "autotune"};
+
+    frame = dsp::telemetry_frame{};
+    frame.sample_rate = get_sample_rate();
+    frame.buffer_size = get_buffer_size();
+    frame.volume = requested.volume;
+    std::strncpy(frame.mode, mode_names[static_cast<int>(requested.mode)],
+                 sizeof(frame.mode) - 1);
+    frame.energy_mode = requested.energy_mode;
+    frame.period_mode = requested.period_mode;
+    frame.loudness_mode = requested.loudness_mode;
+    const dsp::loudness_reading loudness_now = loudness_result.read();
+    frame.momentary = loudness_now.momentary;
+    frame.short_term = loudness_now.short_term;
+    frame.integrated = loudness_now.integrated;
+    frame.loudness_range = loudness_now.range;
+
+    if (const jack::callback_stats *callbacks = stats()) {
+        const jack::callback_stats::summary s = callbacks->read();
+        frame.cycles = s.cycles;
+        frame.xruns = s.xruns;
+        frame.load = s.load;
+        frame.worst_load = s.worst_load;
+        frame.p99_load = s.p99_load;
+        frame.worst_us = s.worst_us;
+    }
+
+    frame.channels = std::min(num_channels, dsp::telemetry_frame::max_channels);
+    for (unsigned int ch = 0; ch < frame.channels; ++ch) {
+        const PeriodResult r = results[ch].read();
+        dsp::telemetry_channel &c = frame.channel[ch];
+        const EnergyResult e = energy_results[ch].read();
+        c.energy = e.energy;
+        c.power = e.power;
+        c.period = r.period;
+        c.frequency = r.period > 0 ? 1 / r.period : 0;
+        c.confidence = r.confidence;
+        c.freq_tuned = r.freq_tuned;
+        c.cents = r.cents;
+        c.note = r.note_tuned;
+    }
+}
+
+std::string dsp_client::get_note_tuned(unsigned int channel) const {
+    const int note = results[channel].read().note_tuned;
+    return note < 0 ? "Sin sonido" : dsp::note_table::name(note);
+}
@@ -1,13 +1,33 @@
 #ifndef _DSP_CLIENT_H
 #define _DSP_CLIENT_H
 
+#include <atomic>
 #include <boost/circular_buffer.hpp>
 #include <cmath>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <queue>
-#include <unordered_map>
+#include <thread>
+#include <vector>
 
+#include "autocorrelation.h"
+#include "decimator.h"
 #include "jack_client.h"
+#include "loudness.h"
+#include "mirrored_ring.h"
+#include "note_table.h"
+#include "oscillator.h"
+#include "pipeline.h"
+#include "pitch_detector.h"
+#include "psola.h"
+#include "ramp.h"
+#include "recorder.h"
+#include "snapshot.h"
+#include "spectrum.h"
+#include "spsc_ring.h"
+#include "telemetry.h"
 
 class dsp_client : public jack::client {
    public:
@@ -20,96 +40,397 @@ class dsp_client : public jack::client {
         Autotune
     };
 
+    // Motores para el cálculo de la autocorrelación
+    enum class CorrelationEngine {
+        Direct,  // O(N^2) lag x sample loop
+        FFT,     // Wiener-Khinchin, O(N log N)
+        Sliding  // Running sums updated per block, O(B lags)
+    };
+
+    // Estimadores del periodo
+    enum class PitchDetector {
+        Autocorrelation,  // Two highest autocorrelation peaks
+        YIN,              // Cumulative mean normalized difference
+        MPM               // McLeod normalized square difference
+    };
+
+    // Resultados del análisis de periodo y del afinador
+    struct PeriodResult {
+        float period;
+        float second_period;  // Highest peak when period is an earlier one
+        float confidence;  // 0 to 1, of the last analysis window
+        float ring_buffer_energy;
+        float freq_tuned;
+        int note_tuned;  // MIDI number, -1 without sound
+        float frequency_difference;
+        float cents;     // Of the frequency above the note
+    };
+
+    // Sums over the energy window, as of the last block
+    struct EnergyResult {
+        float energy;
+        float power;
+    };
+
    private:
-    Mode current_mode;
-    float volume;  // Valor actual del volumen
+    // Times the private kernels
+    friend class dsp_bench;
+
+    // Parameters set from the control (UI) thread
+    struct Settings {
+        Mode mode;
+        float volume;  // Valor actual del volumen
+        bool energy_mode;
+        bool period_mode;
+        float energy_window_size;  // Window size in seconds
+        float period_minfreq;
+        float period_maxfreq;
+        float period_minlevel;
+        CorrelationEngine correlation_engine;
+        PitchDetector detector;
+        float reference_pitch;  // la4, in Hz
+        bool spectrum_mode;     // Alongside any of the modes above
+        bool loudness_mode;     // Also alongside the modes
+        unsigned int loudness_resets;  // Counted, for apply_settings()
+    };
+
+    // One change of a setting, queued for process()
+    struct Command {
+        enum class Type : unsigned char {
+            Mode,
+            Volume,
+            EnergyMode,
+            PeriodMode,
+            EnergyWindow,
+            MinFreq,
+            MaxFreq,
+            MinLevel,
+            Engine,
+            Detector,
+            ReferencePitch,
+            SpectrumMode,
+            LoudnessMode,
+            LoudnessReset
+        };
+        Type type;
+        float value;  // Flags are 0 or 1, enumerations their index
+    };
+
+    // Per-worker buffers of the autocorrelation
+    struct AnalysisScratch {
+        Settings settings;  // As of the last analyze()
+        dsp::note_table tuning;
+        dsp::fft_autocorrelation fft_correlation;
+        dsp::yin_detector yin;
+        dsp::mpm_detector mpm;
+    };
 
-    // For energy and power measure
-    float energy_window_size;  // Window size in seconds
-    bool energy_mode;
+    // The control thread never writes what process() reads: the setters
+    // update requested and queue a command, and process() applies the
+    // queued commands to active before each block.  The analysis
+    // threads read a snapshot of active.
+    Settings requested;
+    Settings active;
+    // requested as of the last change of a setting that sizes the
+    // buffers, for make_stream() and prepare_analysis(), which run on
+    // JACK's notification thread; guarded by reconfiguration
+    Settings sizing;
+    dsp::spsc_ring<Command> commands;
+    dsp::snapshot<Settings> analysis_settings;
 
-    // std::queue<float> energy_queue;
-    boost::circular_buffer<float> energy_queue;
+    // Volume gain, ramped to active.volume
+    dsp::linear_ramp gain;
 
-    float accumulated_energy;
+    // Crossfade from the previous mode, which keeps being rendered into
+    // fade_buffer until fade_position reaches fade_length
+    Mode fade_mode;
+    std::size_t fade_length;
+    std::size_t fade_position;
 
-    // std::queue<float> power_queue;
-    boost::circular_buffer<float> power_queue;
+    // Number of channels of the per-channel state below
+    unsigned int num_channels;
+
+    // The per-channel state is kept as a structure of arrays: element c
+    // of each vector belongs to channel c.
+
+    // Buffers of process() sized for the stream format.  When the
+    // format changes, a new set is built outside the audio thread and
+    // handed to process() through pending; process() swaps it in
+    // before a block and hands the old set back through retired, so
+    // that it is freed outside the audio thread too.
+    struct StreamBuffers {
+        jack_nframes_t sample_rate = 0;
+        jack_nframes_t buffer_size = 0;
+        std::size_t fade_length = 0;
+        std::vector<boost::circular_buffer<float>> energy_queue;
+        std::vector<boost::circular_buffer<float>> power_queue;
+        std::vector<std::vector<float>> fade_buffer;
+        // Samples captured by process(), consumed by the analysis threads
+        std::unique_ptr<dsp::spsc_ring<float>[]> sample_ring;
+        // Every sample while the spectrum mode is on, for the STFT
+        std::unique_ptr<dsp::spsc_ring<float>[]> spectrum_ring;
+        std::vector<dsp::psola_shifter> shifter;
+    };
+    // Every set not freed yet, owned by the control side
+    std::vector<std::unique_ptr<StreamBuffers>> streams;
+    StreamBuffers *stream;  // In use by process()
+    // stream for the analysis threads, which keep reading the old set
+    // until reconfigure() stops them
+    std::atomic<StreamBuffers *> live;
+    std::atomic<StreamBuffers *> pending;
+    dsp::spsc_ring<StreamBuffers *> retired;
+    std::mutex reconfiguration;
+    std::atomic<std::size_t> autotune_latency;
 
-    float accumulated_power;
+    // Running sums of the queues, recomputed from them once per window
+    // so that the add and subtract rounding never builds up
+    std::vector<double> accumulated_energy;
+    std::vector<double> accumulated_power;
+    std::vector<std::size_t> energy_updates;  // Since the last recompute
+    // The sums for the other threads, published by process()
+    std::unique_ptr<dsp::snapshot<EnergyResult>[]> energy_results;
 
     // For period calculation
-    bool period_mode;
-    float period_minfreq;
-    float period_maxfreq;
-    float period_minlevel;
     float period_window_size;
     float period_ringsize;
-    float period;
-    float second_period;
-    bool capturing_frames;
-    boost::circular_buffer<float> ring_buffer;
-    boost::circular_buffer<float> correlation_signal;
-    unsigned int fail_counter_energy;
+    // The analysis runs on the input decimated by this factor, chosen
+    // from period_maxfreq by prepare_analysis() unless set (0: chosen)
+    unsigned int period_decimation;
+    unsigned int decimation;
+    float analysis_rate;  // Sample rate of the ring buffers below
+    std::unique_ptr<dsp::decimator[]> decimators;
+    std::vector<float> period;
+    std::vector<float> second_period;
+    std::vector<float> confidence;
+    std::atomic<bool> capturing_frames;
+    // Analysis windows are contiguous spans of the mirrored ring
+    std::unique_ptr<dsp::mirrored_ring[]> ring_buffer;
+    // Correlation of the last window, kept up to date by the analysis
+    // thread with the sliding engine
+    std::unique_ptr<dsp::sliding_autocorrelation[]> sliding_correlation;
+    std::vector<std::vector<float>> correlation_signal;  // One value per lag
+    std::vector<unsigned int> fail_counter_energy;
+
+    // Each analysis thread owns the ring_buffer of the channels c with
+    // c % analysis_threads == its index, which it fills from the
+    // sample_ring of the stream buffers.
+    std::unique_ptr<std::atomic<bool>[]> ring_reset;
+    std::atomic<unsigned int> data_ready;
+    std::atomic<bool> analysis_running;
+    unsigned int analysis_threads;
+    std::vector<std::thread> analysis_pool;
+    std::vector<AnalysisScratch> scratch;
+    std::function<void()> results_listener;  // Called by the analysis threads
 
     // repeater and autotune
-    unsigned int counter_repeater;
-    float ring_buffer_energy;
-    float freq_tuned;
-    std::string note_tuned;
-    float frequency_difference;
+    std::vector<dsp::oscillator> synth;
+    std::vector<float> ring_buffer_energy;
+    std::vector<float> freq_tuned;
+    std::vector<int> note_tuned;
+    std::vector<float> frequency_difference;
+    std::vector<float> cents;
+    dsp::note_table tuning;  // Of active.reference_pitch
+
+    // Last analysis results per channel, readable from any thread
+    // without locks
+    std::unique_ptr<dsp::snapshot<PeriodResult>[]> results;
+
+    // Short-time spectrum of each channel, run by the analysis thread
+    // that owns the channel, and its last frame
+    std::size_t spectrum_size;
+    std::size_t spectrum_hop;
+    unsigned int spectrum_bands;  // Per octave
+    std::unique_ptr<dsp::stft_analyzer[]> spectrum;
+    std::unique_ptr<dsp::snapshot<dsp::spectrum_frame>[]> spectra;
+
+    // R128 loudness of all the channels together, measured by process()
+    dsp::loudness_meter loudness;
+    dsp::snapshot<dsp::loudness_reading> loudness_result;
+
+    // Copy of what process() reads and writes, streamed to disk
+    dsp::disk_recorder recorder;
 
-    void process_passthrough(jack_nframes_t nframes,
-                             const sample_t *const in,
-                             sample_t *const out);
+    void resize_channels(unsigned int channels);
 
-    void process_volume_change(jack_nframes_t nframes,
-                               const sample_t *const in,
-                               sample_t *const out);
+    // Stream buffers for the given format and the current settings
+    std::unique_ptr<StreamBuffers> make_stream(jack_nframes_t sample_rate,
+                                               jack_nframes_t nframes) const;
+    // Size the buffers of the analysis, whose threads must be stopped
+    void prepare_analysis(jack_nframes_t sample_rate);
+    // Hand new stream buffers to process(), or swap them in right away
+    // if process() is not called from another thread
+    void install_stream(std::unique_ptr<StreamBuffers> next);
+    // Swap in the pending stream buffers; called at the start of process()
+    void adopt_stream();
+    // Free the stream buffers dropped by process(); the analysis
+    // threads must be stopped
+    void reclaim_streams();
+    // Resize everything for the current format; called with
+    // reconfiguration locked
+    void reconfigure();
+    // Copy requested to sizing, after a setter that changes the size of
+    // the buffers, and rebuild them if running
+    void update_sizing();
 
-    void process_repeater(jack_nframes_t nframes,
+    // Queue a change for process(), or apply it at once while no
+    // backend is running
+    void control(Command::Type type, float value);
+    static void update(Settings &settings, const Command &command);
+    void apply_settings(const Settings &previous);
+    // Apply the queued commands; called at the start of process()
+    void drain_commands();
+
+    /**
+     * Output of a mode.  The analysis stages (e.g. an energy_meter) are
+     * fused into the pass over the input, in front of the stages of the
+     * mode.
+     */
+    template <typename... Analysis>
+    void render(Mode mode,
+                unsigned int channel,
+                jack_nframes_t nframes,
+                const sample_t *const in,
+                sample_t *const out,
+                Analysis &...analysis);
+
+    void process_repeater(unsigned int channel,
+                          jack_nframes_t nframes,
                           sample_t *const out);
 
-    void process_autotune(jack_nframes_t nframes,
+    void process_autotune(unsigned int channel,
+                          jack_nframes_t nframes,
+                          const sample_t *const in,
                           sample_t *const out);
 
-    void calculate_energy_and_power(jack_nframes_t nframes,
-                                    const sample_t *const signal);
+    // Sine of the given frequency (silence if <= 0) on the channel's
+    // oscillator, ramping to the given amplitude
+    void synthesize(unsigned int channel,
+                    jack_nframes_t nframes,
+                    float frequency,
+                    float amplitude,
+                    sample_t *const out);
+
+    // energy is the sum of squares of the block, computed once in process()
+    void calculate_energy_and_power(unsigned int channel,
+                                    jack_nframes_t nframes,
+                                    float energy);
+
+    void get_data_period(unsigned int channel,
+                         jack_nframes_t nframes,
+                         const sample_t *const signal,
+                         float energy);
+
+    void calculate_period(unsigned int channel, AnalysisScratch &work);
+    // calculate_period() with the YIN and MPM detectors
+    void detect_period(unsigned int channel, AnalysisScratch &work);
+    void process_tuner(unsigned int channel, AnalysisScratch &work);
+    // Feed the captured samples of a channel to its STFT
+    void analyze_spectrum(unsigned int channel, const Settings &settings,
+                          StreamBuffers *input);
+    void analyze(unsigned int first_channel, unsigned int step,
+                 AnalysisScratch &work);
+
+    jack::client_state prepare(jack::client_state state);
 
-    void get_data_period(jack_nframes_t nframes,
-                         const sample_t *const signal);
+    void wake_analysis();
+    void analysis_loop(unsigned int worker);
 
    public:
     dsp_client();
     ~dsp_client();
 
     jack::client_state init();
+    jack::client_state init(jack::backend &backend);
 
+    // Processes channel 0 only
     virtual bool process(jack_nframes_t nframes,
                          const sample_t *const in,
                          sample_t *const out) override;
 
+    virtual bool process(jack_nframes_t nframes,
+                         unsigned int channels,
+                         const sample_t *const *const in,
+                         sample_t *const *const out) override;
+
+    // Rebuilds the buffers for the new format while process() runs
+    virtual void format_changed() override;
+
+    // The setters below are for the control thread; the getters return
+    // what was last set, which process() applies at its next block
+
     void change_mode(Mode new_mode);
     void adjust_volume(float delta);
-    void reset_volume() { volume = 1.0f; }
-    Mode get_current_mode() const { return current_mode; }
-    float get_volume() const { return volume; }
-    bool get_energy_mode() const { return energy_mode; }
+    void set_volume(float volume);
+    void reset_volume();
+    Mode get_current_mode() const { return requested.mode; }
+    float get_volume() const { return requested.volume; }
+    bool get_energy_mode() const { return requested.energy_mode; }
     void set_energy_mode(bool mode);
-    float get_energy() const { return accumulated_energy; }
-    float get_power() const { return accumulated_power; }
+    float get_energy(unsigned int channel = 0) const { return energy_results[channel].read().energy; }
+    float get_power(unsigned int channel = 0) const { return energy_results[channel].read().power; }
     void set_period_mode(bool mode);
-    bool get_period_mode() const { return period_mode; }
-    float get_period() const { return period; }
-    float get_second_period() const { return second_period; }
-    float get_freq() const { return 1 / period; }
+    bool get_period_mode() const { return requested.period_mode; }
+    float get_period(unsigned int channel = 0) const { return results[channel].read().period; }
+    float get_second_period(unsigned int channel = 0) const { return results[channel].read().second_period; }
+    float get_freq(unsigned int channel = 0) const { return 1 / get_period(channel); }
+    float get_confidence(unsigned int channel = 0) const { return results[channel].read().confidence; }
+    PeriodResult get_results(unsigned int channel = 0) const { return results[channel].read(); }
     void calculate_period();
+    void set_correlation_engine(CorrelationEngine engine);
+    CorrelationEngine get_correlation_engine() const { return requested.correlation_engine; }
+    void set_pitch_detector(PitchDetector detector);
+    PitchDetector get_pitch_detector() const { return requested.detector; }
+
+    // Short-time spectrum and band levels of the input, next to any mode
+    void set_spectrum_mode(bool mode);
+    bool get_spectrum_mode() const { return requested.spectrum_mode; }
+    /**
+     * FFT size and hop in samples, and bands per octave (1 or 3) of the
+     * spectrum.  Must be called before init().
+     */
+    void set_spectrum_size(std::size_t size, std::size_t hop);
+    void set_spectrum_bands(unsigned int bands_per_octave);
+    // Frames per second of the spectrum
+    float get_spectrum_rate();
+    // Last spectrum of the channel; lock-free, for any thread
+    void get_spectrum(unsigned int channel, dsp::spectrum_frame &frame) const { frame = spectra[channel].read(); }
+
+    // EBU R128 loudness of the input, next to any mode.  Turning it on
+    // starts a new program, as does reset_loudness().
+    void set_loudness_mode(bool mode);
+    bool get_loudness_mode() const { return requested.loudness_mode; }
+    void reset_loudness();
+    // Last reading, updated every 100 ms; lock-free, for any thread
+    dsp::loudness_reading get_loudness() const { return loudness_result.read(); }
 
     // std::string get_tuner();
-    float get_freq_tuned() const { return freq_tuned; }
-    std::string get_note_tuned() const { return note_tuned; }
-    float get_freq_diff() const { return frequency_difference; }
+    float get_freq_tuned(unsigned int channel = 0) const { return results[channel].read().freq_tuned; }
+    std::string get_note_tuned(unsigned int channel = 0) const;
+    int get_note_index(unsigned int channel = 0) const { return results[channel].read().note_tuned; }
+    float get_freq_diff(unsigned int channel = 0) const { return results[channel].read().frequency_difference; }
+    float get_cents(unsigned int channel = 0) const { return results[channel].read().cents; }
+
+    /**
+     * Current settings, callback statistics and results of every channel
+     * (up to telemetry_frame::max_channels), for a telemetry_publisher.
+     * Lock-free; for the control thread.
+     */
+    void get_telemetry(dsp::telemetry_frame &frame);
+
+    /**
+     * Record the input and the output of every channel to path (WAV if
+     * it ends in ".wav", raw floats otherwise) until stop_recording().
+     * Throws std::runtime_error if the file cannot be created.
+     */
+    void start_recording(const std::string &path);
+    void stop_recording();
+    const dsp::disk_recorder &get_recorder() const { return recorder; }
 
+    // Delay of the autotune output, in samples
+    jack_nframes_t get_autotune_latency() const { return autotune_latency.load(std::memory_order_relaxed); }
+
+    // These three size the buffers: while running they are rebuilt as
+    // for a new stream format, and the estimates start over
     void set_energy_window_size(float energy_window_size_);
     void set_period_minfreq(int period_minfreq_);
     void set_period_maxfreq(int period_maxfreq_);
@@ -117,7 +438,57 @@ class dsp_client : public jack::client {
     void set_period_window_size(float period_window_size_);
     void set_period_ringsize(float period_ringsize_);
 
+    /**
+     * Analysis window and ring size in seconds, also while running: the
+     * analysis buffers are rebuilt as for a new stream format, and the
+     * estimates start over.
+     */
+    void resize_period_window(float window, float ringsize);
+    float get_period_window_size() const { return period_window_size; }
+    float get_period_ringsize() const { return period_ringsize; }
+
+    /**
+     * Called by the analysis threads, in period mode, every time they
+     * have published new results.  Must be set before init(), and must
+     * be quick and safe to call from several threads.
+     */
+    void set_results_listener(std::function<void()> listener) { results_listener = std::move(listener); }
+
+    /**
+     * Decimation of the input of the pitch analysis (1 for none, 0 to
+     * choose it from the maximum frequency).  Must be called before
+     * init().
+     */
+    void set_period_decimation(unsigned int factor);
+    // Factor in use, and the sample rate the analysis sees
+    unsigned int get_period_decimation() const { return decimation; }
+    float get_analysis_rate() const { return analysis_rate; }
+
+    // Frequency of la4 for the tuner and the autotune, in Hz
+    void set_reference_pitch(float reference);
+    float get_reference_pitch() const { return requested.reference_pitch; }
+
+    /**
+     * Number of analysis threads, at most one per channel.  Must be
+     * called before init().
+     */
+    void set_analysis_threads(unsigned int threads);
+
     void process_tuner();
+
+    /**
+     * Move the captured samples of every channel into its analysis ring
+     * buffer, run calculate_period() and process_tuner() and publish the
+     * results.
+     *
+     * This is what the analysis threads do every time process() signals
+     * new data, each one on its own channels.  It can also be called
+     * directly when the threads are not running (offline processing).
+     */
+    void analyze();
+
+    void start_analysis();
+    void stop_analysis();
 };
 
 #endif
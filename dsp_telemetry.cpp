@@ -0,0 +1,101 @@
+/** @file dsp_telemetry.cpp
+ *
+ * @brief Reader of the metrics published by dsp1 with --telemetry-shm
+ * or --telemetry-socket.
+ *
+ * Prints one line per frame, as text or as JSON, until --count frames
+ * were read or no frame arrives within --timeout.
+ */
+
+#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "callback_stats.h"
+#include "note_table.h"
+#include "telemetry.h"
+
+namespace po = boost::program_options;
+
+namespace {
+
+void print_text(const dsp::telemetry_frame &f, double age_ms) {
+    std::cout << std::fixed << std::setprecision(2)
+              << "pid " << f.pid << " #" << f.sequence
+              << " age " << age_ms << " ms  " << f.mode
+              << "  vol " << f.volume
+              << "  load " << f.load << "% (p99 " << f.p99_load
+              << "%, worst " << f.worst_load << "%)  xruns " << f.xruns;
+    if (f.loudness_mode) {
+        std::cout << std::setprecision(1) << "  M " << f.momentary << " S " << f.short_term
+                  << " I " << f.integrated << " LUFS LRA " << f.loudness_range << " LU"
+                  << std::setprecision(2);
+    }
+    for (unsigned int ch = 0; ch < f.channels; ++ch) {
+        const dsp::telemetry_channel &c = f.channel[ch];
+        std::cout << "  | " << ch + 1 << ": ";
+        if (f.energy_mode) {
+            std::cout << std::setprecision(6) << "E " << c.energy << " P " << c.power
+                      << std::setprecision(2);
+        }
+        if (f.period_mode) {
+            std::cout << c.frequency << " Hz (" << c.confidence << ")";
+            if (c.note >= 0) {
+                std::cout << " " << dsp::note_table::name(c.note) << " "
+                          << std::showpos << c.cents << std::noshowpos << " c";
+            }
+        }
+    }
+    std::cout << '\n';
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    po::options_description desc("Options");
+    desc.add_options()("help,h", "Show help message")("shm", po::value<std::string>(), "Read the shared memory segment of dsp1 --telemetry-shm")("socket", po::value<std::string>(), "Bind the socket given to dsp1 --telemetry-socket")("count,n", po::value<int>()->default_value(0), "Stop after this many frames (0: never)")("timeout", po::value<int>()->default_value(5000), "Give up after this many ms without frames")("json", "Print JSON lines");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || vm.count("shm") == vm.count("socket")) {
+        std::cout << "Use exactly one of --shm and --socket\n"
+                  << desc << std::endl;
+        return vm.count("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    try {
+        dsp::telemetry_reader reader;
+        if (vm.count("shm")) {
+            reader.open_shared_memory(vm["shm"].as<std::string>());
+        } else {
+            reader.open_socket(vm["socket"].as<std::string>());
+        }
+
+        const int count = vm["count"].as<int>();
+        const bool json = vm.count("json");
+        dsp::telemetry_frame frame;
+        for (int n = 0; count <= 0 || n < count; ++n) {
+            if (!reader.read(frame, vm["timeout"].as<int>())) {
+                std::cerr << "No telemetry received" << std::endl;
+                return EXIT_FAILURE;
+            }
+            // Both clocks are CLOCK_MONOTONIC of the same host
+            const double age_ms = (jack::callback_stats::now_ns() - frame.timestamp_ns) / 1e6;
+            if (json) {
+                dsp::write_json(std::cout, frame, age_ms);
+                std::cout << '\n';
+            } else {
+                print_text(frame, age_ms);
+            }
+            std::cout << std::flush;
+        }
+    } catch (std::exception &exc) {
+        std::cerr << argv[0] << ": Error: " << exc.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
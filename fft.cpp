@@ -0,0 +1,117 @@
+#include "fft.h"
+
+#include <cmath>
+#include <utility>
+
+namespace dsp {
+
+std::size_t next_pow2(std::size_t n) {
+    std::size_t p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+real_fft::real_fft() : n(0) {}
+
+real_fft::real_fft(std::size_t size) : n(0) {
+    resize(size);
+}
+
+void real_fft::resize(std::size_t size) {
+    // The half size complex FFT needs at least two points
+    size = next_pow2(size < 4 ? 4 : size);
+    if (size == n)
+        return;
+    n = size;
+
+    const std::size_t half = n / 2;
+
+    // Bit reversal permutation for the half size complex FFT
+    bitrev.resize(half);
+    unsigned int bits = 0;
+    while ((std::size_t(1) << bits) < half)
+        bits++;
+    for (std::size_t k = 0; k < half; k++) {
+        std::size_t r = 0;
+        for (unsigned int b = 0; b < bits; b++)
+            r |= ((k >> b) & 1) << (bits - 1 - b);
+        bitrev[k] = r;
+    }
+
+    // Twiddles of the complex FFT: exp(-2 pi i k / (N/2)), k < N/4
+    twiddles.resize(half / 2);
+    for (std::size_t k = 0; k < half / 2; k++)
+        twiddles[k] = std::polar(1.0, -2.0 * M_PI * k / half);
+
+    // Twiddles to split the packed transform: exp(-2 pi i k / N)
+    real_twiddles.resize(half + 1);
+    for (std::size_t k = 0; k <= half; k++)
+        real_twiddles[k] = std::polar(1.0, -2.0 * M_PI * k / n);
+
+    scratch.resize(half);
+}
+
+void real_fft::complex_fft(complex_t *const data) {
+    const std::size_t half = n / 2;
+
+    for (std::size_t k = 0; k < half; k++) {
+        if (k < bitrev[k])
+            std::swap(data[k], data[bitrev[k]]);
+    }
+
+    // Iterative radix-2 decimation in time
+    for (std::size_t len = 2; len <= half; len <<= 1) {
+        const std::size_t step = half / len;
+        const std::size_t hlen = len / 2;
+        for (std::size_t start = 0; start < half; start += len) {
+            for (std::size_t k = 0; k < hlen; k++) {
+                const complex_t t = twiddles[k * step] * data[start + k + hlen];
+                data[start + k + hlen] = data[start + k] - t;
+                data[start + k] += t;
+            }
+        }
+    }
+}
+
+void real_fft::forward(const double *const in, complex_t *const out) {
+    const std::size_t half = n / 2;
+
+    // Pack even samples as real part and odd samples as imaginary part
+    for (std::size_t k = 0; k < half; k++)
+        scratch[k] = complex_t(in[2 * k], in[2 * k + 1]);
+
+    complex_fft(scratch.data());
+
+    // Split the spectra of the even and odd samples
+    for (std::size_t k = 0; k <= half; k++) {
+        const complex_t z = scratch[k == half ? 0 : k];
+        const complex_t zc = std::conj(scratch[k == 0 ? 0 : half - k]);
+        const complex_t even = 0.5 * (z + zc);
+        const complex_t odd = complex_t(0, -0.5) * (z - zc);
+        out[k] = even + real_twiddles[k] * odd;
+    }
+}
+
+void real_fft::inverse(const complex_t *const in, double *const out) {
+    const std::size_t half = n / 2;
+
+    // Rebuild the packed spectrum, conjugated to use the forward FFT
+    for (std::size_t k = 0; k < half; k++) {
+        const complex_t x = in[k];
+        const complex_t xc = std::conj(in[half - k]);
+        const complex_t even = 0.5 * (x + xc);
+        const complex_t odd = 0.5 * (x - xc) * std::conj(real_twiddles[k]);
+        scratch[k] = std::conj(even + complex_t(0, 1) * odd);
+    }
+
+    complex_fft(scratch.data());
+
+    const double norm = 1.0 / half;
+    for (std::size_t k = 0; k < half; k++) {
+        out[2 * k] = scratch[k].real() * norm;
+        out[2 * k + 1] = -scratch[k].imag() * norm;
+    }
+}
+
+}  // namespace dsp
@@ -0,0 +1,63 @@
+#ifndef _FFT_H
+#define _FFT_H
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * Real FFT of power-of-two size.
+ *
+ * The "plan" (bit reversal table and twiddle factors) is computed only
+ * when the size changes, so the object can be kept around and reused
+ * on every analysis tick without allocating.
+ *
+ * The transform of N real samples is computed with a complex FFT of
+ * N/2 points, and produces the N/2+1 non-redundant bins.
+ */
+class real_fft {
+   public:
+    typedef std::complex<double> complex_t;
+
+    real_fft();
+    explicit real_fft(std::size_t size);
+
+    /**
+     * Set the transform size (rounded up to a power of two).  The
+     * plan is only rebuilt if the size actually changes.
+     */
+    void resize(std::size_t size);
+
+    std::size_t size() const { return n; }
+
+    /**
+     * Forward transform: size() real samples into size()/2+1 bins.
+     */
+    void forward(const double *const in, complex_t *const out);
+
+    /**
+     * Inverse transform: size()/2+1 bins into size() real samples,
+     * normalized by 1/size().
+     */
+    void inverse(const complex_t *const in, double *const out);
+
+   private:
+    std::size_t n;  // Real transform size
+    std::vector<std::size_t> bitrev;
+    std::vector<complex_t> twiddles;       // For the N/2 complex FFT
+    std::vector<complex_t> real_twiddles;  // exp(-2 pi i k / N)
+    std::vector<complex_t> scratch;
+
+    void complex_fft(complex_t *const data);
+};
+
+/**
+ * Smallest power of two greater or equal than n
+ */
+std::size_t next_pow2(std::size_t n);
+
+}  // namespace dsp
+
+#endif
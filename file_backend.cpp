@@ -0,0 +1,144 @@
+#include "file_backend.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "rt_memory.h"
+
+namespace jack {
+
+  file_backend::file_backend(const std::string& input,
+                             const std::string& output,
+                             jack_nframes_t buffer_size,
+                             jack_nframes_t raw_sample_rate)
+    : _file(std::make_unique<dsp::mapped_audio_file>(input, raw_sample_rate)),
+      _output(output),
+      _input(_file->samples()),
+      _frames(_file->frames()),
+      _sample_rate(_file->sample_rate()),
+      _buffer_size(buffer_size),
+      _channels(1),
+      _client(nullptr),
+      _running(false) {
+  }
+
+  file_backend::file_backend(std::span<const float> input,
+                             jack_nframes_t sample_rate,
+                             jack_nframes_t buffer_size,
+                             const std::string& output)
+    : _output(output),
+      _input(input.data()),
+      _frames(input.size()),
+      _sample_rate(sample_rate),
+      _buffer_size(buffer_size),
+      _channels(1),
+      _client(nullptr),
+      _running(false) {
+  }
+
+  file_backend::~file_backend() {
+    close();
+  }
+
+  client_state file_backend::start(client& c) {
+    if (_buffer_size == 0 || _sample_rate == 0) {
+      std::cerr << "E> Invalid buffer size or sample rate" << std::endl;
+      return client_state::Error;
+    }
+
+    _client = &c;
+    _channels = c.get_channels();
+    _in_block.assign(std::size_t(_buffer_size) * _channels, 0.0f);
+    _out_block.assign(std::size_t(_buffer_size) * _channels, 0.0f);
+    _in.assign(_channels, nullptr);
+    _out.assign(_channels, nullptr);
+    for (unsigned int ch = 0; ch < _channels; ++ch) {
+      _out[ch] = _out_block.data() + std::size_t(ch) * _buffer_size;
+    }
+    if (_channels > 1) {
+      _interleaved.assign(std::size_t(_buffer_size) * _channels, 0.0f);
+    }
+    if (!_output.empty() && !_writer) {
+      _writer = std::make_unique<dsp::wav_writer>(_output, _sample_rate,
+                                                  _channels);
+    }
+    set_format(_sample_rate, _buffer_size);
+
+    std::cerr << "I> Offline sample rate: " << _sample_rate << std::endl;
+    std::cerr << "I> Offline buffer size: " << _buffer_size << std::endl;
+    std::cerr << "I> Offline channels: " << _channels << std::endl;
+
+    _stats.reset();
+    _running = true;
+    return client_state::Running;
+  }
+
+  void file_backend::stop() {
+    _running = false;
+  }
+
+  void file_backend::close() {
+    _running = false;
+    if (_writer) {
+      _writer->close();
+    }
+  }
+
+  std::size_t file_backend::run(const std::function<void()>& after_block) {
+    std::size_t pos = 0;
+
+    while (_running && pos < _frames) {
+      const std::size_t n = std::min<std::size_t>(_buffer_size, _frames - pos);
+
+      for (unsigned int ch = 0; ch < _channels; ++ch) {
+        float* block = _in_block.data() + std::size_t(ch) * _buffer_size;
+
+        if (_input != nullptr && n == _buffer_size) {
+          // Zero copy: process straight from the mapping
+          _in[ch] = _input + pos;
+        } else if (_input != nullptr) {
+          std::copy(_input + pos, _input + pos + n, block);
+          std::fill(block + n, block + _buffer_size, 0.0f);
+          _in[ch] = block;
+        } else {
+          _file->read(std::min(ch, _file->channels() - 1), pos,
+                      _buffer_size, block);
+          _in[ch] = block;
+        }
+      }
+
+      bool ok;
+      {
+        const process_scope scope;
+        const std::int64_t start = callback_stats::now_ns();
+        ok = _client->process(_buffer_size, _channels,
+                              _in.data(), _out.data());
+        _stats.record(start, callback_stats::now_ns() - start,
+                      _buffer_size, _sample_rate);
+      }
+
+      if (!ok) {
+        std::cerr << "E> process() failed at frame " << pos << std::endl;
+        break;
+      }
+
+      if (_writer && _channels == 1) {
+        _writer->write(_out[0], n);
+      } else if (_writer) {
+        for (std::size_t i = 0; i < n; ++i) {
+          for (unsigned int ch = 0; ch < _channels; ++ch) {
+            _interleaved[i * _channels + ch] = _out[ch][i];
+          }
+        }
+        _writer->write(_interleaved.data(), n);
+      }
+      if (after_block) {
+        after_block();
+      }
+      pos += n;
+    }
+
+    return pos;
+  }
+
+} // namespace jack
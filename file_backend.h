@@ -0,0 +1,94 @@
+#ifndef _FILE_BACKEND_H
+#define _FILE_BACKEND_H
+
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "jack_client.h"
+#include "wav_file.h"
+
+namespace jack {
+
+  /**
+   * Offline backend
+   *
+   * Feeds a client from a memory-mapped WAV or raw float file (or any
+   * block of samples already in memory), block by block and as fast as
+   * the CPU allows, and optionally writes what process() produces into
+   * an output file.
+   *
+   * Channel c of the client reads channel c of the file, or its last
+   * channel if the file has fewer.  Memory input is mono and feeds every
+   * channel.
+   *
+   * This allows processing recorded sessions faster than real time and
+   * running a client on machines without a sound card or JACK server.
+   */
+  class file_backend : public backend {
+  private:
+    std::unique_ptr<dsp::mapped_audio_file> _file;
+    std::unique_ptr<dsp::wav_writer> _writer;
+    std::string    _output;
+
+    const float*   _input;         // Zero-copy input, if available
+    std::size_t    _frames;
+    jack_nframes_t _sample_rate;
+    jack_nframes_t _buffer_size;
+    unsigned int   _channels;
+
+    // One block per channel, and the interleaved output for the writer
+    std::vector<float> _in_block;
+    std::vector<float> _out_block;
+    std::vector<float> _interleaved;
+    std::vector<const float*> _in;
+    std::vector<float*> _out;
+
+    client*        _client;
+    bool           _running;
+
+  public:
+    /**
+     * Read input (channel 0) from a file.  raw_sample_rate is only used
+     * if the file has no WAV header.  If output is not empty, the
+     * processed audio is written there (WAV if it ends in ".wav").
+     */
+    file_backend(const std::string& input,
+                 const std::string& output = "",
+                 jack_nframes_t buffer_size = 1024,
+                 jack_nframes_t raw_sample_rate = 0);
+
+    /**
+     * Read input from memory.  The samples must outlive the backend.
+     */
+    file_backend(std::span<const float> input,
+                 jack_nframes_t sample_rate,
+                 jack_nframes_t buffer_size = 1024,
+                 const std::string& output = "");
+
+    virtual ~file_backend();
+
+    virtual client_state start(client& c) override;
+    virtual void stop() override;
+    virtual void close() override;
+    virtual bool realtime() const override { return false; }
+
+    /**
+     * Call the client's process() with consecutive blocks of the input
+     * until it is exhausted or stop() is called.  The last block is
+     * zero padded.  If given, after_block is called after every
+     * process() call.
+     *
+     * Returns the number of input frames processed.
+     */
+    std::size_t run(const std::function<void()>& after_block = {});
+
+    std::size_t frames() const { return _frames; }
+    jack_nframes_t sample_rate() const { return _sample_rate; }
+  };
+
+} // namespace jack
+
+#endif
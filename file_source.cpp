@@ -0,0 +1,114 @@
+#include "file_source.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace jack {
+
+  file_source::file_source(const std::string& path,
+                           jack_nframes_t raw_sample_rate,
+                           std::size_t start,
+                           bool loop)
+    : _file(std::make_unique<dsp::mapped_audio_file>(path, raw_sample_rate)),
+      _start(start),
+      _loop(loop),
+      _block(0),
+      _position(start),
+      _served(0),
+      _finished(false) {
+    if (_start >= _file->frames()) {
+      throw std::runtime_error("Start frame " + std::to_string(start)
+                               + " is past the end of " + path + " ("
+                               + std::to_string(_file->frames()) + " frames)");
+    }
+  }
+
+  void file_source::prepare(unsigned int channels, jack_nframes_t buffer_size) {
+    const std::size_t frames = _file->frames();
+    const unsigned int file_channels = _file->channels();
+    const unsigned int used = std::min(std::max(channels, 1u), file_channels);
+
+    _channel.assign(file_channels, nullptr);
+    if (_file->samples() != nullptr) {
+      // Zero copy: serve straight from the mapping, kept in memory so
+      // that the process thread does not wait for the disk
+      _channel[0] = _file->samples();
+      if (!_file->load()) {
+        std::cerr << "W> Could not lock the injected file in memory"
+                  << " (ulimit -l), its pages may be evicted" << std::endl;
+      }
+    } else {
+      // Interleaved or integer samples: one float plane per channel read
+      _planes.assign(std::size_t(used) * frames, 0.0f);
+      for (unsigned int ch = 0; ch < used; ++ch) {
+        float* plane = _planes.data() + std::size_t(ch) * frames;
+        _file->read(ch, 0, frames, plane);
+        _channel[ch] = plane;
+      }
+    }
+
+    _source.assign(std::max(channels, 1u), nullptr);
+    for (unsigned int c = 0; c < _source.size(); ++c) {
+      _source[c] = _channel[std::min(c, file_channels - 1)];
+    }
+
+    _block = std::max(buffer_size, max_block);
+    _scratch.assign(_source.size() * _block, 0.0f);
+
+    _position = _start;
+    _served.store(0, std::memory_order_relaxed);
+    _finished.store(false, std::memory_order_release);
+  }
+
+  void file_source::serve(jack_nframes_t nframes,
+                          unsigned int channels,
+                          const float** in) {
+    const std::size_t end = _file->frames();
+    const std::size_t pos = _position;
+    const bool contiguous = pos + nframes <= end;
+    const std::size_t n = std::min<std::size_t>(nframes, _block);
+
+    for (unsigned int c = 0; c < channels; ++c) {
+      const float* src = _source[std::min<std::size_t>(c, _source.size() - 1)];
+      if (contiguous) {
+        in[c] = src + pos;
+        continue;
+      }
+
+      // The block crosses the end of the file: copy it, going back to
+      // the start frame or padding with silence
+      float* block = _scratch.data() + std::size_t(c) * _block;
+      std::size_t i = 0;
+      std::size_t p = pos;
+      while (i < n) {
+        if (p >= end) {
+          if (!_loop) {
+            break;
+          }
+          p = _start;
+        }
+        const std::size_t k = std::min(n - i, end - p);
+        std::copy(src + p, src + p + k, block + i);
+        i += k;
+        p += k;
+      }
+      std::fill(block + i, block + n, 0.0f);
+      in[c] = block;
+    }
+
+    std::size_t next = pos + nframes;
+    if (next >= end) {
+      if (_loop) {
+        next = _start + (next - end) % (end - _start);
+      } else {
+        next = end;
+        _finished.store(true, std::memory_order_release);
+      }
+    }
+    _position = next;
+    _served.store(_served.load(std::memory_order_relaxed) + nframes,
+                  std::memory_order_relaxed);
+  }
+
+} // namespace jack
@@ -0,0 +1,105 @@
+#ifndef _FILE_SOURCE_H
+#define _FILE_SOURCE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <jack/jack.h>
+
+#include "wav_file.h"
+
+namespace jack {
+
+  /**
+   * Input injected from a file
+   *
+   * Replaces the capture ports of the JACK backend with a
+   * memory-mapped WAV or raw float file, so that a recorded session can
+   * be replayed through the live client, under real JACK timing, as
+   * many times as needed with identical input.
+   *
+   * Channel c of the client reads channel c of the file, or its last
+   * channel if the file has fewer; the recordings of --record thus
+   * replay their inputs.  Mono float files are served straight from
+   * the mapping; other formats are converted to float planes once, in
+   * prepare().  Either way, serve() only hands out pointers, except for
+   * the block that wraps around the end of the file, which is copied.
+   *
+   * Playback starts at a given frame.  Looping plays again from that
+   * frame after the end of the file, sample-accurately; otherwise the
+   * input is silent once the file is exhausted.
+   */
+  class file_source {
+  private:
+    std::unique_ptr<dsp::mapped_audio_file> _file;
+    std::size_t    _start;
+    bool           _loop;
+
+    // Samples of each channel of the file, from the mapping or _planes
+    std::vector<const float*> _channel;
+    std::vector<float> _planes;
+
+    // Input of each channel of the client, and room for wrapped blocks
+    std::vector<const float*> _source;
+    std::vector<float> _scratch;
+    std::size_t    _block;
+
+    std::size_t    _position;  // Next frame, written by serve() only
+    std::atomic<std::size_t> _served;
+    std::atomic<bool> _finished;
+
+  public:
+    /// Largest block JACK passes to process() (BUFFER_SIZE_MAX of JACK2)
+    static constexpr jack_nframes_t max_block = 8192;
+
+    /**
+     * Map the file.  raw_sample_rate is only used if the file has no
+     * WAV header.  Throws std::runtime_error if it cannot be read or
+     * start is past its end.
+     */
+    file_source(const std::string& path,
+                jack_nframes_t raw_sample_rate = 0,
+                std::size_t start = 0,
+                bool loop = false);
+
+    file_source(const file_source&) = delete;
+    file_source& operator=(const file_source&) = delete;
+
+    /**
+     * Prepare to feed channels channels in blocks of up to
+     * max(buffer_size, max_block) frames, and load the file into
+     * memory.  Not real-time safe; call it before process() starts.
+     */
+    void prepare(unsigned int channels, jack_nframes_t buffer_size);
+
+    /**
+     * Process thread: point in[c], c < channels, at the next nframes of
+     * channel c, and advance.  Never allocates or blocks.
+     */
+    void serve(jack_nframes_t nframes,
+               unsigned int channels,
+               const float** in);
+
+    /// Frames served since prepare(), from any thread
+    std::size_t served() const {
+      return _served.load(std::memory_order_relaxed);
+    }
+
+    /// True once a file that does not loop has been played to the end
+    bool finished() const {
+      return _finished.load(std::memory_order_acquire);
+    }
+
+    std::size_t frames() const { return _file->frames(); }
+    unsigned int channels() const { return _file->channels(); }
+    jack_nframes_t sample_rate() const { return _file->sample_rate(); }
+    std::size_t start() const { return _start; }
+    bool loop() const { return _loop; }
+  };
+
+} // namespace jack
+
+#endif
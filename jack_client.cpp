@@ -21,14 +21,18 @@
  */
 
 #include "jack_client.h"
+#include "file_source.h"
+#include "rt_memory.h"
 
 #include <cstdio>
 #include <cerrno>
 #include <cstdlib>
 #include <stdexcept>
 
+#include <cstring>
 #include <mutex>
 #include <iostream>
+#include <string>
 
 std::ostream& operator<<(std::ostream& os,const JackStatus& s) {
   if (s & JackFailure) {
@@ -72,16 +76,13 @@ std::ostream& operator<<(std::ostream& os,const JackStatus& s) {
 namespace jack {
 
   // Static member of class client
-  jack_client_t* client::_client_ptr  = 0;
+  backend*       client::_backend     = nullptr;
   client_state   client::_state       = client_state::Idle;
 
-  jack_nframes_t client::_buffer_size = 0;
-  jack_nframes_t client::_sample_rate = 0;
+  std::atomic<jack_nframes_t> client::_buffer_size{0};
+  std::atomic<jack_nframes_t> client::_sample_rate{0};
+  unsigned int   client::_channels    = 1;
 
-  
-  jack_port_t*   client::_input_port  = nullptr;
-  jack_port_t*   client::_output_port = nullptr;
-  
   /*
    * C level callback function.  
    *
@@ -90,28 +91,23 @@ namespace jack {
    * method is the one that jack's C API defines.
    */
   static int process(jack_nframes_t nframes, void *arg) {
-    client* ptr=static_cast<client*>(arg);
-    
-    typedef jack_default_audio_sample_t sample_t;
-
-    jack_port_t *const ip = ptr->input_port();
-    jack_port_t *const op = ptr->output_port();
-    
-    const sample_t *const in
-      = static_cast<const sample_t*>(jack_port_get_buffer(ip,nframes));
-    
-    sample_t *const out
-      = static_cast<sample_t*>(jack_port_get_buffer(op,nframes));
-    
-    return ptr->process(nframes,in,out) ? EXIT_SUCCESS : EXIT_FAILURE;
+    jack_backend* ptr=static_cast<jack_backend*>(arg);
+    return ptr->process(nframes);
   }
 
   // C level callback function, follows jack's C API.
   static void shutdown(void *arg) {
-    client* ptr=static_cast<client*>(arg);
+    jack_backend* ptr=static_cast<jack_backend*>(arg);
     ptr->shutdown();
   }
 
+  // Called by the server whenever an xrun occurs
+  static int xrun(void *arg) {
+    jack_backend* ptr=static_cast<jack_backend*>(arg);
+    ptr->xrun();
+    return 0;
+  }
+
   // Callback used to update used sample rate
   static int sample_rate_changed(jack_nframes_t nframes, void *arg) {
     client* ptr=static_cast<client*>(arg);
@@ -125,46 +121,82 @@ namespace jack {
     ptr->set_buffer_size(nframes);
     return EXIT_SUCCESS;
   }
-  
 
-  client::client() {
+
+  backend::~backend() {
+    // Do not let the client use a backend that no longer exists
+    if (client::_backend == this) {
+      client::_backend = nullptr;
+    }
   }
 
-  client::~client() {
-    std::cout << "I> Deactivating and closing JACK client" << std::endl;
-    jack_deactivate(_client_ptr);
-    jack_client_close(_client_ptr);
-    _client_ptr=nullptr;
-    _state = client_state::Stopped;
+  void backend::set_format(const jack_nframes_t sample_rate,
+                           const jack_nframes_t buffer_size) {
+    client::_sample_rate = sample_rate;
+    client::_buffer_size = buffer_size;
   }
-  
-  
-  client_state client::init() {
-    
-    static std::mutex state_lock;
 
-    {
-      std::lock_guard<std::mutex> lk(state_lock);
+
+  jack_backend::jack_backend()
+    : _client_ptr(nullptr),
+      _client(nullptr),
+      _source(nullptr),
+      _name("dsp1") {
+  }
+
+  jack_backend::~jack_backend() {
+    close();
+  }
+
+  int jack_backend::process(jack_nframes_t nframes) {
+    typedef jack_default_audio_sample_t sample_t;
+
+    for (std::size_t c = 0; c < _in.size(); ++c) {
+      _in[c] = static_cast<const sample_t*>(
+        jack_port_get_buffer(_input_ports[c], nframes));
+      _out[c] = static_cast<sample_t*>(
+        jack_port_get_buffer(_output_ports[c], nframes));
+    }
+    if (_source != nullptr) {
+      _source->serve(nframes, _in.size(), _in.data());
+    }
+
+    const process_scope scope;
+    const std::int64_t start = callback_stats::now_ns();
+    const bool ok = _client->process(nframes, _in.size(),
+                                     _in.data(), _out.data());
+    _stats.record(start, callback_stats::now_ns() - start,
+                  nframes, _client->get_sample_rate());
     
-      if (_state != client_state::Idle) {
-        // Jack should only be initialized once.  If it is not Idle, someone
-        // already initialized this.  Just report the current state.
-        return _state;
-      }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
-      _state = client_state::Initializing;
+  void jack_backend::shutdown() {
+    _client->shutdown();
+  }
+
+  void jack_backend::xrun() {
+    _stats.xrun();
+  }
+
+  client_state jack_backend::start(client& c) {
+
+    if (_client_ptr != nullptr) {
+      std::cerr << "E> JACK backend can only be started once" << std::endl;
+      return client_state::Error;
     }
 
+    _client = &c;
+
     std::cerr << "I> Initializing JACK" << std::endl;
 
-    static const char* client_name = "dsp1";
     static const char* server_name = nullptr;
 
     jack_status_t jack_status;
     jack_options_t options = JackNullOption;
     
     // open a client connection to the JACK server
-    _client_ptr = jack_client_open(client_name,
+    _client_ptr = jack_client_open(_name.c_str(),
                                    options,
                                    &jack_status,
                                    server_name);
@@ -175,7 +207,7 @@ namespace jack {
       if (jack_status & JackServerFailed) {
         std::cerr << "E> Unable to connect to JACK server" << std::endl;
       }
-      return (_state = client_state::Error);
+      return client_state::Error;
     }
     
     if (jack_status & JackServerStarted) {
@@ -183,8 +215,8 @@ namespace jack {
     }
     
     if (jack_status & JackNameNotUnique) {
-      client_name = jack_get_client_name(_client_ptr);
-      std::cerr << "I> unique name '" << client_name
+      _name = jack_get_client_name(_client_ptr);
+      std::cerr << "I> unique name '" << _name
                 << "' assigned" << std::endl;
     }
 
@@ -194,7 +226,7 @@ namespace jack {
                                   jack::process,
                                   this) != 0) {
       std::cerr << "E> Unable to set process callback" << std::endl;
-      return (_state = client_state::Error);
+      return client_state::Error;
     }
 
     // call `jack::shutdown()' if jack ever shuts down, either
@@ -203,48 +235,79 @@ namespace jack {
                      jack::shutdown,
                      this);
 
+    // Count the xruns, to know how close to the deadline we run
+    if (jack_set_xrun_callback(_client_ptr, jack::xrun, this) != 0) {
+      std::cerr << "E> Unable to set xrun callback" << std::endl;
+    }
+
     // Callbacks to update buffer size and sample rate if necessary
     if (jack_set_buffer_size_callback(_client_ptr,
                                       jack::buffer_size_changed,
-                                      this)!=0) {
+                                      _client)!=0) {
       std::cerr << "E> Unable to set buffer size callback" << std::endl;
     }
     
     if (jack_set_sample_rate_callback(_client_ptr,
                                       jack::sample_rate_changed,
-                                      this)!=0) {
+                                      _client)!=0) {
       std::cerr << "E> Unable to set sample rate callback" << std::endl;
     }
 
     // Get sample rate and buffer size
-    _sample_rate = jack_get_sample_rate(_client_ptr);
-    _buffer_size = jack_get_buffer_size(_client_ptr);
+    set_format(jack_get_sample_rate(_client_ptr),
+               jack_get_buffer_size(_client_ptr));
      
     // display the current sample rate.
-    std::cerr << "I> Jack current sample rate: " << _sample_rate << std::endl;
-    std::cerr << "I> Jack current buffer size: " << _buffer_size << std::endl;
-
-    // create two ports
-    _input_port = jack_port_register(_client_ptr, "input",
-                                     JACK_DEFAULT_AUDIO_TYPE,
-                                     JackPortIsInput, 0);
-    _output_port = jack_port_register(_client_ptr, "output",
-                                      JACK_DEFAULT_AUDIO_TYPE,
-                                      JackPortIsOutput, 0);
-
-    if ((_input_port == nullptr) || (_output_port == nullptr)) {
-      std::cerr << "E> no more JACK ports available" << std::endl;
-      return (_state = client_state::Error);
+    std::cerr << "I> Jack current sample rate: "
+              << jack_get_sample_rate(_client_ptr) << std::endl;
+    std::cerr << "I> Jack current buffer size: "
+              << jack_get_buffer_size(_client_ptr) << std::endl;
+
+    // create two ports per channel
+    const unsigned int channels = c.get_channels();
+    _input_ports.assign(channels, nullptr);
+    _output_ports.assign(channels, nullptr);
+    _in.assign(channels, nullptr);
+    _out.assign(channels, nullptr);
+
+    for (unsigned int ch = 0; ch < channels; ++ch) {
+      // A single channel keeps the plain port names
+      const std::string suffix
+        = (channels == 1) ? "" : "_" + std::to_string(ch + 1);
+      _input_ports[ch] = jack_port_register(_client_ptr,
+                                            ("input" + suffix).c_str(),
+                                            JACK_DEFAULT_AUDIO_TYPE,
+                                            JackPortIsInput, 0);
+      _output_ports[ch] = jack_port_register(_client_ptr,
+                                             ("output" + suffix).c_str(),
+                                             JACK_DEFAULT_AUDIO_TYPE,
+                                             JackPortIsOutput, 0);
+
+      if ((_input_ports[ch] == nullptr) || (_output_ports[ch] == nullptr)) {
+        std::cerr << "E> no more JACK ports available" << std::endl;
+        return client_state::Error;
+      }
+    }
+
+    if (_source != nullptr) {
+      _source->prepare(channels, jack_get_buffer_size(_client_ptr));
+      std::cerr << "I> Input from a file: " << _source->frames() << " frames, "
+                << _source->channels() << " channels"
+                << (_source->loop() ? ", looped" : "") << std::endl;
+      if (_source->sample_rate() != jack_get_sample_rate(_client_ptr)) {
+        std::cerr << "W> The input file is at " << _source->sample_rate()
+                  << " Hz and is played without resampling" << std::endl;
+      }
     }
 
     // Tell the JACK server that we are ready to roll.  Our process()
     // callback will start running now.
     if (jack_activate (_client_ptr)) {
       std::cerr << "E> cannot activate client" << std::endl;
-      return (_state = client_state::Error);
+      return client_state::Error;
     }
 
-    _state = client_state::Running;
+    client_state state = client_state::Running;
     
     const char **ports = nullptr;
     
@@ -253,18 +316,26 @@ namespace jack {
     // aren't running.  Note the confusing (but necessary) orientation
     // of the driver backend ports: playback ports are "input" to the
     // backend, and capture ports are "output" from it.
-    ports = jack_get_ports(_client_ptr, nullptr, nullptr,
-                           JackPortIsPhysical|JackPortIsOutput);
+    ports = (_source != nullptr) ? nullptr
+      : jack_get_ports(_client_ptr, nullptr, nullptr,
+                       JackPortIsPhysical|JackPortIsOutput);
     
-    if (ports == nullptr) {
+    if (ports == nullptr && _source == nullptr) {
       stop();
       std::cerr << "E> no physical capture ports" << std::endl;
-      return (_state = client_state::Error);
+      return client_state::Error;
     }
     
-    if (jack_connect(_client_ptr, ports[0], jack_port_name(_input_port))) {
-      fprintf (stderr, "cannot connect input ports\n");
-      _state = client_state::Error;
+    for (unsigned int ch = 0; ports != nullptr && ch < channels; ++ch) {
+      if (ports[ch] == nullptr) {
+        std::cerr << "W> only " << ch << " physical capture ports" << std::endl;
+        break;
+      }
+      if (jack_connect(_client_ptr, ports[ch],
+                       jack_port_name(_input_ports[ch]))) {
+        fprintf (stderr, "cannot connect input ports\n");
+        state = client_state::Error;
+      }
     }
     
     free(ports);
@@ -274,18 +345,91 @@ namespace jack {
                             JackPortIsPhysical|JackPortIsInput);
     if (ports == nullptr) {
       std::cerr << "E> no physical playback ports" << std::endl;
-      return (_state = client_state::Error);
+      return client_state::Error;
     }
     
-    if (jack_connect (_client_ptr, jack_port_name(_output_port), ports[0])) {
-      std::cerr << "E> Cannot connect output ports" << std::endl;
-      _state = client_state::Error;
+    for (unsigned int ch = 0; ch < channels; ++ch) {
+      if (ports[ch] == nullptr) {
+        std::cerr << "W> only " << ch << " physical playback ports" << std::endl;
+        break;
+      }
+      if (jack_connect (_client_ptr, jack_port_name(_output_ports[ch]),
+                        ports[ch])) {
+        std::cerr << "E> Cannot connect output ports" << std::endl;
+        state = client_state::Error;
+      }
     }
 
     free(ports);
     ports=nullptr;
 
-    return (_state);
+    return state;
+  }
+
+  void jack_backend::stop() {
+    if (_client_ptr != nullptr) {
+      jack_deactivate(_client_ptr);
+    }
+  }
+
+  void jack_backend::close() {
+    if (_client_ptr != nullptr) {
+      std::cout << "I> Deactivating and closing JACK client" << std::endl;
+      jack_deactivate(_client_ptr);
+      jack_client_close(_client_ptr);
+      _client_ptr=nullptr;
+    }
+  }
+  
+
+  client::client() {
+  }
+
+  client::~client() {
+    if (_backend != nullptr) {
+      _backend->close();
+      _backend = nullptr;
+    }
+    _state = client_state::Stopped;
+  }
+  
+  
+  bool client::process(jack_nframes_t nframes,
+                       unsigned int channels,
+                       const sample_t *const *const in,
+                       sample_t *const *const out) {
+    for (unsigned int ch = 1; ch < channels; ++ch) {
+      memset(out[ch], 0, sizeof(sample_t) * nframes);
+    }
+    return (channels == 0) || process(nframes, in[0], out[0]);
+  }
+
+  client_state client::init() {
+    // The JACK server is the default backend
+    static jack_backend jack_server;
+    return init(jack_server);
+  }
+
+  client_state client::init(backend& b) {
+    
+    static std::mutex state_lock;
+
+    {
+      std::lock_guard<std::mutex> lk(state_lock);
+    
+      if (_state != client_state::Idle && _state != client_state::Stopped) {
+        // A backend should only be initialized once.  If it is not Idle
+        // or Stopped, someone already initialized this.  Just report the
+        // current state.
+        return _state;
+      }
+
+      _state = client_state::Initializing;
+    }
+
+    _backend = &b;
+    _state = b.start(*this);
+    return _state;
   }
   
   /*
@@ -298,32 +442,61 @@ namespace jack {
   }
 
   void client::stop() {
-    jack_deactivate(_client_ptr);
+    if (_backend != nullptr) {
+      _backend->stop();
+    }
     _state = client_state::Stopped;
   }
 
   void client::set_sample_rate(const jack_nframes_t sample_rate) {
     
-    std::cout << "I> Sample rate changed from " << _sample_rate
+    const jack_nframes_t previous = _sample_rate.exchange(sample_rate);
+    if (previous == sample_rate) {
+      return;
+    }
+    std::cerr << "I> Sample rate changed from " << previous
               << " to " << sample_rate << std::endl;
-    
-    _sample_rate = sample_rate;
+
+    if (_state == client_state::Running) {
+      format_changed();
+    }
   }
   
   void client::set_buffer_size(const jack_nframes_t buffer_size) {
     
-    std::cout << "I> buffer size changed from " << _buffer_size
+    const jack_nframes_t previous = _buffer_size.exchange(buffer_size);
+    if (previous == buffer_size) {
+      return;
+    }
+    std::cerr << "I> Buffer size changed from " << previous
               << " to " << buffer_size << std::endl;
 
-    _buffer_size = buffer_size; 
+    if (_state == client_state::Running) {
+      format_changed();
+    }
   }
 
-  jack_port_t *const client::input_port() const {
-    return _input_port;
+  void client::format_changed() {
   }
-  
-  jack_port_t *const client::output_port() const {
-    return _output_port;
+
+  void client::set_channels(const unsigned int channels) {
+    _channels = (channels > 0) ? channels : 1;
+  }
+
+  unsigned int client::get_channels() const {
+    return _channels;
+  }
+
+  client_state client::state() const {
+    return _state;
+  }
+
+  bool client::realtime() const {
+    return (_backend != nullptr) && _backend->realtime();
+  }
+
+  const callback_stats* client::stats() const {
+    return (_backend != nullptr) ? &_backend->stats() : nullptr;
   }
 
   jack_nframes_t jack::client::get_sample_rate() {
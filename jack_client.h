@@ -24,7 +24,12 @@
 #define _JACK_CLIENT_H
 
 #include <jack/jack.h>
+#include <atomic>
 #include <ostream>
+#include <string>
+#include <vector>
+
+#include "callback_stats.h"
 
 namespace jack {
 
@@ -36,7 +41,114 @@ namespace jack {
     Stopped,
     Error
   };
-  
+
+  class client;
+  class file_source;
+
+  /**
+   * Audio backend
+   *
+   * A backend is whatever calls client::process() with blocks of
+   * audio.  The default one is the JACK server (jack_backend), but a
+   * client can also be driven by other sources, like audio files
+   * processed offline (see file_backend.h).
+   */
+  class backend {
+  public:
+    virtual ~backend();
+
+    /**
+     * Prepare the backend to feed the given client, setting the
+     * client's sample rate and buffer size.  Returns Running if the
+     * client can start receiving process() calls.
+     */
+    virtual client_state start(client& c) = 0;
+
+    /**
+     * Stop calling process().  The backend may be started again.
+     */
+    virtual void stop() = 0;
+
+    /**
+     * Release all resources of the backend.
+     */
+    virtual void close() = 0;
+
+    /**
+     * True if process() is called by the backend at real-time pace
+     * from its own thread.
+     */
+    virtual bool realtime() const = 0;
+
+    /**
+     * Timing of the process() calls made by this backend
+     */
+    const callback_stats& stats() const { return _stats; }
+
+  protected:
+    callback_stats _stats;
+
+    /// Set the stream format seen by all clients
+    static void set_format(const jack_nframes_t sample_rate,
+                           const jack_nframes_t buffer_size);
+  };
+
+  /**
+   * Backend connected to a JACK server.
+   *
+   * Registers one input and one output port per channel of the client
+   * and connects them to the first physical capture and playback ports.
+   *
+   * With a file source (see file_source.h), the inputs are read from
+   * the file instead, and the input ports are left unconnected.
+   */
+  class jack_backend : public backend {
+  private:
+    jack_client_t* _client_ptr;
+    std::vector<jack_port_t*> _input_ports;
+    std::vector<jack_port_t*> _output_ports;
+    client*        _client;
+    file_source*   _source;
+    std::string    _name;
+
+    /// Port buffers of the current cycle, preallocated in start()
+    std::vector<const jack_default_audio_sample_t*> _in;
+    std::vector<jack_default_audio_sample_t*> _out;
+
+  public:
+    jack_backend();
+    virtual ~jack_backend();
+
+    virtual client_state start(client& c) override;
+    virtual void stop() override;
+    virtual void close() override;
+    virtual bool realtime() const override { return true; }
+
+    /**
+     * Feed the client from source instead of the capture ports.  Must
+     * be called before start(); the source must outlive the backend.
+     */
+    void set_source(file_source* source) { _source = source; }
+
+    /**
+     * Name of the client in the JACK graph, "dsp1" by default.  Must be
+     * called before start(); if the name is taken, JACK picks another.
+     */
+    void set_name(const std::string& name) { _name = name; }
+    const std::string& name() const { return _name; }
+
+    /// Called from JACK's process thread
+    int process(jack_nframes_t nframes);
+
+    /// Called if the server shuts down
+    void shutdown();
+
+    /// Called by the server on every xrun
+    void xrun();
+
+    jack_client_t* jack_client() const { return _client_ptr; }
+  };
+
   /**
    * Jack client class
    *
@@ -49,16 +161,15 @@ namespace jack {
   private:
     
     /// Part of monostate 
-    static jack_client_t* _client_ptr;
+    static backend*       _backend;
     static client_state   _state;
 
-    static jack_nframes_t _buffer_size;
-    static jack_nframes_t _sample_rate;
-    
-  protected:
-    
-    static jack_port_t*   _input_port;
-    static jack_port_t*   _output_port;
+    /// Written by the backend, read from the process and other threads
+    static std::atomic<jack_nframes_t> _buffer_size;
+    static std::atomic<jack_nframes_t> _sample_rate;
+    static unsigned int   _channels;
+
+    friend class backend;
     
   public:
     typedef jack_default_audio_sample_t sample_t;
@@ -80,6 +191,18 @@ namespace jack {
     virtual bool process(jack_nframes_t nframes,
                          const sample_t *const in,
                          sample_t *const out) = 0;
+
+    /**
+     * Process nframes of several channels: in[c] and out[c] are the
+     * buffers of channel c.  This is what the backends call.
+     *
+     * The default implementation processes channel 0 with the single
+     * channel process() and silences the other outputs.
+     */
+    virtual bool process(jack_nframes_t nframes,
+                         unsigned int channels,
+                         const sample_t *const *const in,
+                         sample_t *const *const out);
     
     virtual void shutdown();
 
@@ -91,24 +214,58 @@ namespace jack {
      */
     client_state init();
 
+    /**
+     * Start processing with the given backend instead of the JACK
+     * server.  The backend must outlive the client.
+     */
+    client_state init(backend& b);
+
     /**
      * Stop processing.  After calling this method, the application must
      * end, as no Jack client will be available anymore.
      */
     void stop();
     
+    /**
+     * Called by the backend when the server changes the stream format.
+     * While running they call format_changed().
+     */
     void set_sample_rate(const jack_nframes_t sample_rate);
     void set_buffer_size(const jack_nframes_t buffer_size);
 
     /**
-     * Get input port
+     * Called after the sample rate or the buffer size changed while
+     * running, from a thread that is not the process thread (JACK's
+     * notification thread), so it may allocate and block.  process()
+     * may be called with the new buffer size before it returns.
+     *
+     * The default implementation does nothing.
+     */
+    virtual void format_changed();
+
+    /**
+     * Set the number of input/output channels.  Must be called before
+     * init().
+     */
+    void set_channels(const unsigned int channels);
+    unsigned int get_channels() const;
+
+    /**
+     * Get current state
+     */
+    client_state state() const;
+
+    /**
+     * True if process() is being called in real time (JACK server),
+     * false for offline backends.
      */
-    jack_port_t *const input_port() const;
+    bool realtime() const;
 
     /**
-     * Get output port
+     * Timing statistics of the process() calls, or nullptr if no
+     * backend is running.  Lock-free, can be called from any thread.
      */
-    jack_port_t *const output_port() const;
+    const callback_stats* stats() const;
 
     /**
      * Get sample rate
@@ -0,0 +1,229 @@
+#include "loudness.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace dsp {
+
+namespace {
+
+double lufs(double mean_square) {
+    return mean_square > 0 ? -0.691 + 10 * std::log10(mean_square) : loudness_meter::floor_lufs;
+}
+
+// States this small only decay further into denormals
+constexpr double denormal = 1e-30;
+
+}  // namespace
+
+loudness_meter::loudness_meter()
+    : shelf{1, 0, 0, 0, 0},
+      highpass{1, 0, 0, 0, 0},
+      block_length(1),
+      position(0),
+      sum(0),
+      history{},
+      next(0),
+      gated{},
+      short_terms{},
+      result{} {
+    prepare(0);
+}
+
+void loudness_meter::prepare(unsigned int channels) {
+    state.assign(channels, channel_state{});
+    for (histogram *h : {&gated, &short_terms}) {
+        h->count.assign(bins, 0);
+        h->energy.assign(bins, 0.0);
+    }
+    reset();
+}
+
+void loudness_meter::set_sample_rate(float sample_rate) {
+    // The filters of BS.1770 at 48 kHz, from the analog prototypes that
+    // give them back under the bilinear transform
+    double f0 = 1681.974450955533;
+    double Q = 0.7071752369554196;
+    double K = std::tan(M_PI * f0 / sample_rate);
+    const double Vh = std::pow(10.0, 3.999843853973347 / 20);
+    const double Vb = std::pow(Vh, 0.4996667741545416);
+    double a0 = 1 + K / Q + K * K;
+    shelf = {(Vh + Vb * K / Q + K * K) / a0, 2 * (K * K - Vh) / a0,
+             (Vh - Vb * K / Q + K * K) / a0, 2 * (K * K - 1) / a0,
+             (1 - K / Q + K * K) / a0};
+
+    f0 = 38.13547087602444;
+    Q = 0.5003270373238773;
+    K = std::tan(M_PI * f0 / sample_rate);
+    a0 = 1 + K / Q + K * K;
+    highpass = {1, -2, 1, 2 * (K * K - 1) / a0, (1 - K / Q + K * K) / a0};
+
+    block_length = std::max<std::size_t>(std::lround(0.1 * sample_rate), 1);
+    std::fill(state.begin(), state.end(), channel_state{});
+    position = 0;
+    sum = 0;
+}
+
+void loudness_meter::reset() {
+    std::fill(state.begin(), state.end(), channel_state{});
+    position = 0;
+    sum = 0;
+    history.fill(0);
+    next = 0;
+    gated.clear();
+    short_terms.clear();
+    result = {0, floor_lufs, floor_lufs, floor_lufs, 0};
+}
+
+std::size_t loudness_meter::process(const float *const *in, unsigned int channels,
+                                    std::size_t n) {
+    channels = std::min<unsigned int>(channels, state.size());
+    std::size_t completed = 0;
+    std::size_t done = 0;
+    while (done < n) {
+        const std::size_t k = std::min(n - done, block_length - position);
+        for (unsigned int c = 0; c < channels; ++c) {
+            const float *const x = in[c] + done;
+            channel_state &s = state[c];
+            double z1 = s.z1[0], z2 = s.z2[0];
+            double w1 = s.z1[1], w2 = s.z2[1];
+            double squares = 0;
+            for (std::size_t i = 0; i < k; ++i) {
+                const double u = shelf.b0 * x[i] + z1;
+                z1 = shelf.b1 * x[i] - shelf.a1 * u + z2;
+                z2 = shelf.b2 * x[i] - shelf.a2 * u;
+                const double y = highpass.b0 * u + w1;
+                w1 = highpass.b1 * u - highpass.a1 * y + w2;
+                w2 = highpass.b2 * u - highpass.a2 * y;
+                squares += y * y;
+            }
+            s.z1[0] = std::abs(z1) < denormal ? 0 : z1;
+            s.z2[0] = std::abs(z2) < denormal ? 0 : z2;
+            s.z1[1] = std::abs(w1) < denormal ? 0 : w1;
+            s.z2[1] = std::abs(w2) < denormal ? 0 : w2;
+            sum += squares;
+        }
+        done += k;
+        position += k;
+        if (position == block_length) {
+            finish_block();
+            ++completed;
+        }
+    }
+    return completed;
+}
+
+void loudness_meter::finish_block() {
+    history[next] = sum / block_length;
+    next = (next + 1) % short_term_blocks;
+    position = 0;
+    sum = 0;
+    ++result.blocks;
+
+    // Gating blocks of 400 ms overlap by 75%, short-term windows are
+    // taken every block too (the 10 Hz of Tech 3342)
+    if (result.blocks >= momentary_blocks) {
+        const double momentary = mean_of_last(momentary_blocks);
+        result.momentary = static_cast<float>(lufs(momentary));
+        gated.add(momentary, lufs(momentary));
+        update_integrated();
+    }
+    if (result.blocks >= short_term_blocks) {
+        const double short_term = mean_of_last(short_term_blocks);
+        result.short_term = static_cast<float>(lufs(short_term));
+        short_terms.add(short_term, lufs(short_term));
+        update_range();
+    }
+}
+
+double loudness_meter::mean_of_last(std::size_t blocks) const {
+    double total = 0;
+    for (std::size_t i = 1; i <= blocks; ++i) {
+        total += history[(next + short_term_blocks - i) % short_term_blocks];
+    }
+    return total / blocks;
+}
+
+void loudness_meter::update_integrated() {
+    if (gated.total_count == 0) {
+        result.integrated = floor_lufs;
+        return;
+    }
+    // Relative gate 10 LU below the blocks above the absolute one
+    const double gate = lufs(gated.total_energy / gated.total_count) - 10;
+    std::uint64_t count = 0;
+    double energy = 0;
+    for (std::size_t b = gated.first_above(gate); b < bins; ++b) {
+        count += gated.count[b];
+        energy += gated.energy[b];
+    }
+    result.integrated = count > 0 ? static_cast<float>(lufs(energy / count)) : floor_lufs;
+}
+
+void loudness_meter::update_range() {
+    if (short_terms.total_count == 0) {
+        result.range = 0;
+        return;
+    }
+    // Relative gate 20 LU below, then from the 10th to the 95th
+    // percentile of what is left
+    const double gate = lufs(short_terms.total_energy / short_terms.total_count) - 20;
+    const std::size_t first = short_terms.first_above(gate);
+    std::uint64_t count = 0;
+    for (std::size_t b = first; b < bins; ++b) {
+        count += short_terms.count[b];
+    }
+    if (count == 0) {
+        result.range = 0;
+        return;
+    }
+    const std::uint64_t low_rank = static_cast<std::uint64_t>(0.10 * (count - 1));
+    const std::uint64_t high_rank = static_cast<std::uint64_t>(0.95 * (count - 1));
+    std::size_t low = first;
+    std::size_t high = first;
+    std::uint64_t seen = 0;
+    for (std::size_t b = first; b < bins; ++b) {
+        if (seen <= low_rank && low_rank < seen + short_terms.count[b]) {
+            low = b;
+        }
+        if (seen <= high_rank && high_rank < seen + short_terms.count[b]) {
+            high = b;
+            break;
+        }
+        seen += short_terms.count[b];
+    }
+    result.range = static_cast<float>((high - low) * bin_width);
+}
+
+void loudness_meter::histogram::clear() {
+    std::fill(count.begin(), count.end(), 0);
+    std::fill(energy.begin(), energy.end(), 0.0);
+    total_count = 0;
+    total_energy = 0;
+}
+
+void loudness_meter::histogram::add(double mean_square, double loudness) {
+    if (loudness < lowest) {
+        return;  // Below the absolute gate
+    }
+    const std::size_t b = std::min(static_cast<std::size_t>((loudness - lowest) / bin_width), bins - 1);
+    ++count[b];
+    energy[b] += mean_square;
+    ++total_count;
+    total_energy += mean_square;
+}
+
+std::size_t loudness_meter::histogram::first_above(double gate) const {
+    if (gate <= lowest) {
+        return 0;
+    }
+    const double position = (gate - lowest) / bin_width;
+    if (position >= bins) {
+        return bins;
+    }
+    // The bin of the gate counts if its center is above it
+    const std::size_t b = static_cast<std::size_t>(position);
+    return position - b <= 0.5 ? b : b + 1;
+}
+
+}  // namespace dsp
@@ -0,0 +1,124 @@
+#ifndef _LOUDNESS_H
+#define _LOUDNESS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * Loudness of a program after the last 100 ms block, in LUFS (LU for
+ * the range).  Trivially copyable, so that it can be published through
+ * a snapshot.  Values not measured yet, or of digital silence, read
+ * loudness_meter::floor_lufs.
+ */
+struct loudness_reading {
+    std::uint64_t blocks;  // 100 ms blocks measured since the last reset
+    float momentary;       // Last 400 ms, ungated
+    float short_term;      // Last 3 s, ungated
+    float integrated;      // Everything since the reset, gated
+    float range;           // Loudness range (EBU Tech 3342)
+};
+
+/**
+ * Loudness meter of ITU-R BS.1770 / EBU R128.
+ *
+ * Every channel goes through the K-weighting filter (a high shelf and
+ * the RLB high pass, designed for the sample rate from their analog
+ * prototypes) and the mean squares of all the channels are added, each
+ * with weight 1: the channels of the client have no surround layout.
+ *
+ * The mean square is accumulated in double precision over blocks of
+ * 100 ms, each started from zero.  The momentary and short-term levels
+ * are recomputed at the end of every block from the last 4 and 30 of
+ * them, so no running sum is ever subtracted from.  The integrated
+ * level and the loudness range keep their gated blocks in histograms of
+ * 0.1 LU from -70 to +10 LUFS, which keeps the memory constant over any
+ * length of program; their relative gates and percentiles are resolved
+ * to one bin.
+ *
+ * prepare() allocates; everything else is real-time safe.
+ */
+class loudness_meter {
+   public:
+    static constexpr float floor_lufs = -200;
+
+    loudness_meter();
+
+    // Filter states for this many channels.  Not real-time safe.
+    void prepare(unsigned int channels);
+
+    /**
+     * Design the filters and the block length for sample_rate.  Restarts
+     * the current block, keeps the measured ones.
+     */
+    void set_sample_rate(float sample_rate);
+
+    // Forget the program, from the filter states to the histograms
+    void reset();
+
+    /**
+     * Measure n frames of the channels in[0, channels) (no more than
+     * prepared).  Returns the number of 100 ms blocks completed; the
+     * reading is updated after each.
+     */
+    std::size_t process(const float *const *in, unsigned int channels, std::size_t n);
+
+    const loudness_reading &reading() const { return result; }
+
+   private:
+    // Direct form II transposed, in double: the poles of the 38 Hz high
+    // pass sit very close to the unit circle
+    struct biquad {
+        double b0, b1, b2, a1, a2;
+    };
+    struct channel_state {
+        double z1[2];
+        double z2[2];
+    };
+
+    static constexpr std::size_t momentary_blocks = 4;
+    static constexpr std::size_t short_term_blocks = 30;
+
+    // Histogram of the gated blocks
+    static constexpr double lowest = -70;   // Absolute gate, in LUFS
+    static constexpr double bin_width = 0.1;
+    static constexpr std::size_t bins = 800;  // Up to +10 LUFS
+    struct histogram {
+        std::vector<std::uint64_t> count;
+        std::vector<double> energy;  // Sum of the mean squares of each bin
+        std::uint64_t total_count;
+        double total_energy;
+
+        void clear();
+        void add(double mean_square, double loudness);
+        // First bin at or above a gate, by the loudness of its center
+        std::size_t first_above(double gate) const;
+    };
+
+    biquad shelf;
+    biquad highpass;
+    std::vector<channel_state> state;
+
+    std::size_t block_length;  // Samples per 100 ms block
+    std::size_t position;      // Samples of the current block
+    double sum;                // Weighted squares of the current block
+
+    std::array<double, short_term_blocks> history;  // Mean square per block
+    std::size_t next;                               // Oldest of history
+    histogram gated;       // 400 ms blocks, for the integrated level
+    histogram short_terms; // 3 s windows, for the range
+
+    loudness_reading result;
+
+    void finish_block();
+    double mean_of_last(std::size_t blocks) const;
+    void update_integrated();
+    void update_range();
+};
+
+}  // namespace dsp
+
+#endif
@@ -7,16 +7,71 @@
 
 #include <boost/program_options.hpp>
 #include <boost/version.hpp>
+#include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
 
+#include <unistd.h>
+
+#include "control_server.h"
 #include "dsp_client.h"
+#include "file_backend.h"
+#include "file_source.h"
+#include "rt_memory.h"
+#include "telemetry.h"
 #include "waitkey.h"
 namespace po = boost::program_options;
 
+// With --lock-memory, keep room in the locked heap for a second set of
+// the buffers the client just allocated: a change of the stream format
+// builds the new set while the old one is still in use
+void reserve_buffers(std::size_t heap_before) {
+    const std::size_t heap = jack::heap_in_use();
+    const std::size_t buffers = heap > heap_before ? heap - heap_before : 0;
+    jack::reserve_heap(buffers);
+    std::cerr << "I> Memory locked, " << buffers / 1024
+              << " KiB of heap reserved for the DSP buffers" << std::endl;
+}
+
+// Allocations counted by the malloc tripwire, if it was built in
+void report_tripwire() {
+    if (!jack::tripwire_enabled) {
+        return;
+    }
+    const jack::tripwire_report r = jack::read_tripwire();
+    if (r.allocations == 0 && r.frees == 0) {
+        std::cerr << "I> No allocations on the process thread" << std::endl;
+        return;
+    }
+    std::cerr << "W> " << r.allocations << " allocations (largest " << r.largest
+              << " bytes) and " << r.frees << " frees on the process thread, first at:"
+              << std::endl;
+    jack::print_tripwire(STDERR_FILENO);
+}
+
+// Close the --record file and report what was lost
+void stop_recording(dsp_client& client) {
+    const dsp::disk_recorder& recorder = client.get_recorder();
+    if (!recorder.recording()) {
+        return;
+    }
+    client.stop_recording();
+    std::cerr << "I> Recorded " << recorder.frames() << " frames, "
+              << recorder.dropped() << " dropped"
+              << (recorder.direct() ? " (direct I/O)" : "") << std::endl;
+    if (recorder.error() != 0) {
+        std::cerr << "E> Recording failed: " << std::strerror(recorder.error()) << std::endl;
+    }
+}
+
 void signal_handler(int signal) {
     if (signal == SIGINT) {
         std::cout << "Ctrl-C caught, cleaning up and exiting   " << std::endl;
@@ -26,17 +81,215 @@ void signal_handler(int signal) {
     }
 }
 
+// Select the mode as the corresponding keys in the main loop do
+void set_mode(dsp_client& client, const std::string& mode) {
+    if (mode == "passthrough") {
+        client.change_mode(dsp_client::Mode::Passthrough);
+    } else if (mode == "volume") {
+        client.change_mode(dsp_client::Mode::VolumeChange);
+    } else if (mode == "repeater" || mode == "tuner" || mode == "autotune") {
+        client.set_period_mode(true);
+        client.change_mode(mode == "repeater" ? dsp_client::Mode::Repeater
+                           : mode == "tuner"  ? dsp_client::Mode::Tuner
+                                              : dsp_client::Mode::Autotune);
+    } else {
+        throw std::invalid_argument("Unknown mode: " + mode);
+    }
+}
+
+// Run one line of the control socket protocol and return the reply:
+// "ok", "ok" and a JSON status, or "error" and the reason
+std::string execute(dsp_client& client, dsp::control_server& control,
+                    const dsp::control_server::event& command, bool& running) {
+    std::istringstream words(command.text);
+    std::string name;
+    words >> name;
+    auto number = [&words, &name]() {
+        float value;
+        if (!(words >> value)) {
+            throw std::invalid_argument(name + " needs a number");
+        }
+        return value;
+    };
+    auto positive = [&number, &name]() {
+        const float value = number();
+        if (!(value > 0)) {
+            throw std::invalid_argument(name + " must be positive");
+        }
+        return value;
+    };
+    auto word = [&words, &name]() {
+        std::string value;
+        if (!(words >> value)) {
+            throw std::invalid_argument(name + " needs an argument");
+        }
+        return value;
+    };
+    auto flag = [&word, &name]() {
+        const std::string value = word();
+        if (value != "on" && value != "off") {
+            throw std::invalid_argument(name + " is on or off");
+        }
+        return value == "on";
+    };
+
+    try {
+        if (name == "mode") {
+            set_mode(client, word());
+        } else if (name == "volume") {
+            client.set_volume(number());
+        } else if (name == "energy") {
+            client.set_energy_mode(flag());
+        } else if (name == "period") {
+            client.set_period_mode(flag());
+        } else if (name == "spectrum") {
+            client.set_spectrum_mode(flag());
+        } else if (name == "loudness") {
+            const std::string value = word();
+            if (value == "reset") {
+                client.reset_loudness();
+            } else if (value == "on" || value == "off") {
+                client.set_loudness_mode(value == "on");
+            } else {
+                throw std::invalid_argument("loudness is on, off or reset");
+            }
+        } else if (name == "energy-window") {
+            client.set_energy_window_size(positive());
+        } else if (name == "window") {
+            client.resize_period_window(positive(), client.get_period_ringsize());
+        } else if (name == "ringsize") {
+            client.resize_period_window(client.get_period_window_size(), positive());
+        } else if (name == "minfreq") {
+            client.set_period_minfreq(positive());
+        } else if (name == "maxfreq") {
+            client.set_period_maxfreq(positive());
+        } else if (name == "minlevel") {
+            client.set_period_minlevel(number());
+        } else if (name == "a4") {
+            client.set_reference_pitch(positive());
+        } else if (name == "status") {
+            dsp::telemetry_frame frame;
+            client.get_telemetry(frame);
+            std::ostringstream status;
+            status << "ok ";
+            dsp::write_json(status, frame, 0);
+            return status.str();
+        } else if (name == "subscribe" || name == "unsubscribe") {
+            control.subscribe(command.connection, name == "subscribe");
+        } else if (name == "quit") {
+            running = false;
+        } else if (name == "help") {
+            return "ok mode volume energy period spectrum loudness energy-window window "
+                   "ringsize minfreq maxfreq minlevel a4 status subscribe unsubscribe quit";
+        } else {
+            return "error unknown command: " + name;
+        }
+    } catch (std::exception& exc) {
+        return std::string("error ") + exc.what();
+    }
+    return "ok";
+}
+
+// Strongest bin and band levels of every channel
+void print_spectrum(const dsp_client& client) {
+    static dsp::spectrum_frame spectrum;
+    for (unsigned int ch = 0; ch < client.get_channels(); ++ch) {
+        client.get_spectrum(ch, spectrum);
+        if (client.get_channels() > 1) {
+            std::cout << "Canal " << ch + 1 << "\n";
+        }
+        std::cout << std::fixed << std::setprecision(1)
+                  << "Pico: " << spectrum.peak_frequency << " Hz ("
+                  << spectrum.peak_level << " dB)\nBandas:";
+        std::cout << std::setprecision(0);
+        for (unsigned int b = 0; b < spectrum.bands; ++b) {
+            std::cout << " " << spectrum.band_center[b] << ":"
+                      << std::max(spectrum.band_level[b], -99.0f);
+        }
+        std::cout << "\n\n";
+    }
+}
+
+// Momentary, short-term and integrated loudness and loudness range
+void print_loudness(float momentary, float short_term, float integrated, float range) {
+    // Silence and what is not measured yet read -200
+    auto level = [](float lufs) { return std::max(lufs, -99.9f); };
+    std::cout << std::fixed << std::setprecision(1)
+              << "Sonoridad: M " << level(momentary) << "  S " << level(short_term)
+              << "  I " << level(integrated) << " LUFS  LRA " << range << " LU\n\n";
+}
+
+// Energy/power or period and tuner results of every channel, from the
+// frame that was just published
+void print_metrics(const dsp_client& client, const dsp::telemetry_frame& frame, bool energy) {
+    for (unsigned int ch = 0; ch < frame.channels; ++ch) {
+        const dsp::telemetry_channel& c = frame.channel[ch];
+        if (frame.channels > 1 && (frame.energy_mode || frame.period_mode)) {
+            std::cout << "Canal " << ch + 1 << "\n";
+        }
+        if (frame.energy_mode) {
+            std::cout << std::fixed << std::setprecision(6)
+                      << (energy ? "Energy: " : "Power: ")
+                      << (energy ? c.energy : c.power) << "\n\n";
+        } else if (frame.period_mode) {
+            std::cout << std::fixed << std::setprecision(2)
+                      << "Period: " << c.period
+                      << "\tFreq: " << c.frequency
+                      << "\tConfidence: " << c.confidence << "\n\n";
+
+            const char* note = c.note < 0 ? "Sin sonido" : dsp::note_table::name(c.note);
+            if (client.get_current_mode() == dsp_client::Mode::Tuner) {
+                std::cout << "Frecuencia mas cercana: " << c.freq_tuned << "\n"
+                          << "Corresponde a la nota: " << note
+                          << " (" << std::showpos << c.cents << std::noshowpos
+                          << " cents)\n";
+
+                const float difference = client.get_freq_diff(ch);
+                if (std::abs(difference) < 0.5) {
+                    std::cout << "Está afinado\n";
+                } else if (difference < 0) {
+                    std::cout << "Debe bajar el tono\n";
+                } else {
+                    std::cout << "Debe subir el tono\n";
+                }
+            } else if (client.get_current_mode() == dsp_client::Mode::Autotune) {
+                std::cout << "Periodo actual: " << c.period << "\n"
+                          << "Frecuencia actual: " << c.frequency << "\n"
+                          << "Frecuencia mas cercana: " << c.freq_tuned << "\n"
+                          << "Corresponde a la nota: " << note << "\n";
+            }
+        }
+    }
+    if (client.get_spectrum_mode()) {
+        print_spectrum(client);
+    }
+    if (frame.loudness_mode) {
+        print_loudness(frame.momentary, frame.short_term, frame.integrated, frame.loudness_range);
+    }
+    // One write per update instead of one per line
+    std::cout << std::flush;
+}
+
 int main(int argc, char* argv[]) {
     // ///////////////////////////////////////////
 
     po::options_description desc("Options");
 
     // Define las opciones de línea de comandos
-    desc.add_options()("help,h", "Show help message")("energy,e", po::value<float>(), "Set energy window size")("minfreq", po::value<int>(), "Set minimum frequency")("maxfreq", po::value<int>(), "Set maximum frequency")("minlevel", po::value<float>(), "Set minimum level")("nwindow,n", po::value<float>(), "Set window size")("ringsize,r", po::value<float>(), "Set ring size");
+    desc.add_options()("help,h", "Show help message")("energy,e", po::value<float>(), "Set energy window size")("minfreq", po::value<int>(), "Set minimum frequency")("maxfreq", po::value<int>(), "Set maximum frequency")("minlevel", po::value<float>(), "Set minimum level")("a4", po::value<float>(), "Set tuning reference for la4 in Hz")("nwindow,n", po::value<float>(), "Set window size")("ringsize,r", po::value<float>(), "Set ring size")("decimate", po::value<int>()->default_value(0), "Set decimation of the pitch analysis (0 chooses it from --maxfreq, 1 disables it)")("engine", po::value<std::string>(), "Set autocorrelation engine (fft, direct, sliding)")("detector,d", po::value<std::string>(), "Set pitch detector (autocorrelation, yin, mpm)")("mode,m", po::value<std::string>(), "Set initial mode (passthrough, volume, repeater, tuner, autotune)")("input,i", po::value<std::string>(), "Process a WAV/raw float file offline instead of using JACK")("output,o", po::value<std::string>(), "Write the processed --input to a file")("frames", po::value<int>()->default_value(1024), "Set block size for --input")("rate", po::value<int>()->default_value(48000), "Set sample rate of raw --input files")("channels,c", po::value<int>()->default_value(1), "Set number of input/output channels")("analysis-threads", po::value<int>()->default_value(1), "Set number of pitch analysis threads")("telemetry-shm", po::value<std::string>(), "Publish metrics in this shared memory segment (e.g. /dsp1)")("telemetry-socket", po::value<std::string>(), "Send metrics as datagrams to this UNIX socket")("telemetry-rate", po::value<float>()->default_value(2), "Set metrics updates per second")("quiet,q", "Do not print the metrics on the terminal")("lock-memory", "Lock all memory and preallocate the heap for low latency")("record", po::value<std::string>(), "Record the input and output of every channel to a WAV/raw float file")("inject", po::value<std::string>(), "Feed the JACK client from a WAV/raw float file instead of the capture ports")("inject-start", po::value<long>()->default_value(0), "Set first frame of the --inject file")("loop", "Play the --inject file again from --inject-start when it ends")("spectrum", "Analyze the spectrum of the input alongside the mode")("fft-size", po::value<int>()->default_value(4096), "Set FFT size of the spectrum")("hop", po::value<int>()->default_value(1024), "Set samples between spectrum frames")("bands", po::value<std::string>()->default_value("third"), "Set spectrum bands (octave, third)")("loudness", "Measure the EBU R128 loudness of the input alongside the mode")("config", po::value<std::string>(), "Read options from this file, one name = value per line (the command line wins)")("name", po::value<std::string>()->default_value("dsp1"), "Set JACK client name")("control-socket", po::value<std::string>(), "Run headless, taking commands on this UNIX socket");
 
     // Parsea los argumentos de línea de comandos
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("config")) {
+        // Values already given on the command line are kept
+        std::ifstream config(vm["config"].as<std::string>());
+        if (!config) {
+            std::cerr << argv[0] << ": Error: Cannot read " << vm["config"].as<std::string>() << std::endl;
+            return EXIT_FAILURE;
+        }
+        po::store(po::parse_config_file(config, desc), vm);
+    }
     po::notify(vm);
 
     // Verifica si se especificó la opción de ayuda
@@ -73,6 +326,14 @@ int main(int argc, char* argv[]) {
             client.set_period_minlevel(period_minlevel);
         }
 
+        if (vm.count("a4")) {
+            float reference = vm["a4"].as<float>();
+            if (reference <= 0) {
+                throw std::invalid_argument("--a4 must be positive");
+            }
+            client.set_reference_pitch(reference);
+        }
+
         if (vm.count("nwindow") || vm.count("n")) {
             float period_window_size = vm.count("nwindow") ? vm["nwindow"].as<float>() : vm["n"].as<float>();
             client.set_period_window_size(period_window_size);
@@ -83,16 +344,260 @@ int main(int argc, char* argv[]) {
             client.set_period_ringsize(period_ringsize);
         }
 
-        if (client.init() != jack::client_state::Running) {
+        const int decimation = vm["decimate"].as<int>();
+        if (decimation < 0) {
+            throw std::invalid_argument("The decimation cannot be negative");
+        }
+        client.set_period_decimation(decimation);
+
+        if (vm.count("engine")) {
+            std::string engine = vm["engine"].as<std::string>();
+            if (engine == "fft") {
+                client.set_correlation_engine(dsp_client::CorrelationEngine::FFT);
+            } else if (engine == "direct") {
+                client.set_correlation_engine(dsp_client::CorrelationEngine::Direct);
+            } else if (engine == "sliding") {
+                client.set_correlation_engine(dsp_client::CorrelationEngine::Sliding);
+            } else {
+                throw std::invalid_argument("Unknown autocorrelation engine: " + engine);
+            }
+        }
+
+        if (vm.count("detector") || vm.count("d")) {
+            std::string detector = vm.count("detector") ? vm["detector"].as<std::string>() : vm["d"].as<std::string>();
+            if (detector == "autocorrelation") {
+                client.set_pitch_detector(dsp_client::PitchDetector::Autocorrelation);
+            } else if (detector == "yin") {
+                client.set_pitch_detector(dsp_client::PitchDetector::YIN);
+            } else if (detector == "mpm") {
+                client.set_pitch_detector(dsp_client::PitchDetector::MPM);
+            } else {
+                throw std::invalid_argument("Unknown pitch detector: " + detector);
+            }
+        }
+
+        if (vm["channels"].as<int>() < 1 || vm["analysis-threads"].as<int>() < 1) {
+            throw std::invalid_argument("--channels and --analysis-threads must be at least 1");
+        }
+        client.set_channels(vm["channels"].as<int>());
+
+        const std::string bands = vm["bands"].as<std::string>();
+        if (bands != "octave" && bands != "third") {
+            throw std::invalid_argument("Unknown spectrum bands: " + bands);
+        }
+        if (vm["fft-size"].as<int>() < 1 || vm["hop"].as<int>() < 1) {
+            throw std::invalid_argument("--fft-size and --hop must be positive");
+        }
+        client.set_spectrum_size(vm["fft-size"].as<int>(), vm["hop"].as<int>());
+        client.set_spectrum_bands(bands == "octave" ? 1 : 3);
+        if (vm.count("spectrum")) {
+            client.set_spectrum_mode(true);
+        }
+        if (vm.count("loudness")) {
+            client.set_loudness_mode(true);
+        }
+        client.set_analysis_threads(vm["analysis-threads"].as<int>());
+
+        const float telemetry_rate = vm["telemetry-rate"].as<float>();
+        if (!(telemetry_rate > 0)) {
+            throw std::invalid_argument("--telemetry-rate must be positive");
+        }
+        static dsp::telemetry_publisher telemetry;
+        if (vm.count("telemetry-shm")) {
+            telemetry.open_shared_memory(vm["telemetry-shm"].as<std::string>());
+        }
+        if (vm.count("telemetry-socket")) {
+            telemetry.open_socket(vm["telemetry-socket"].as<std::string>());
+        }
+        dsp::telemetry_frame frame;
+
+        // Headless: the control socket replaces the keyboard, and SIGINT
+        // and SIGTERM arrive through it, so it has to be opened before
+        // the client starts its threads
+        static dsp::control_server control;
+        const bool headless = vm.count("control-socket");
+        if (headless) {
+            if (vm.count("input")) {
+                throw std::invalid_argument("--control-socket runs with JACK, not with --input");
+            }
+            control.open(vm["control-socket"].as<std::string>(), 1 / telemetry_rate);
+            client.set_results_listener([] { control.notify(); });
+        }
+
+        // Lock before the buffers and threads are created, so that they
+        // are resident from the start
+        const bool lock_memory = vm.count("lock-memory");
+        if (lock_memory) {
+            jack::lock_memory();
+        }
+        const std::size_t heap_before = jack::heap_in_use();
+
+        if (vm.count("input")) {
+            // Offline processing, as fast as possible
+            jack::file_backend backend(vm["input"].as<std::string>(),
+                                       vm.count("output") ? vm["output"].as<std::string>() : "",
+                                       vm["frames"].as<int>(),
+                                       vm["rate"].as<int>());
+
+            if (client.init(backend) != jack::client_state::Running) {
+                throw std::runtime_error("Could not initialize the offline client");
+            }
+            if (lock_memory) {
+                reserve_buffers(heap_before);
+            }
+            if (vm.count("record")) {
+                client.start_recording(vm["record"].as<std::string>());
+            }
+            if (vm.count("mode")) {
+                set_mode(client, vm["mode"].as<std::string>());
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            std::size_t frames = backend.run([] { client.analyze(); });
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            client.stop();
+            stop_recording(client);
+            report_tripwire();
+
+            double duration = static_cast<double>(frames) / backend.sample_rate();
+            std::cout << std::fixed << std::setprecision(2)
+                      << "Processed " << frames << " frames (" << duration
+                      << " s) in " << elapsed.count() << " s, "
+                      << duration / elapsed.count() << "x real time" << std::endl;
+
+            std::cout << "Callbacks: " << client.stats()->read() << std::endl;
+
+            if (telemetry.active()) {
+                client.get_telemetry(frame);
+                telemetry.publish(frame);
+            }
+
+            for (unsigned int ch = 0; client.get_period_mode() && ch < client.get_channels(); ++ch) {
+                if (client.get_channels() > 1) {
+                    std::cout << "Ch " << ch + 1 << "\t";
+                }
+                std::cout << "Period: " << client.get_period(ch)
+                          << "\tFreq: " << client.get_freq(ch)
+                          << "\tConfidence: " << client.get_confidence(ch)
+                          << "\tNote: " << client.get_note_tuned(ch) << std::endl;
+            }
+            if (client.get_spectrum_mode()) {
+                print_spectrum(client);
+            }
+            if (client.get_loudness_mode()) {
+                const dsp::loudness_reading loudness = client.get_loudness();
+                print_loudness(loudness.momentary, loudness.short_term,
+                               loudness.integrated, loudness.range);
+            }
+            return EXIT_SUCCESS;
+        }
+
+        // Replay a file under JACK timing instead of the capture ports
+        static std::unique_ptr<jack::file_source> injected;
+        if (vm.count("inject")) {
+            if (vm["inject-start"].as<long>() < 0) {
+                throw std::invalid_argument("--inject-start must not be negative");
+            }
+            injected = std::make_unique<jack::file_source>(vm["inject"].as<std::string>(),
+                                                           vm["rate"].as<int>(),
+                                                           vm["inject-start"].as<long>(),
+                                                           vm.count("loop") > 0);
+        }
+        static jack::jack_backend jack_server;
+        jack_server.set_source(injected.get());
+        jack_server.set_name(vm["name"].as<std::string>());
+
+        if (client.init(jack_server) != jack::client_state::Running) {
             throw std::runtime_error("Could not initialize the JACK client");
         }
+        if (lock_memory) {
+            reserve_buffers(heap_before);
+        }
+        if (vm.count("record")) {
+            client.start_recording(vm["record"].as<std::string>());
+        }
+
+        if (vm.count("mode")) {
+            set_mode(client, vm["mode"].as<std::string>());
+        }
+
+        if (headless) {
+            // Commands take effect as they arrive, results go to the
+            // subscribers as soon as the analysis publishes them, and
+            // the telemetry is published every tick
+            std::cerr << "I> Listening on " << vm["control-socket"].as<std::string>() << std::endl;
+            int status = EXIT_SUCCESS;
+            for (bool running = true; running;) {
+                const dsp::control_server::event e = control.wait();
+                switch (e.type) {
+                    case dsp::control_server::event_type::Command:
+                        control.reply(e.connection, execute(client, control, e, running));
+                        break;
+                    case dsp::control_server::event_type::Tick:
+                        if (client.state() != jack::client_state::Running) {
+                            std::cerr << "E> The JACK client stopped" << std::endl;
+                            status = EXIT_FAILURE;
+                            running = false;
+                            break;
+                        }
+                        if (injected && injected->finished()) {
+                            std::cerr << "I> End of the injected file" << std::endl;
+                            running = false;
+                            break;
+                        }
+                        client.get_telemetry(frame);
+                        telemetry.publish(frame);
+                        if (control.subscribers() > 0) {
+                            std::ostringstream line;
+                            line << "status ";
+                            dsp::write_json(line, frame, 0);
+                            control.broadcast(line.str());
+                        }
+                        break;
+                    case dsp::control_server::event_type::Results:
+                        if (control.subscribers() > 0) {
+                            client.get_telemetry(frame);
+                            telemetry.stamp(frame);
+                            std::ostringstream line;
+                            line << "results ";
+                            dsp::write_json(line, frame, 0);
+                            control.broadcast(line.str());
+                        }
+                        break;
+                    case dsp::control_server::event_type::Stop:
+                        std::cerr << "I> Stopping" << std::endl;
+                        running = false;
+                        break;
+                }
+            }
+            client.stop();
+            stop_recording(client);
+            report_tripwire();
+            control.close();
+            return status;
+        }
 
         // keep running until stopped by the user
         std::cout << "Press x key to exit" << std::endl;
 
+        // Metrics are published every update, and printed at most every
+        // print_interval
+        using clock = std::chrono::steady_clock;
+        const auto update_interval = std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(1 / telemetry_rate));
+        const auto print_interval = std::chrono::milliseconds(500);
+        const bool quiet = vm.count("quiet");
+        auto next_update = clock::now();
+        auto next_print = next_update;
+
         int key = -1;
         while (key != 'x') {
-            key = waitkey(500);
+            if (injected && injected->finished()) {
+                std::cerr << "I> End of the injected file" << std::endl;
+                break;
+            }
+            const auto wait = std::chrono::ceil<std::chrono::milliseconds>(next_update - clock::now());
+            key = waitkey(std::max<int>(0, wait.count()));
             if (key > 0) {
                 switch (key) {
                     case 'p':
@@ -106,6 +611,7 @@ int main(int argc, char* argv[]) {
                         break;
                     case '+':
                         if (client.get_current_mode() == dsp_client::Mode::VolumeChange ||
+                            client.get_current_mode() == dsp_client::Mode::Tuner ||
                             client.get_current_mode() == dsp_client::Mode::Repeater ||
                             client.get_current_mode() == dsp_client::Mode::Autotune) {
                             client.adjust_volume(0.05);  // Adjust this value as needed.
@@ -116,6 +622,7 @@ int main(int argc, char* argv[]) {
                         break;
                     case '-':
                         if (client.get_current_mode() == dsp_client::Mode::VolumeChange ||
+                            client.get_current_mode() == dsp_client::Mode::Tuner ||
                             client.get_current_mode() == dsp_client::Mode::Repeater ||
                             client.get_current_mode() == dsp_client::Mode::Autotune) {
                             client.adjust_volume(-0.05);  // Adjust this value as needed.
@@ -135,6 +642,28 @@ int main(int argc, char* argv[]) {
                     case 'E':
                         flag_E_P = !flag_E_P;
                         break;
+                    case 'f':
+                        client.set_spectrum_mode(!client.get_spectrum_mode());
+                        if (client.get_spectrum_mode()) {
+                            std::cout << "Spectrum on, " << client.get_spectrum_rate()
+                                      << " frames/s       " << std::endl;
+                        } else {
+                            std::cout << "Spectrum off       " << std::endl;
+                        }
+                        break;
+                    case 'l':
+                        client.set_loudness_mode(!client.get_loudness_mode());
+                        std::cout << "Loudness " << (client.get_loudness_mode() ? "on" : "off") << "       " << std::endl;
+                        break;
+                    case 'L':
+                        client.reset_loudness();
+                        std::cout << "Loudness reset       " << std::endl;
+                        break;
+                    case 's':
+                        if (client.stats() != nullptr) {
+                            std::cout << "Callbacks: " << client.stats()->read() << std::endl;
+                        }
+                        break;
                     case 'n':
                         client.set_period_mode(!client.get_period_mode());
                         std::cout << "Period mode " << (client.get_period_mode() ? "on" : "off") << "       " << std::endl;
@@ -168,8 +697,10 @@ int main(int argc, char* argv[]) {
                         }
                         client.change_mode(dsp_client::Mode::Autotune);
 
-                        std::cout << "Autotune mode on"
-                                  << "       " << std::endl;
+                        std::cout << "Autotune mode on, latency "
+                                  << client.get_autotune_latency() << " samples ("
+                                  << 1000.0 * client.get_autotune_latency() / client.get_sample_rate()
+                                  << " ms)       " << std::endl;
                         break;
                     default:
                         if (key > 32) {
@@ -180,55 +711,26 @@ int main(int argc, char* argv[]) {
                         break;
                 }
             }
-            client.calculate_period();
-            client.process_tuner();
-            if (client.get_energy_mode()) {
-                if (flag_E_P == true) {
-                    std::cout << std::fixed << std::setprecision(6)
-                              << "Energy: " << client.get_energy()
-                              << "\n"
-                              << std::endl;
-                } else {
-                    std::cout << std::fixed << std::setprecision(6)
-                              << "Power: " << client.get_power()
-                              << "\n"
-                              << std::endl;
-                }
-            } else if (client.get_period_mode()) {
-                std::cout << std::fixed << std::setprecision(2)
-                          << "Period: " << client.get_period()
-                          << "\tFreq: " << client.get_freq()
-                          << "\n"
-                          << std::endl;
-
-                if (client.get_current_mode() == dsp_client::Mode::Tuner) {
-                    std::cout << "Frecuencia mas cercana: " << client.get_freq_tuned() << std::endl;
-                    std::cout << "Corresponde a la nota: " << client.get_note_tuned() << std::endl;
-
-                    if (std::abs(client.get_freq_diff()) < 0.5) {
-                        std::cout << "Está afinado" << std::endl;
-                    } else if (client.get_freq_diff() < 0) {
-                        std::cout << "Debe bajar el tono" << std::endl;
-                    } else {
-                        std::cout << "Debe subir el tono" << std::endl;
-                    }
-                    /*
-                    freq_tuned   = -1
-                    si freq es -1 no hay nada sonado
-                    si esta afinado 0.01+-
-                    / frequcey_difference (RECUERDE EN EL IF SETEAR POR DEFECTO y en EL CONSTRCUTOR)
-
-                  */
-                } else if (client.get_current_mode() == dsp_client::Mode::Autotune) {
-                    std::cout << "Periodo actual: " << 1 / client.get_freq() << std::endl;
-                    std::cout << "Frecuencia actual: " << client.get_freq() << std::endl;
-                    std::cout << "Frecuencia mas cercana: " << client.get_freq_tuned() << std::endl;
-                    std::cout << "Corresponde a la nota: " << client.get_note_tuned() << std::endl;
-                }
+
+            const auto now = clock::now();
+            if (now < next_update) {
+                continue;  // A key came before the update
+            }
+            next_update = std::max(next_update + update_interval, now);
+
+            client.get_telemetry(frame);
+            if (telemetry.active()) {
+                telemetry.publish(frame);
+            }
+            if (!quiet && now >= next_print) {
+                next_print = now + print_interval;
+                print_metrics(client, frame, flag_E_P);
             }
         }
 
         client.stop();
+        stop_recording(client);
+        report_tripwire();
     } catch (std::exception& exc) {
         std::cout << argv[0] << ": Error: " << exc.what() << std::endl;
         exit(EXIT_FAILURE);
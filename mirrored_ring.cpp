@@ -0,0 +1,86 @@
+#include "mirrored_ring.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+namespace dsp {
+
+mirrored_ring::mirrored_ring()
+    : base(nullptr), physical(0), mask(0), max_size(0), head(0), count(0) {}
+
+mirrored_ring::~mirrored_ring() {
+    release();
+}
+
+void mirrored_ring::release() {
+    if (base != nullptr) {
+        munmap(base, 2 * physical * sizeof(float));
+        base = nullptr;
+    }
+    physical = mask = max_size = head = count = 0;
+}
+
+void mirrored_ring::reset(std::size_t capacity) {
+    release();
+
+    // Both mappings must start at a page boundary.  Pages are a power
+    // of two, so a power of two number of samples that fills at least
+    // one page keeps the index arithmetic down to a mask.
+    const std::size_t page = sysconf(_SC_PAGESIZE);
+    const std::size_t samples = std::bit_ceil(
+        std::max({capacity, page / sizeof(float), std::size_t(1)}));
+    const std::size_t bytes = samples * sizeof(float);
+
+    int fd = memfd_create("dsp_mirrored_ring", MFD_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create the ring buffer memory");
+    }
+    if (ftruncate(fd, bytes) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot size the ring buffer memory");
+    }
+
+    // Reserve the address range first, then put the file twice into it
+    void *area = mmap(nullptr, 2 * bytes, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("Cannot reserve the ring buffer addresses");
+    }
+    char *const first = static_cast<char *>(area);
+    if (mmap(first, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, 0) == MAP_FAILED ||
+        mmap(first + bytes, bytes, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(area, 2 * bytes);
+        ::close(fd);
+        throw std::runtime_error("Cannot map the ring buffer twice");
+    }
+    // The mappings keep the memory alive
+    ::close(fd);
+
+    base = reinterpret_cast<float *>(first);
+    physical = samples;
+    mask = samples - 1;
+    max_size = capacity;
+}
+
+void mirrored_ring::push(const float *const src, std::size_t n) {
+    // Only the last max_size samples can survive
+    const float *from = src;
+    if (n > max_size) {
+        from += n - max_size;
+        n = max_size;
+    }
+    // The second mapping takes whatever passes the end of the first one
+    std::memcpy(base + head, from, n * sizeof(float));
+    head = (head + n) & mask;
+    count = std::min(count + n, max_size);
+}
+
+}  // namespace dsp
@@ -0,0 +1,69 @@
+#ifndef _MIRRORED_RING_H
+#define _MIRRORED_RING_H
+
+#include <cstddef>
+#include <span>
+
+namespace dsp {
+
+/**
+ * Ring buffer of the last capacity() samples, mapped twice.
+ *
+ * The same physical pages (a memfd) are mapped at two consecutive
+ * virtual addresses, so a window that wraps around the end of the
+ * buffer continues in the second mapping and is still contiguous in
+ * memory.  Any window of the stored samples is therefore a single
+ * std::span, usable directly by the vectorized kernels and the FFT,
+ * and push() is at most one memcpy.
+ *
+ * The mapping is page aligned.  reset() maps memory and must not run
+ * concurrently with the other methods.
+ */
+class mirrored_ring {
+   public:
+    mirrored_ring();
+    mirrored_ring(const mirrored_ring &) = delete;
+    mirrored_ring &operator=(const mirrored_ring &) = delete;
+    ~mirrored_ring();
+
+    /**
+     * Keep the last capacity samples.  Throws std::runtime_error if the
+     * mirrored mapping cannot be created.
+     */
+    void reset(std::size_t capacity);
+
+    void clear() { count = 0; }
+
+    std::size_t size() const { return count; }
+    std::size_t capacity() const { return max_size; }
+
+    /**
+     * Append n samples, dropping the oldest ones if the ring is full.
+     */
+    void push(const float *const src, std::size_t n);
+
+    /**
+     * length samples starting first samples after the oldest one.
+     * first + length must not exceed size().
+     */
+    std::span<const float> window(std::size_t first, std::size_t length) const {
+        return {base + ((head + physical - count + first) & mask), length};
+    }
+
+    // Every stored sample, oldest first
+    std::span<const float> samples() const { return window(0, count); }
+
+   private:
+    float *base;           // First of the two mappings
+    std::size_t physical;  // Samples in one mapping, a power of two
+    std::size_t mask;
+    std::size_t max_size;
+    std::size_t head;      // Where the next sample goes
+    std::size_t count;
+
+    void release();
+};
+
+}  // namespace dsp
+
+#endif
@@ -0,0 +1,71 @@
+#include "note_table.h"
+
+namespace dsp {
+
+namespace {
+
+// 2^(1/12)
+constexpr double semitone = 1.0594630943592952646;
+
+constexpr std::array<double, note_table::count> make_ratios() {
+    std::array<double, note_table::count> ratios{};
+    ratios[note_table::reference_note] = 1.0;
+    for (int n = note_table::reference_note + 1; n < note_table::count; ++n)
+        ratios[n] = ratios[n - 1] * semitone;
+    for (int n = note_table::reference_note - 1; n >= 0; --n)
+        ratios[n] = ratios[n + 1] / semitone;
+    return ratios;
+}
+
+constexpr std::array<double, note_table::count> ratios = make_ratios();
+
+static_assert(ratios[note_table::reference_note + 12] > 1.999999 &&
+                  ratios[note_table::reference_note + 12] < 2.000001,
+              "An octave must double the frequency");
+
+struct note_name {
+    char text[8];
+};
+
+// Names as the tuner always used them: pitch class, octave, then the
+// sharp
+constexpr std::array<note_name, note_table::count> make_names() {
+    const char *const pitch[12] = {"do", "do", "re", "re", "mi", "fa",
+                                   "fa", "sol", "sol", "la", "la", "si"};
+    const bool sharp[12] = {false, true, false, true, false, false,
+                            true, false, true, false, true, false};
+
+    std::array<note_name, note_table::count> names{};
+    for (int n = 0; n < note_table::count; ++n) {
+        char *out = names[n].text;
+        for (const char *c = pitch[n % 12]; *c != '\0'; ++c)
+            *out++ = *c;
+        int octave = n / 12 - 1;
+        if (octave < 0) {
+            *out++ = '-';
+            octave = -octave;
+        }
+        *out++ = static_cast<char>('0' + octave);
+        if (sharp[n % 12])
+            *out++ = '#';
+        *out = '\0';
+    }
+    return names;
+}
+
+constexpr std::array<note_name, note_table::count> names = make_names();
+
+}  // namespace
+
+void note_table::set_reference(float reference) {
+    for (int n = 0; n < count; ++n)
+        frequencies[n] = static_cast<float>(reference * ratios[n]);
+}
+
+const char *note_table::name(int note) {
+    if (note < 0 || note >= count)
+        return "";
+    return names[note].text;
+}
+
+}  // namespace dsp
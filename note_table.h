@@ -0,0 +1,62 @@
+#ifndef _NOTE_TABLE_H
+#define _NOTE_TABLE_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace dsp {
+
+/**
+ * Nearest note to a frequency
+ */
+struct note_match {
+    int note;         // MIDI number, -1 if there is no frequency
+    float frequency;  // Of the note, -1 if there is none
+    float cents;      // Of the frequency above the note, [-50, 50] in range
+};
+
+/**
+ * Equal-temperament notes of the whole MIDI range, from 0 (do-1) to
+ * 127 (sol9), tuned to a reference for la4 (note 69).
+ *
+ * The names and the frequency ratios to la4 are computed at compile
+ * time; the reference only scales the ratios.  nearest() takes a single
+ * log2, so it neither allocates nor hashes and can be called from the
+ * audio thread.
+ */
+class note_table {
+   public:
+    static constexpr int count = 128;
+    static constexpr int reference_note = 69;  // la4
+
+    explicit note_table(float reference = 440.0f) { set_reference(reference); }
+
+    // Frequency of la4, in Hz
+    void set_reference(float reference);
+    float get_reference() const { return frequencies[reference_note]; }
+
+    float frequency(int note) const { return frequencies[note]; }
+
+    note_match nearest(float frequency) const {
+        if (!(frequency > 0)) {
+            return {-1, -1, 0};
+        }
+        const float semitones = 12 * std::log2(frequency / get_reference());
+        const int note = std::clamp(static_cast<int>(std::lround(semitones)) + reference_note,
+                                    0, count - 1);
+        return {note, frequencies[note], 100 * (semitones - (note - reference_note))};
+    }
+
+    /**
+     * Name of a note, like "do4" or "fa3#"; "" if out of range
+     */
+    static const char *name(int note);
+
+   private:
+    std::array<float, count> frequencies;
+};
+
+}  // namespace dsp
+
+#endif
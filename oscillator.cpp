@@ -0,0 +1,62 @@
+#include "oscillator.h"
+
+#include <array>
+#include <cmath>
+
+namespace dsp {
+
+namespace {
+
+// 2^table_bits intervals, plus a guard point so that the interpolation
+// never needs to wrap
+constexpr unsigned int table_bits = 11;
+constexpr unsigned int table_size = 1u << table_bits;
+constexpr unsigned int frac_bits = 32 - table_bits;
+constexpr float frac_scale = 1.0f / (1u << frac_bits);
+
+std::array<float, table_size + 1> make_sine_table() {
+    std::array<float, table_size + 1> table;
+    for (unsigned int i = 0; i <= table_size; i++)
+        table[i] = static_cast<float>(std::sin(2 * M_PI * i / table_size));
+    return table;
+}
+
+const std::array<float, table_size + 1> sine_table = make_sine_table();
+
+}  // namespace
+
+oscillator::oscillator() : phase(0), increment(0), gain(0), target(0) {}
+
+void oscillator::set_frequency(float frequency, float sample_rate) {
+    // Cycles per sample as a 32 bit fraction
+    const double cycles = static_cast<double>(frequency) / sample_rate;
+    increment = static_cast<std::uint32_t>(
+        static_cast<std::int64_t>(std::llround(cycles * 4294967296.0)));
+}
+
+void oscillator::reset() {
+    phase = 0;
+    gain = 0;
+    target = 0;
+}
+
+void oscillator::render(float *const out, std::size_t n) {
+    if (n == 0)
+        return;
+
+    const float step = (target - gain) / n;
+    float g = gain;
+    std::uint32_t p = phase;
+    for (std::size_t i = 0; i < n; i++) {
+        const std::uint32_t index = p >> frac_bits;
+        const float frac = (p & ((1u << frac_bits) - 1)) * frac_scale;
+        const float a = sine_table[index];
+        out[i] = g * (a + frac * (sine_table[index + 1] - a));
+        p += increment;  // Wraps at one cycle
+        g += step;
+    }
+    phase = p;
+    gain = target;
+}
+
+}  // namespace dsp
@@ -0,0 +1,50 @@
+#ifndef _OSCILLATOR_H
+#define _OSCILLATOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace dsp {
+
+/**
+ * Sine oscillator with a wrapped phase accumulator and a wavetable.
+ *
+ * The phase is a 32 bit fixed point fraction of a cycle, so it wraps
+ * by integer overflow and its resolution never degrades, no matter how
+ * long the oscillator runs.  Each sample is a linear interpolation in
+ * a shared sine table (error below 2e-6), which costs a few cycles.
+ *
+ * Frequency changes keep the phase continuous, and amplitude changes
+ * are ramped linearly over the next render() call to avoid clicks.
+ * Nothing allocates, so everything can be called from process().
+ */
+class oscillator {
+   public:
+    oscillator();
+
+    void set_frequency(float frequency, float sample_rate);
+
+    // Amplitude reached at the end of the next render()
+    void set_amplitude(float amplitude) { target = amplitude; }
+
+    float amplitude() const { return gain; }
+
+    // Restart at phase 0 and amplitude 0
+    void reset();
+
+    /**
+     * Write n samples of the sine to out, ramping the amplitude to the
+     * last value given to set_amplitude().
+     */
+    void render(float *const out, std::size_t n);
+
+   private:
+    std::uint32_t phase;
+    std::uint32_t increment;
+    float gain;    // Current amplitude
+    float target;  // Amplitude at the end of the next block
+};
+
+}  // namespace dsp
+
+#endif
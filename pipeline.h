@@ -0,0 +1,249 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "ramp.h"
+
+// The fused loops are compiled for each instruction set, like the
+// kernels of simd_kernels.h, and the best one is picked at load time.
+// What they call must be inlined into each version.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DSP_FUSED_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#define DSP_FUSED_INLINE __attribute__((always_inline)) inline
+#else
+#define DSP_FUSED_CLONES
+#define DSP_FUSED_INLINE inline
+#endif
+
+namespace dsp {
+
+/**
+ * Processing stages and the chains that run them.
+ *
+ * A stage is any class with
+ *
+ *     void begin(std::size_t n);                  // before a block of n
+ *     float operator()(float x, std::size_t i);   // sample i of the block
+ *     void end(std::size_t n);                    // after the block
+ *
+ * operator() returns the sample for the next stage, so stages that only
+ * measure return x.  The position of a stage in the chain is its tap
+ * point: a meter before a gain sees the input, after it the output.
+ *
+ * run() passes each sample through every stage before reading the next
+ * one.  With the stage types known at compile time the calls inline
+ * into a single loop over the buffer.  Stages are copied into that loop
+ * and back, so they must be copy assignable (hold pointers, not
+ * references).  stage_chain is the fallback for
+ * chains put together at run time, with one pass per stage.
+ */
+
+/**
+ * Multiplies by a constant gain
+ */
+class gain_stage {
+   public:
+    explicit gain_stage(float gain) : gain(gain) {}
+
+    void begin(std::size_t) {}
+    float operator()(float x, std::size_t) const { return x * gain; }
+    void end(std::size_t) {}
+
+   private:
+    float gain;
+};
+
+/**
+ * Multiplies by a linear_ramp, with the same gains as
+ * linear_ramp::apply().  The ramp is not moved: its owner advances it
+ * once after the block, for all the channels.  While the ramp is not
+ * moving gain_stage is cheaper.
+ */
+class ramp_stage {
+   public:
+    explicit ramp_stage(const linear_ramp &ramp) : ramp(&ramp) {}
+
+    void begin(std::size_t n) { ramped = std::min(n, ramp->samples_left()); }
+    float operator()(float x, std::size_t i) const {
+        return x * (ramp->value() +
+                    ramp->increment() * static_cast<float>(std::min(i + 1, ramped)));
+    }
+    void end(std::size_t) {}
+
+   private:
+    const linear_ramp *ramp;
+    std::size_t ramped = 0;  // Samples of the block still ramping
+};
+
+/**
+ * Sum of squares of the block.  The sum is kept in several lanes so
+ * that the fused loop can still be vectorized.
+ */
+class energy_meter {
+   public:
+    static constexpr std::size_t lanes = 16;  // One AVX-512 vector
+
+    void begin(std::size_t) { std::fill(sum, sum + lanes, 0.0f); }
+    float operator()(float x, std::size_t i) {
+        sum[i % lanes] += x * x;
+        return x;
+    }
+    void end(std::size_t) {}
+
+    float energy() const {
+        float total = 0;
+        for (std::size_t l = 0; l < lanes; ++l)
+            total += sum[l];
+        return total;
+    }
+
+   private:
+    float sum[lanes] = {};
+};
+
+/**
+ * Copies the signal at its point of the chain into a block of at least
+ * n samples, e.g. to hand it to the pitch analysis.
+ */
+class capture_stage {
+   public:
+    explicit capture_stage(float *const block) : block(block) {}
+
+    void begin(std::size_t) {}
+    float operator()(float x, std::size_t i) {
+        block[i] = x;
+        return x;
+    }
+    void end(std::size_t) {}
+
+    const float *data() const { return block; }
+
+   private:
+    float *block;
+};
+
+namespace detail {
+
+// Loop of run() and measure(), on the local copies of their stages
+template <bool Output, typename... Stages>
+DSP_FUSED_INLINE void fused_loop(const float *const in, float *const out,
+                                 std::size_t n, Stages &...stages) {
+    (stages.begin(n), ...);
+    // Groups of lanes samples in a local array, which cannot alias the
+    // buffers nor the stages, so that the compiler turns each unrolled
+    // group into vector operations
+    constexpr std::size_t lanes = energy_meter::lanes;
+    std::size_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        float x[lanes];
+        std::memcpy(x, in + i, sizeof(x));
+#pragma GCC unroll 16
+        for (std::size_t k = 0; k < lanes; ++k) {
+            ((x[k] = stages(x[k], i + k)), ...);
+        }
+        if constexpr (Output)
+            std::memcpy(out + i, x, sizeof(x));
+    }
+    for (; i < n; ++i) {
+        float x = in[i];
+        ((x = stages(x, i)), ...);
+        if constexpr (Output)
+            out[i] = x;
+    }
+    (stages.end(n), ...);
+}
+
+// The stages are references that may alias the buffers; their copies
+// can stay in registers through the whole loop
+template <bool Output, std::size_t... I, typename... Stages>
+DSP_FUSED_CLONES void fused(const float *const in, float *const out, std::size_t n,
+                            std::index_sequence<I...>, Stages &...stages) {
+    std::tuple<Stages...> local(stages...);
+    fused_loop<Output>(in, out, n, std::get<I>(local)...);
+    ((stages = std::get<I>(local)), ...);
+}
+
+}  // namespace detail
+
+/**
+ * Fused chain: out[i] is in[i] after all the stages, in order.  in and
+ * out may be the same buffer.
+ */
+template <typename... Stages>
+void run(const float *const in, float *const out, std::size_t n,
+         Stages &&...stages) {
+    if constexpr (sizeof...(Stages) == 0) {
+        if (in != out)
+            std::memcpy(out, in, n * sizeof(float));
+    } else {
+        detail::fused<true>(in, out, n, std::index_sequence_for<Stages...>(), stages...);
+    }
+}
+
+/**
+ * Fused chain of stages that only measure: in is not copied anywhere
+ */
+template <typename... Stages>
+void measure(const float *const in, std::size_t n, Stages &&...stages) {
+    if constexpr (sizeof...(Stages) > 0) {
+        detail::fused<false>(in, nullptr, n, std::index_sequence_for<Stages...>(), stages...);
+    }
+}
+
+/**
+ * Chain of stages chosen at run time.
+ *
+ * Each stage runs over the whole block before the next one, through a
+ * virtual call per stage and block.  add() allocates, so the chain must
+ * be built before process() uses it; process() itself does not.
+ */
+class stage_chain {
+   public:
+    // Append a stage; returns the copy kept by the chain
+    template <typename Stage>
+    Stage &add(Stage stage) {
+        auto node = std::make_unique<holder<Stage>>(std::move(stage));
+        Stage &kept = node->stage;
+        stages.push_back(std::move(node));
+        return kept;
+    }
+
+    void clear() { stages.clear(); }
+    std::size_t size() const { return stages.size(); }
+
+    // Same as run() with the stages added so far
+    void process(const float *const in, float *const out, std::size_t n) {
+        if (in != out)
+            std::copy(in, in + n, out);
+        for (const std::unique_ptr<node> &s : stages)
+            s->process(out, n);
+    }
+
+   private:
+    struct node {
+        virtual ~node() = default;
+        virtual void process(float *const data, std::size_t n) = 0;
+    };
+
+    template <typename Stage>
+    struct holder : node {
+        explicit holder(Stage &&stage) : stage(std::move(stage)) {}
+        void process(float *const data, std::size_t n) override {
+            run(data, data, n, stage);
+        }
+        Stage stage;
+    };
+
+    std::vector<std::unique_ptr<node>> stages;
+};
+
+}  // namespace dsp
+
+#endif
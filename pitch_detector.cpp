@@ -0,0 +1,213 @@
+#include "pitch_detector.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "simd_kernels.h"
+
+namespace dsp {
+
+pitch_detector::pitch_detector() : direct_lags(false), running(nullptr) {}
+
+pitch_detector::~pitch_detector() {}
+
+void pitch_detector::prepare(std::size_t max_window) {
+    fft.prepare(max_window);
+    if (prefix.size() < max_window + 1)
+        prefix.assign(max_window + 1, 0.0);
+}
+
+void pitch_detector::accumulate_squares() {
+    // Only allocates if prepare() was given a shorter window
+    if (prefix.size() < samples.size() + 1)
+        prefix.resize(samples.size() + 1);
+
+    prefix[0] = 0.0;
+    for (std::size_t j = 0; j < samples.size(); ++j)
+        prefix[j + 1] = prefix[j] + static_cast<double>(samples[j]) * samples[j];
+}
+
+pitch_estimate pitch_detector::detect(std::span<const float> window,
+                                      std::size_t min_lag,
+                                      std::size_t max_lag,
+                                      bool direct) {
+    max_lag = std::min(max_lag, window.size() / 2);
+    if (max_lag <= min_lag) {
+        return {-1, 0};
+    }
+    samples = window;
+    direct_lags = direct;
+    running = nullptr;
+    accumulate_squares();
+    if (!direct) {
+        fft.compute(window.begin(), window.end());
+    }
+    return estimate(min_lag, max_lag);
+}
+
+pitch_estimate pitch_detector::detect(const sliding_autocorrelation &sums,
+                                      std::size_t min_lag,
+                                      std::size_t max_lag) {
+    max_lag = std::min(max_lag, sums.max_lag() > 0 ? sums.max_lag() - 1 : 0);
+    if (max_lag <= min_lag || sums.size() == 0) {
+        return {-1, 0};
+    }
+    samples = sums.samples();
+    running = &sums;
+    accumulate_squares();
+    return estimate(min_lag, max_lag);
+}
+
+double pitch_detector::correlation(std::size_t lag) const {
+    if (running != nullptr) {
+        return running->lag(lag);
+    }
+    if (direct_lags) {
+        return dot(samples.data(), samples.data() + lag, samples.size() - lag);
+    }
+    return fft.lag(lag);
+}
+
+double pitch_detector::energy(std::size_t lag) const {
+    const std::size_t w = samples.size();
+    if (running != nullptr) {
+        // Ends after the first max_lag samples, and their partners
+        const std::size_t first = running->max_lag();
+        return (prefix[w] - prefix[first]) + (prefix[w - lag] - prefix[first - lag]);
+    }
+    return prefix[w - lag] + (prefix[w] - prefix[lag]);
+}
+
+double pitch_detector::vertex(double a, double b, double c) {
+    const double curvature = a - 2 * b + c;
+    if (curvature == 0)
+        return 0;
+    return std::clamp(0.5 * (a - c) / curvature, -1.0, 1.0);
+}
+
+yin_detector::yin_detector(float threshold) : threshold(threshold) {}
+
+pitch_estimate yin_detector::estimate(std::size_t min_lag,
+                                      std::size_t max_lag) {
+    // d'(min_lag - 1) is needed for the interpolation
+    min_lag = std::max<std::size_t>(min_lag, 2);
+    if (max_lag <= min_lag) {
+        return {-1, 0};
+    }
+
+    // d'(tau), for tau = 1, 2, ... in this order; difference keeps d(tau)
+    double cumulative = 0;
+    double difference = 0;
+    std::size_t next = 1;
+    auto normalized = [&]() {
+        difference = std::max(energy(next) - 2 * correlation(next), 0.0);
+        cumulative += difference;
+        const double value = cumulative > 0 ? difference * next / cumulative : 1.0;
+        ++next;
+        return value;
+    };
+
+    double before = 1;
+    double d_before = 0;
+    while (next < min_lag) {
+        before = normalized();
+        d_before = difference;
+    }
+    double current = normalized();
+    double d_current = difference;
+    double lowest = current;
+
+    for (std::size_t tau = min_lag; tau <= max_lag; ++tau) {
+        const double after = tau < max_lag ? normalized() : current;
+        const double d_after = tau < max_lag ? difference : d_current;
+        lowest = std::min(lowest, current);
+
+        // Bottom of the first dip below the threshold.  The parabola
+        // goes through d rather than d', whose running mean bends the
+        // dip when a period spans only a few lags (step 5 of the paper)
+        if (current < threshold && current <= after) {
+            const double offset = vertex(d_before, d_current, d_after);
+            const double value = current - 0.25 * (before - after) * vertex(before, current, after);
+            return {static_cast<float>(tau + offset),
+                    static_cast<float>(std::clamp(1 - value, 0.0, 1.0))};
+        }
+        before = current;
+        d_before = d_current;
+        current = after;
+        d_current = d_after;
+    }
+    return {-1, static_cast<float>(std::clamp(1 - lowest, 0.0, 1.0))};
+}
+
+mpm_detector::mpm_detector(float k, float min_clarity)
+    : k(k), min_clarity(min_clarity) {}
+
+void mpm_detector::prepare(std::size_t max_window) {
+    pitch_detector::prepare(max_window);
+    if (nsdf.size() < max_window / 2 + 2) {
+        nsdf.assign(max_window / 2 + 2, 0.0);
+        peaks.reserve(nsdf.size());
+    }
+}
+
+pitch_estimate mpm_detector::estimate(std::size_t min_lag,
+                                      std::size_t max_lag) {
+    min_lag = std::max<std::size_t>(min_lag, 1);
+    if (max_lag <= min_lag) {
+        return {-1, 0};
+    }
+
+    // One lag past max_lag, for the interpolation
+    const std::size_t last = max_lag + 1;
+    if (nsdf.size() < last + 1) {
+        nsdf.resize(last + 1);
+        peaks.reserve(nsdf.size());
+    }
+    for (std::size_t tau = 0; tau <= last; ++tau) {
+        const double m = energy(tau);
+        nsdf[tau] = m > 0 ? 2 * correlation(tau) / m : 0.0;
+    }
+
+    // Skip the lobe around lag 0, then keep the highest maximum of each
+    // positive lobe
+    std::size_t tau = 1;
+    while (tau <= last && nsdf[tau] > 0)
+        ++tau;
+    peaks.clear();
+    std::size_t peak = 0;
+    for (; tau <= last; ++tau) {
+        if (nsdf[tau - 1] <= 0 && nsdf[tau] > 0) {
+            peak = tau;
+        } else if (nsdf[tau - 1] > 0 && nsdf[tau] <= 0) {
+            peaks.push_back(peak);
+            peak = 0;
+        }
+        if (peak != 0 && nsdf[tau] > nsdf[peak]) {
+            peak = tau;
+        }
+    }
+    if (peak != 0) {
+        peaks.push_back(peak);
+    }
+
+    double highest = -std::numeric_limits<double>::infinity();
+    for (std::size_t p : peaks) {
+        if (min_lag <= p && p <= max_lag)
+            highest = std::max(highest, nsdf[p]);
+    }
+    for (std::size_t p : peaks) {
+        if (p < min_lag || p > max_lag || nsdf[p] < k * highest)
+            continue;
+
+        const double offset = vertex(nsdf[p - 1], nsdf[p], nsdf[p + 1]);
+        const double value = nsdf[p] - 0.25 * (nsdf[p - 1] - nsdf[p + 1]) * offset;
+        const float clarity = static_cast<float>(std::clamp(value, 0.0, 1.0));
+        if (clarity < min_clarity) {
+            return {-1, clarity};
+        }
+        return {static_cast<float>(p + offset), clarity};
+    }
+    return {-1, 0};
+}
+
+}  // namespace dsp
@@ -0,0 +1,144 @@
+#ifndef _PITCH_DETECTOR_H
+#define _PITCH_DETECTOR_H
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "autocorrelation.h"
+
+namespace dsp {
+
+/**
+ * Pitch of one analysis window
+ */
+struct pitch_estimate {
+    float period;      // In samples (fractional), <= 0 if there is no pitch
+    float confidence;  // From 0 (noise) to 1 (exactly periodic)
+};
+
+/**
+ * Pitch detector on analysis windows.
+ *
+ * The detectors below are built on the autocorrelation r(tau) of the
+ * window x[0..W) and on the energy of the two overlapping parts
+ *
+ *   m(tau) = sum_{j=0}^{W-1-tau} x[j]^2 + x[j+tau]^2,
+ *
+ * taken from a prefix sum of squares.  With them the squared difference
+ * of the window and its shifted copy is d(tau) = m(tau) - 2 r(tau).
+ *
+ * r(tau) comes either from one FFT of the whole window or, with the
+ * direct engine, from one dot product per lag, computed only for the
+ * lags the detector actually visits.  It can also be taken from the
+ * sums of a sliding_autocorrelation, where every lag has the same
+ * number of pair ends e and m(tau) is the energy of x[e] and x[e-tau].
+ *
+ * prepare() allocates; detect() does not for windows up to that size.
+ */
+class pitch_detector {
+   public:
+    pitch_detector();
+    virtual ~pitch_detector();
+
+    /**
+     * Allocate for windows of up to max_window samples
+     */
+    virtual void prepare(std::size_t max_window);
+
+    /**
+     * Estimate the period of window, between min_lag and max_lag
+     * samples.  max_lag is limited to half the window.
+     */
+    pitch_estimate detect(std::span<const float> window,
+                          std::size_t min_lag,
+                          std::size_t max_lag,
+                          bool direct);
+
+    /**
+     * Estimate the period from the running sums, between min_lag and
+     * max_lag samples.  max_lag is limited to one less than the
+     * longest lag of the sums.
+     */
+    pitch_estimate detect(const sliding_autocorrelation &sums,
+                          std::size_t min_lag,
+                          std::size_t max_lag);
+
+   protected:
+    /**
+     * Estimate the period of the current window.  Lags up to
+     * max_lag + 1 can be used.
+     */
+    virtual pitch_estimate estimate(std::size_t min_lag, std::size_t max_lag) = 0;
+
+    double correlation(std::size_t lag) const;
+    double energy(std::size_t lag) const;
+
+    // Offset of the vertex of the parabola through (-1, a), (0, b), (1, c)
+    static double vertex(double a, double b, double c);
+
+   private:
+    fft_autocorrelation fft;
+    std::vector<double> prefix;  // prefix[j] = sum_{i<j} x[i]^2
+    std::span<const float> samples;
+    bool direct_lags;
+    const sliding_autocorrelation *running;  // Source of r, if any
+
+    // Fill prefix for samples
+    void accumulate_squares();
+};
+
+/**
+ * YIN (de Cheveigné and Kawahara, 2002).
+ *
+ * The difference function is normalized by its cumulative mean,
+ *
+ *   d'(tau) = d(tau) tau / sum_{j=1}^{tau} d(j),   d'(0) = 1,
+ *
+ * which removes the dip at lag 0 and makes the first lag below the
+ * threshold the fundamental rather than one of its multiples.  The
+ * lags are visited in increasing order and the scan stops at the
+ * bottom of the first dip, so the direct engine never computes the
+ * correlation of longer lags.  The confidence is 1 - d'.
+ */
+class yin_detector : public pitch_detector {
+   public:
+    explicit yin_detector(float threshold = 0.15f);
+
+   protected:
+    virtual pitch_estimate estimate(std::size_t min_lag,
+                                    std::size_t max_lag) override;
+
+   private:
+    float threshold;
+};
+
+/**
+ * McLeod pitch method (McLeod and Wyvill, 2005).
+ *
+ * The normalized square difference n(tau) = 2 r(tau) / m(tau) lies in
+ * [-1, 1].  The highest maximum of each positive lobe is a key maximum,
+ * and the period is the first key maximum within k of the highest one.
+ * The confidence (the "clarity") is n at that maximum; below
+ * min_clarity the window has no pitch.
+ */
+class mpm_detector : public pitch_detector {
+   public:
+    explicit mpm_detector(float k = 0.9f, float min_clarity = 0.5f);
+
+    virtual void prepare(std::size_t max_window) override;
+
+   protected:
+    virtual pitch_estimate estimate(std::size_t min_lag,
+                                    std::size_t max_lag) override;
+
+   private:
+    float k;
+    float min_clarity;
+    std::vector<double> nsdf;        // n(tau)
+    std::vector<std::size_t> peaks;  // Lags of the key maxima
+};
+
+}  // namespace dsp
+
+#endif
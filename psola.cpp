@@ -0,0 +1,99 @@
+#include "psola.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace dsp {
+
+psola_shifter::psola_shifter()
+    : mask(0), max_period(0), delay(0), now(0), synthesis_mark(0), analysis_mark(0) {}
+
+void psola_shifter::prepare(std::size_t max_period_) {
+    max_period = std::max<std::size_t>(max_period_, 2);
+    // A grain reaches one period past its center, which is at most one
+    // period ahead of the output being emitted
+    delay = 2 * max_period + 1;
+
+    // Input back to the oldest grain start, output up to the newest end
+    const std::size_t size = std::bit_ceil(2 * delay + 4 * max_period);
+    input.assign(size, 0.0f);
+    output.assign(size, 0.0f);
+    weight.assign(size, 0.0f);
+    mask = size - 1;
+    reset();
+}
+
+void psola_shifter::reset() {
+    std::fill(input.begin(), input.end(), 0.0f);
+    std::fill(output.begin(), output.end(), 0.0f);
+    std::fill(weight.begin(), weight.end(), 0.0f);
+    now = 0;
+    synthesis_mark = 0;
+    analysis_mark = 0;
+}
+
+void psola_shifter::add_grain(double period, double hop, std::int64_t emit) {
+    // Latest analysis mark not after the synthesis mark
+    while (analysis_mark + period <= synthesis_mark)
+        analysis_mark += period;
+    if (analysis_mark > synthesis_mark)
+        analysis_mark = synthesis_mark;
+
+    const std::int64_t length = std::max<std::int64_t>(std::lround(period), 1);
+    const std::int64_t to = std::llround(synthesis_mark);
+    const std::int64_t from = std::llround(analysis_mark);
+
+    // Hann window of 2 * length samples: 0.5 + 0.5 cos(pi m / length),
+    // with the cosine advanced by a rotation instead of calling cos()
+    const double step_cos = std::cos(M_PI / length);
+    const double step_sin = std::sin(M_PI / length);
+    double c = -1.0;
+    double s = 0.0;
+    for (std::int64_t m = -length; m < length; m++) {
+        // After a jump of the period, the start of the grain may fall
+        // on samples already sent out
+        if (to + m >= emit) {
+            const float w = static_cast<float>(0.5 + 0.5 * c);
+            const std::size_t k = static_cast<std::size_t>(to + m) & mask;
+            output[k] += w * input[static_cast<std::size_t>(from + m) & mask];
+            weight[k] += w;
+        }
+        const double next = c * step_cos - s * step_sin;
+        s = s * step_cos + c * step_sin;
+        c = next;
+    }
+
+    synthesis_mark += hop;
+}
+
+void psola_shifter::process(const float *const in, float *const out,
+                            std::size_t n, float period, float ratio) {
+    // Unvoiced: fixed grains of 5 ms at 48 kHz, without shift
+    double p = period;
+    double r = ratio;
+    if (!(p > 1.0) || !(r > 0.0)) {
+        p = std::min<double>(240.0, max_period);
+        r = 1.0;
+    }
+    p = std::min<double>(p, max_period);
+    r = std::clamp(r, 0.5, 2.0);
+    const double hop = p / r;
+
+    for (std::size_t i = 0; i < n; i++) {
+        input[static_cast<std::size_t>(now) & mask] = in[i];
+
+        // Every grain that starts at or before the sample to emit
+        const std::int64_t emit = now - static_cast<std::int64_t>(delay);
+        while (synthesis_mark <= emit + p)
+            add_grain(p, hop, emit);
+
+        const std::size_t k = static_cast<std::size_t>(emit) & mask;
+        out[i] = output[k] / std::max(weight[k], 0.5f);
+        output[k] = 0.0f;
+        weight[k] = 0.0f;
+        now++;
+    }
+}
+
+}  // namespace dsp
@@ -0,0 +1,66 @@
+#ifndef _PSOLA_H
+#define _PSOLA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * Pitch shifter by time-domain pitch synchronous overlap-add (TD-PSOLA).
+ *
+ * Grains of two input periods, Hann windowed and centered on analysis
+ * marks one period apart, are added to the output at synthesis marks
+ * period / ratio apart.  Repeating or skipping grains changes the pitch
+ * by ratio while the duration and the spectral envelope stay the same.
+ *
+ * The output is the input delayed by latency() samples, a fixed delay
+ * given by the longest period that prepare() allows: a grain can only
+ * be added once the whole input period after its center is known.
+ * Unvoiced input (period <= 0) passes through with the same delay.
+ *
+ * prepare() allocates; process() does not.
+ */
+class psola_shifter {
+   public:
+    psola_shifter();
+
+    /**
+     * Allocate for periods of up to max_period samples
+     */
+    void prepare(std::size_t max_period);
+
+    // Forget the signal, keeping the buffers
+    void reset();
+
+    // Delay from input to output, in samples
+    std::size_t latency() const { return delay; }
+
+    /**
+     * Shift n samples of in by ratio (output frequency / input
+     * frequency, clamped to [0.5, 2]), given the input period in
+     * samples.  in and out may be the same buffer.
+     */
+    void process(const float *const in, float *const out, std::size_t n,
+                 float period, float ratio);
+
+   private:
+    std::vector<float> input;   // Input history
+    std::vector<float> output;  // Overlap-added grains
+    std::vector<float> weight;  // Overlap-added windows
+    std::size_t mask;
+    std::size_t max_period;
+    std::size_t delay;
+
+    std::int64_t now;        // Time of the next input sample
+    double synthesis_mark;   // Center of the next output grain
+    double analysis_mark;    // Center of the last input grain
+
+    // emit is the next output sample; the grain only adds from there on
+    void add_grain(double period, double hop, std::int64_t emit);
+};
+
+}  // namespace dsp
+
+#endif
@@ -0,0 +1,47 @@
+#include "ramp.h"
+
+#include <algorithm>
+
+#include "simd_kernels.h"
+
+namespace dsp {
+
+linear_ramp::linear_ramp(float value) {
+    reset(value);
+}
+
+void linear_ramp::reset(float value) {
+    current = goal = value;
+    step = 0;
+    remaining = 0;
+}
+
+void linear_ramp::set_target(float value, std::size_t samples) {
+    if (samples == 0) {
+        reset(value);
+        return;
+    }
+    goal = value;
+    remaining = samples;
+    step = (goal - current) / samples;
+}
+
+void linear_ramp::apply(const float *const in, float *const out,
+                        std::size_t n) const {
+    const std::size_t ramped = std::min(n, remaining);
+    for (std::size_t i = 0; i < ramped; ++i)
+        out[i] = in[i] * (current + step * (i + 1));
+    // The rest of the block is at the target
+    scale(in + ramped, goal, out + ramped, n - ramped);
+}
+
+void linear_ramp::advance(std::size_t n) {
+    if (n >= remaining) {
+        reset(goal);
+        return;
+    }
+    remaining -= n;
+    current += step * n;
+}
+
+}  // namespace dsp
@@ -0,0 +1,52 @@
+#ifndef _RAMP_H
+#define _RAMP_H
+
+#include <cstddef>
+
+namespace dsp {
+
+/**
+ * Gain that moves linearly to a new value over a given number of
+ * samples, to change levels without zipper noise.
+ *
+ * apply() multiplies a block by the ramp without moving it, so that
+ * every channel of a block gets the same gains; advance() then moves
+ * the ramp past the block.  Nothing allocates, so everything can be
+ * called from process().
+ */
+class linear_ramp {
+   public:
+    explicit linear_ramp(float value = 1.0f);
+
+    // Jump to value
+    void reset(float value);
+
+    // Reach value after the given number of samples
+    void set_target(float value, std::size_t samples);
+
+    float value() const { return current; }
+    float target() const { return goal; }
+    bool ramping() const { return remaining > 0; }
+    // Change per sample, and samples until the target
+    float increment() const { return step; }
+    std::size_t samples_left() const { return remaining; }
+
+    /**
+     * out[i] = in[i] times the gain of the i-th next sample.  in and
+     * out may be the same buffer.
+     */
+    void apply(const float *const in, float *const out, std::size_t n) const;
+
+    // Move past n samples
+    void advance(std::size_t n);
+
+   private:
+    float current;
+    float goal;
+    float step;             // Per sample
+    std::size_t remaining;  // Samples until goal
+};
+
+}  // namespace dsp
+
+#endif
@@ -0,0 +1,259 @@
+#include "recorder.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace dsp {
+
+namespace {
+
+// Alignment of O_DIRECT buffers, offsets and sizes
+constexpr std::size_t block_alignment = 4096;
+
+// The WAV header is padded so that the samples start at this offset
+constexpr std::size_t header_bytes = block_alignment;
+
+// How often the writer looks for full chunks and updates the header
+constexpr auto poll_interval = std::chrono::milliseconds(10);
+constexpr auto header_interval = std::chrono::seconds(1);
+
+void put32(unsigned char *p, std::uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+void put64(unsigned char *p, std::uint64_t v) {
+    for (int i = 0; i < 8; ++i)
+        p[i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+void put16(unsigned char *p, std::uint16_t v) {
+    p[0] = static_cast<unsigned char>(v);
+    p[1] = static_cast<unsigned char>(v >> 8);
+}
+
+template <typename T>
+T *aligned_array(std::size_t n) {
+    void *p = std::aligned_alloc(block_alignment, n * sizeof(T));
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return static_cast<T *>(p);
+}
+
+}  // namespace
+
+disk_recorder::disk_recorder()
+    : mask(0), channels(0), width(0), head(0), tail(0), active(false), busy(false), recorded(0), lost(0), fd(-1), wav(false), direct_io(false), rate(0), offset(0), running(false), failure(0) {}
+
+disk_recorder::~disk_recorder() {
+    stop();
+}
+
+void disk_recorder::start(const std::string &path, unsigned int sample_rate,
+                          unsigned int channels_, float buffer_seconds,
+                          bool direct) {
+    if (recording()) {
+        throw std::runtime_error("Already recording");
+    }
+    channels = std::max(channels_, 1u);
+    width = 2 * channels;
+    rate = sample_rate;
+    wav = path.size() >= 4 && path.compare(path.size() - 4, 4, ".wav") == 0;
+
+    // Whole chunks, and at least four of them, so that no write wraps
+    const std::size_t chunk = chunk_bytes / sizeof(float);
+    const std::size_t samples = std::bit_ceil(std::max<std::size_t>(
+        static_cast<std::size_t>(buffer_seconds * sample_rate) * width, 4 * chunk));
+    ring.reset(aligned_array<float>(samples));
+    // Touch every page now, not in the process thread
+    std::fill(ring.get(), ring.get() + samples, 0.0f);
+    mask = samples - 1;
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+    recorded.store(0, std::memory_order_relaxed);
+    lost.store(0, std::memory_order_relaxed);
+    failure.store(0, std::memory_order_relaxed);
+
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    direct_io = direct;
+    fd = direct ? ::open(path.c_str(), flags | O_DIRECT, 0644) : -1;
+    if (fd < 0) {
+        // Some file systems (tmpfs) do not take O_DIRECT
+        direct_io = false;
+        fd = ::open(path.c_str(), flags, 0644);
+    }
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create " + path + ": " + std::strerror(errno));
+    }
+
+    offset = 0;
+    if (wav) {
+        header.reset(aligned_array<unsigned char>(header_bytes));
+        write_header();
+        offset = header_bytes;
+    }
+
+    running.store(true, std::memory_order_release);
+    writer = std::thread(&disk_recorder::writer_loop, this);
+    active.store(true, std::memory_order_seq_cst);
+}
+
+void disk_recorder::record(std::size_t nframes, unsigned int n,
+                           const float *const *const in,
+                           const float *const *const out) {
+    busy.store(true, std::memory_order_seq_cst);
+    if (active.load(std::memory_order_seq_cst)) {
+        const std::size_t h = head.load(std::memory_order_relaxed);
+        const std::size_t t = tail.load(std::memory_order_acquire);
+        const std::size_t needed = nframes * width;
+        if (mask + 1 - (h - t) < needed) {
+            // The writer fell behind: drop the block, never wait
+            lost.store(lost.load(std::memory_order_relaxed) + nframes, std::memory_order_relaxed);
+        } else {
+            float *const data = ring.get();
+            for (unsigned int c = 0; c < channels; ++c) {
+                const float *const input = c < n ? in[c] : nullptr;
+                const float *const output = c < n ? out[c] : nullptr;
+                std::size_t k = h + c;
+                for (std::size_t i = 0; i < nframes; ++i, k += width) {
+                    data[k & mask] = input != nullptr ? input[i] : 0.0f;
+                    data[(k + channels) & mask] = output != nullptr ? output[i] : 0.0f;
+                }
+            }
+            head.store(h + needed, std::memory_order_release);
+            recorded.store(recorded.load(std::memory_order_relaxed) + nframes, std::memory_order_relaxed);
+        }
+    }
+    busy.store(false, std::memory_order_release);
+}
+
+void disk_recorder::stop() {
+    if (!recording()) {
+        return;
+    }
+    // After this no record() call touches the ring
+    active.store(false, std::memory_order_seq_cst);
+    while (busy.load(std::memory_order_seq_cst)) {
+        std::this_thread::yield();
+    }
+    running.store(false, std::memory_order_release);
+    writer.join();
+
+    flush(true);
+    if (wav) {
+        write_header();
+    }
+    ::close(fd);
+    fd = -1;
+}
+
+void disk_recorder::writer_loop() {
+    auto next_header = std::chrono::steady_clock::now() + header_interval;
+    while (running.load(std::memory_order_acquire)) {
+        flush(false);
+        // A header that follows the data keeps the file readable if
+        // the program dies
+        const auto now = std::chrono::steady_clock::now();
+        if (wav && now >= next_header) {
+            write_header();
+            next_header = now + header_interval;
+        }
+        std::this_thread::sleep_for(poll_interval);
+    }
+}
+
+void disk_recorder::flush(bool all) {
+    const std::size_t chunk = chunk_bytes / sizeof(float);
+    const float *const data = ring.get();
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    const std::size_t h = head.load(std::memory_order_acquire);
+
+    // The ring holds whole chunks, so a chunk never wraps
+    while (h - t >= chunk) {
+        write_block(data + (t & mask), chunk_bytes);
+        t += chunk;
+        tail.store(t, std::memory_order_release);
+    }
+    if (all && h > t) {
+        // The last partial chunk cannot be written with O_DIRECT
+        if (direct_io) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        }
+        write_block(data + (t & mask), (h - t) * sizeof(float));
+        tail.store(h, std::memory_order_release);
+    }
+}
+
+void disk_recorder::write_block(const void *data, std::size_t bytes) {
+    // After a failure the data is discarded, so that recording goes on
+    if (failure.load(std::memory_order_relaxed) != 0) {
+        return;
+    }
+    const char *p = static_cast<const char *>(data);
+    while (bytes > 0) {
+        const ssize_t n = ::pwrite(fd, p, bytes, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            failure.store(n < 0 ? errno : EIO, std::memory_order_relaxed);
+            return;
+        }
+        p += n;
+        bytes -= n;
+        offset += n;
+    }
+}
+
+void disk_recorder::write_header() {
+    // Layout: RIFF, ds64 (a JUNK chunk while the file is below 4 GiB),
+    // fmt, JUNK up to header_bytes - 8 and the data chunk header
+    const std::uint64_t data_bytes = offset > header_bytes ? offset - header_bytes : 0;
+    const std::uint64_t riff_bytes = header_bytes - 8 + data_bytes;
+    const bool rf64 = riff_bytes > UINT32_MAX;
+    unsigned char *const h = header.get();
+    std::memset(h, 0, header_bytes);
+
+    std::memcpy(h, rf64 ? "RF64" : "RIFF", 4);
+    put32(h + 4, rf64 ? UINT32_MAX : static_cast<std::uint32_t>(riff_bytes));
+    std::memcpy(h + 8, "WAVE", 4);
+
+    std::memcpy(h + 12, rf64 ? "ds64" : "JUNK", 4);
+    put32(h + 16, 28);
+    if (rf64) {
+        put64(h + 20, riff_bytes);
+        put64(h + 28, data_bytes);
+        put64(h + 36, data_bytes / (width * sizeof(float)));
+        put32(h + 44, 0);  // No table
+    }
+
+    std::memcpy(h + 48, "fmt ", 4);
+    put32(h + 52, 16);
+    put16(h + 56, 3);  // IEEE float
+    put16(h + 58, width);
+    put32(h + 60, rate);
+    put32(h + 64, rate * width * sizeof(float));
+    put16(h + 68, width * sizeof(float));
+    put16(h + 70, 32);
+
+    std::memcpy(h + 72, "JUNK", 4);
+    put32(h + 76, header_bytes - 8 - 80);
+
+    std::memcpy(h + header_bytes - 8, "data", 4);
+    put32(h + header_bytes - 4, rf64 ? UINT32_MAX : static_cast<std::uint32_t>(data_bytes));
+
+    if (failure.load(std::memory_order_relaxed) == 0 &&
+        ::pwrite(fd, h, header_bytes, 0) != static_cast<ssize_t>(header_bytes)) {
+        failure.store(errno != 0 ? errno : EIO, std::memory_order_relaxed);
+    }
+}
+
+}  // namespace dsp
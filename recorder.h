@@ -0,0 +1,111 @@
+#ifndef _RECORDER_H
+#define _RECORDER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace dsp {
+
+/**
+ * Records the input and the output of process() to disk.
+ *
+ * The process thread interleaves each block into a preallocated ring;
+ * a writer thread streams the ring to the file in chunks of chunk_bytes,
+ * aligned so that they can bypass the page cache (O_DIRECT) where the
+ * file system allows it.  If the ring has no room for a block, the
+ * block is dropped and counted: record() never waits, allocates or
+ * makes system calls.
+ *
+ * The file has 2 * channels 32 bit float channels: the inputs first,
+ * then the outputs.  Paths ending in ".wav" get a WAV header, updated
+ * about once per second and switched to RF64 past 4 GiB; anything else
+ * is written as raw floats.
+ */
+class disk_recorder {
+   public:
+    // Size of each write, and alignment of the samples in the file
+    static constexpr std::size_t chunk_bytes = 1 << 20;
+
+    disk_recorder();
+    ~disk_recorder();
+
+    disk_recorder(const disk_recorder &) = delete;
+    disk_recorder &operator=(const disk_recorder &) = delete;
+
+    /**
+     * Start recording channels inputs and outputs to path, through a
+     * ring of about buffer_seconds of audio.  Throws std::runtime_error
+     * if the file cannot be created or it is already recording.
+     */
+    void start(const std::string &path, unsigned int sample_rate,
+               unsigned int channels, float buffer_seconds = 2,
+               bool direct = true);
+
+    /**
+     * Process thread: append nframes of in[c] and out[c], c < channels
+     * (missing channels are recorded as silence)
+     */
+    void record(std::size_t nframes, unsigned int channels,
+                const float *const *const in, const float *const *const out);
+
+    /**
+     * Write what is left in the ring, finish the header and close the
+     * file.  Does nothing if not recording.
+     */
+    void stop();
+
+    bool recording() const { return writer.joinable(); }
+    // Frames recorded and dropped since start()
+    std::uint64_t frames() const { return recorded.load(std::memory_order_relaxed); }
+    std::uint64_t dropped() const { return lost.load(std::memory_order_relaxed); }
+    // errno of the first failed write, 0 if none
+    int error() const { return failure.load(std::memory_order_relaxed); }
+    // True if the file was opened to bypass the page cache
+    bool direct() const { return direct_io; }
+
+   private:
+    struct aligned_free {
+        void operator()(void *p) const { std::free(p); }
+    };
+
+    // Ring of interleaved samples, written by record() at head and by
+    // the writer at tail
+    std::unique_ptr<float[], aligned_free> ring;
+    std::size_t mask;
+    unsigned int channels;
+    unsigned int width;  // Samples per frame, 2 * channels
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+
+    // record() runs while busy; stop() waits for it after clearing active
+    std::atomic<bool> active;
+    std::atomic<bool> busy;
+    std::atomic<std::uint64_t> recorded;
+    std::atomic<std::uint64_t> lost;
+
+    // File side, only touched by the writer (and by stop() once it ended)
+    int fd;
+    bool wav;
+    bool direct_io;
+    unsigned int rate;
+    std::uint64_t offset;  // Of the next write
+    std::unique_ptr<unsigned char[], aligned_free> header;
+    std::atomic<bool> running;
+    std::atomic<int> failure;
+    std::thread writer;
+
+    void writer_loop();
+    // Write every full chunk of the ring, or everything if all
+    void flush(bool all);
+    void write_block(const void *data, std::size_t bytes);
+    void write_header();
+};
+
+}  // namespace dsp
+
+#endif
@@ -0,0 +1,236 @@
+#include "rt_memory.h"
+
+#include <alloca.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#ifdef DSP_MALLOC_TRIPWIRE
+#include <execinfo.h>
+#endif
+
+namespace jack {
+
+  namespace {
+    std::atomic<bool> locked{false};
+
+    std::size_t page_size() {
+      static const std::size_t size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+      return size;
+    }
+  }
+
+  void lock_memory() {
+    // A single arena for all threads, without chunks of their own
+    // mmap()ed and never trimmed: freed memory stays in the heap,
+    // resident and locked
+    mallopt(M_ARENA_MAX, 1);
+    mallopt(M_MMAP_MAX, 0);
+    mallopt(M_TRIM_THRESHOLD, -1);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      const int error = errno;
+      throw std::runtime_error(std::string("Could not lock memory: ")
+                               + std::strerror(error)
+                               + " (check the locked memory limit, ulimit -l)");
+    }
+    locked.store(true, std::memory_order_release);
+    prefault_stack();
+  }
+
+  bool memory_locked() {
+    return locked.load(std::memory_order_acquire);
+  }
+
+  void reserve_heap(std::size_t bytes) {
+    if (bytes == 0) {
+      return;
+    }
+    // Without trimming the block stays in the heap once freed
+    volatile char* block = static_cast<volatile char*>(std::malloc(bytes));
+    if (block == nullptr) {
+      throw std::bad_alloc();
+    }
+    for (std::size_t i = 0; i < bytes; i += page_size()) {
+      block[i] = 0;
+    }
+    std::free(const_cast<char*>(block));
+  }
+
+  std::size_t heap_in_use() {
+    const struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+  }
+
+  __attribute__((noinline)) void prefault_stack(std::size_t bytes) {
+    volatile char* stack = static_cast<volatile char*>(alloca(bytes));
+    for (std::size_t i = 0; i < bytes; i += page_size()) {
+      stack[i] = 0;
+    }
+  }
+
+#ifdef DSP_MALLOC_TRIPWIRE
+
+  namespace {
+    // Initial-exec TLS, so that reading them never allocates
+    __attribute__((tls_model("initial-exec"))) thread_local bool in_process = false;
+    // Set while a call stack is recorded, whose allocations are not ours
+    __attribute__((tls_model("initial-exec"))) thread_local bool recording = false;
+
+    constexpr unsigned int max_traces = 4;
+    constexpr int trace_depth = 16;
+
+    std::atomic<std::uint64_t> allocations{0};
+    std::atomic<std::uint64_t> frees{0};
+    std::atomic<std::size_t> largest{0};
+
+    // Call stacks of the first allocations, written by the process
+    // thread only
+    void* trace[max_traces][trace_depth];
+    int trace_size[max_traces];
+    std::atomic<unsigned int> traces{0};
+
+    // backtrace() loads libgcc the first time, which allocates: do it
+    // before any process thread exists
+    const int backtrace_ready = [] {
+      void* frame[1];
+      return backtrace(frame, 1);
+    }();
+
+    inline bool armed() {
+      return in_process && !recording;
+    }
+
+    void trip(std::size_t size) {
+      allocations.fetch_add(1, std::memory_order_relaxed);
+      std::size_t top = largest.load(std::memory_order_relaxed);
+      while (size > top && !largest.compare_exchange_weak(top, size, std::memory_order_relaxed)) {
+      }
+
+      const unsigned int n = traces.load(std::memory_order_relaxed);
+      if (n < max_traces) {
+        recording = true;
+        trace_size[n] = backtrace(trace[n], trace_depth);
+        recording = false;
+        traces.store(n + 1, std::memory_order_release);
+      }
+    }
+  }
+
+  process_scope::process_scope() {
+    in_process = true;
+  }
+
+  process_scope::~process_scope() {
+    in_process = false;
+  }
+
+  tripwire_report read_tripwire() {
+    return {allocations.load(std::memory_order_relaxed),
+            frees.load(std::memory_order_relaxed),
+            largest.load(std::memory_order_relaxed)};
+  }
+
+  void print_tripwire(int fd) {
+    const unsigned int n = traces.load(std::memory_order_acquire);
+    for (unsigned int t = 0; t < n; ++t) {
+      static const char separator[] = "--\n";
+      if (write(fd, separator, sizeof(separator) - 1) < 0) {
+        return;
+      }
+      backtrace_symbols_fd(trace[t], trace_size[t], fd);
+    }
+  }
+
+#else
+
+  tripwire_report read_tripwire() {
+    return {0, 0, 0};
+  }
+
+  void print_tripwire(int) {
+  }
+
+#endif
+
+} // namespace jack
+
+#ifdef DSP_MALLOC_TRIPWIRE
+
+// glibc's allocator under the replaced names
+extern "C" {
+  void* __libc_malloc(std::size_t size);
+  void __libc_free(void* ptr);
+  void* __libc_calloc(std::size_t count, std::size_t size);
+  void* __libc_realloc(void* ptr, std::size_t size);
+  void* __libc_memalign(std::size_t alignment, std::size_t size);
+}
+
+extern "C" {
+
+  void* malloc(std::size_t size) noexcept {
+    if (jack::armed()) {
+      jack::trip(size);
+    }
+    return __libc_malloc(size);
+  }
+
+  void free(void* ptr) noexcept {
+    if (ptr != nullptr && jack::armed()) {
+      jack::frees.fetch_add(1, std::memory_order_relaxed);
+    }
+    __libc_free(ptr);
+  }
+
+  void* calloc(std::size_t count, std::size_t size) noexcept {
+    if (jack::armed()) {
+      jack::trip(count * size);
+    }
+    return __libc_calloc(count, size);
+  }
+
+  void* realloc(void* ptr, std::size_t size) noexcept {
+    if (jack::armed()) {
+      jack::trip(size);
+    }
+    return __libc_realloc(ptr, size);
+  }
+
+  void* memalign(std::size_t alignment, std::size_t size) noexcept {
+    if (jack::armed()) {
+      jack::trip(size);
+    }
+    return __libc_memalign(alignment, size);
+  }
+
+  void* aligned_alloc(std::size_t alignment, std::size_t size) noexcept {
+    return memalign(alignment, size);
+  }
+
+  void* valloc(std::size_t size) noexcept {
+    return memalign(jack::page_size(), size);
+  }
+
+  int posix_memalign(void** ptr, std::size_t alignment, std::size_t size) noexcept {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+      return EINVAL;
+    }
+    void* block = memalign(alignment, size);
+    if (block == nullptr) {
+      return ENOMEM;
+    }
+    *ptr = block;
+    return 0;
+  }
+
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef _RT_MEMORY_H
+#define _RT_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace jack {
+
+  /**
+   * Memory of a process that must not page fault in its process thread.
+   *
+   * lock_memory() locks every current and future page in RAM
+   * (mlockall) and turns the glibc heap into a single, never shrinking
+   * arena that does not mmap.  reserve_heap() then grows that arena by
+   * a given size and touches every page of it, so that later buffers,
+   * like those rebuilt when the stream format changes, are carved out
+   * of memory that is already resident.
+   *
+   * Thread stacks created after lock_memory() are locked, and thus
+   * resident, as they are mapped; the stack of the calling thread is
+   * prefaulted by lock_memory() itself.
+   */
+
+  /// Bytes of the calling thread's stack prefaulted by lock_memory()
+  constexpr std::size_t stack_prefault = 256 * 1024;
+
+  /**
+   * Lock the memory of the process.  Throws std::runtime_error if the
+   * pages cannot be locked (see ulimit -l, or the audio group limits).
+   */
+  void lock_memory();
+
+  /// True after a successful lock_memory()
+  bool memory_locked();
+
+  /**
+   * Make sure the heap holds at least bytes of free, resident memory.
+   */
+  void reserve_heap(std::size_t bytes);
+
+  /// Bytes allocated from the heap
+  std::size_t heap_in_use();
+
+  /// Touch bytes of the calling thread's stack
+  void prefault_stack(std::size_t bytes = stack_prefault);
+
+  /**
+   * Allocations on the process thread, counted by the malloc tripwire
+   */
+  struct tripwire_report {
+    std::uint64_t allocations;  ///< malloc, calloc, realloc, aligned
+    std::uint64_t frees;
+    std::size_t largest;        ///< Largest size requested
+  };
+
+#ifdef DSP_MALLOC_TRIPWIRE
+
+  /**
+   * Marks the calling thread as the process thread while it exists.
+   *
+   * Built with DSP_MALLOC_TRIPWIRE, malloc() and friends are replaced
+   * by wrappers that count the calls made inside such a scope.  The
+   * backends open one around every client::process() call.
+   */
+  class process_scope {
+  public:
+    process_scope();
+    ~process_scope();
+
+    process_scope(const process_scope&) = delete;
+    process_scope& operator=(const process_scope&) = delete;
+  };
+
+  constexpr bool tripwire_enabled = true;
+
+#else
+
+  class process_scope {
+  public:
+    process_scope() {}
+
+    process_scope(const process_scope&) = delete;
+    process_scope& operator=(const process_scope&) = delete;
+  };
+
+  constexpr bool tripwire_enabled = false;
+
+#endif
+
+  /// Counters of the tripwire so far (all zero if not built in)
+  tripwire_report read_tripwire();
+
+  /**
+   * Write the call stacks of the first allocations on the process
+   * thread to the file descriptor fd
+   */
+  void print_tripwire(int fd);
+
+} // namespace jack
+
+#endif
@@ -0,0 +1,233 @@
+#include "simd_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DSP_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace dsp {
+
+namespace {
+
+// Scalar versions, also used for the tails of the vector loops
+
+float sum_squares_scalar(const float *x, std::size_t n) {
+    float sum = 0.0f;
+    for (std::size_t i = 0; i < n; i++)
+        sum += x[i] * x[i];
+    return sum;
+}
+
+float dot_scalar(const float *a, const float *b, std::size_t n) {
+    float sum = 0.0f;
+    for (std::size_t i = 0; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+void scale_scalar(const float *in, float gain, float *out, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++)
+        out[i] = in[i] * gain;
+}
+
+void mac_scalar(const float *x, float gain, float *acc, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++)
+        acc[i] += x[i] * gain;
+}
+
+const kernel_table scalar_kernels = {"scalar", sum_squares_scalar, dot_scalar,
+                                     scale_scalar, mac_scalar};
+
+#ifdef DSP_X86_KERNELS
+
+// SSE2 is part of x86-64, so these need no target attribute
+
+float hsum128(__m128 v) {
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+float dot_sse2(const float *a, const float *b, std::size_t n) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    return hsum128(_mm_add_ps(acc0, acc1)) + dot_scalar(a + i, b + i, n - i);
+}
+
+float sum_squares_sse2(const float *x, std::size_t n) {
+    return dot_sse2(x, x, n);
+}
+
+void scale_sse2(const float *in, float gain, float *out, std::size_t n) {
+    const __m128 g = _mm_set1_ps(gain);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), g));
+    scale_scalar(in + i, gain, out + i, n - i);
+}
+
+void mac_sse2(const float *x, float gain, float *acc, std::size_t n) {
+    const __m128 g = _mm_set1_ps(gain);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(acc + i);
+        _mm_storeu_ps(acc + i, _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(x + i), g)));
+    }
+    mac_scalar(x + i, gain, acc + i, n - i);
+}
+
+const kernel_table sse2_kernels = {"sse2", sum_squares_sse2, dot_sse2,
+                                   scale_sse2, mac_sse2};
+
+__attribute__((target("avx2,fma"))) float dot_avx2(const float *a, const float *b,
+                                                   std::size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    std::size_t i = 0;
+    // Four accumulators hide the latency of the FMA
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8)
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    const __m256 acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    const __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    return hsum128(half) + dot_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) float sum_squares_avx2(const float *x, std::size_t n) {
+    return dot_avx2(x, x, n);
+}
+
+__attribute__((target("avx2,fma"))) void scale_avx2(const float *in, float gain,
+                                                    float *out, std::size_t n) {
+    const __m256 g = _mm256_set1_ps(gain);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), g));
+    scale_scalar(in + i, gain, out + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) void mac_avx2(const float *x, float gain,
+                                                  float *acc, std::size_t n) {
+    const __m256 g = _mm256_set1_ps(gain);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps(acc + i);
+        _mm256_storeu_ps(acc + i, _mm256_fmadd_ps(_mm256_loadu_ps(x + i), g, a));
+    }
+    mac_scalar(x + i, gain, acc + i, n - i);
+}
+
+const kernel_table avx2_kernels = {"avx2", sum_squares_avx2, dot_avx2,
+                                   scale_avx2, mac_avx2};
+
+__attribute__((target("avx512f"))) float dot_avx512(const float *a, const float *b,
+                                                    std::size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    // The tail uses a mask instead of the scalar loop
+    for (; i < n; i += 16) {
+        const __mmask16 m = n - i >= 16 ? 0xFFFF : __mmask16((1u << (n - i)) - 1);
+        acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc0);
+    }
+    // _mm512_reduce_add_ps trips -Wuninitialized in GCC 12 headers
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, _mm512_add_ps(acc0, acc1));
+    float sum = 0.0f;
+    for (float lane : lanes)
+        sum += lane;
+    return sum;
+}
+
+__attribute__((target("avx512f"))) float sum_squares_avx512(const float *x, std::size_t n) {
+    return dot_avx512(x, x, n);
+}
+
+__attribute__((target("avx512f"))) void scale_avx512(const float *in, float gain,
+                                                     float *out, std::size_t n) {
+    const __m512 g = _mm512_set1_ps(gain);
+    for (std::size_t i = 0; i < n; i += 16) {
+        const __mmask16 m = n - i >= 16 ? 0xFFFF : __mmask16((1u << (n - i)) - 1);
+        _mm512_mask_storeu_ps(out + i, m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, in + i), g));
+    }
+}
+
+__attribute__((target("avx512f"))) void mac_avx512(const float *x, float gain,
+                                                   float *acc, std::size_t n) {
+    const __m512 g = _mm512_set1_ps(gain);
+    for (std::size_t i = 0; i < n; i += 16) {
+        const __mmask16 m = n - i >= 16 ? 0xFFFF : __mmask16((1u << (n - i)) - 1);
+        const __m512 a = _mm512_maskz_loadu_ps(m, acc + i);
+        _mm512_mask_storeu_ps(acc + i, m, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, x + i), g, a));
+    }
+}
+
+const kernel_table avx512_kernels = {"avx512", sum_squares_avx512, dot_avx512,
+                                     scale_avx512, mac_avx512};
+
+#endif
+
+const kernel_table *best_kernels() {
+#ifdef DSP_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return &avx512_kernels;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return &avx2_kernels;
+    return &sse2_kernels;
+#else
+    return &scalar_kernels;
+#endif
+}
+
+// Selected before main(), so the process thread never pays for it
+const kernel_table *active = best_kernels();
+
+}  // namespace
+
+const kernel_table &kernels() {
+    return *active;
+}
+
+bool select_kernels(const std::string &name) {
+    if (name == "scalar") {
+        active = &scalar_kernels;
+        return true;
+    }
+#ifdef DSP_X86_KERNELS
+    __builtin_cpu_init();
+    if (name == "sse2") {
+        active = &sse2_kernels;
+        return true;
+    }
+    if (name == "avx2" && __builtin_cpu_supports("avx2") &&
+        __builtin_cpu_supports("fma")) {
+        active = &avx2_kernels;
+        return true;
+    }
+    if (name == "avx512" && __builtin_cpu_supports("avx512f")) {
+        active = &avx512_kernels;
+        return true;
+    }
+#endif
+    return false;
+}
+
+}  // namespace dsp
@@ -0,0 +1,65 @@
+#ifndef _SIMD_KERNELS_H
+#define _SIMD_KERNELS_H
+
+#include <cstddef>
+#include <string>
+
+namespace dsp {
+
+/**
+ * Vectorized kernels of the per-sample loops.
+ *
+ * Each kernel has a scalar version and, on x86, SSE2, AVX2 and AVX-512
+ * versions.  The best version supported by the CPU is selected at run
+ * time, during static initialization, so that the first call on the
+ * process thread does not pay for it (kernels() is not meant for the
+ * static initializers of other files).  select_kernels() can force
+ * another one (e.g. to compare them in dsp_bench).
+ */
+struct kernel_table {
+    const char *name;
+
+    // sum_i x[i]^2
+    float (*sum_squares)(const float *x, std::size_t n);
+
+    // sum_i a[i] * b[i]
+    float (*dot)(const float *a, const float *b, std::size_t n);
+
+    // out[i] = in[i] * gain  (in and out may be the same)
+    void (*scale)(const float *in, float gain, float *out, std::size_t n);
+
+    // acc[i] += x[i] * gain
+    void (*mac)(const float *x, float gain, float *acc, std::size_t n);
+};
+
+/**
+ * Kernels in use
+ */
+const kernel_table &kernels();
+
+/**
+ * Force a kernel set by name ("scalar", "sse2", "avx2", "avx512").
+ * Returns false if the CPU does not support it.  Not thread safe: call
+ * before processing starts.
+ */
+bool select_kernels(const std::string &name);
+
+inline float sum_squares(const float *x, std::size_t n) {
+    return kernels().sum_squares(x, n);
+}
+
+inline float dot(const float *a, const float *b, std::size_t n) {
+    return kernels().dot(a, b, n);
+}
+
+inline void scale(const float *in, float gain, float *out, std::size_t n) {
+    kernels().scale(in, gain, out, n);
+}
+
+inline void mac(const float *x, float gain, float *acc, std::size_t n) {
+    kernels().mac(x, gain, acc, n);
+}
+
+}  // namespace dsp
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+namespace dsp {
+
+/**
+ * Double-buffered snapshot for one writer and any number of readers.
+ *
+ * The writer fills the slot that is not currently published and then
+ * flips the index, so a reader only has to retry if the writer managed
+ * to publish twice while it was copying.  Each slot carries a sequence
+ * number (odd while being written) to detect that case.  Neither side
+ * ever blocks, which makes read() safe on the JACK process thread.
+ */
+template <typename T>
+class snapshot {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "snapshot values are copied with memcpy");
+
+   public:
+    snapshot() : current(0) {}
+
+    explicit snapshot(const T &value) : current(0) {
+        publish(value);
+    }
+
+    // Writer side, only one thread may call this
+    void publish(const T &value) {
+        const unsigned int next = current.load(std::memory_order_relaxed) ^ 1;
+        slot &s = slots[next];
+        s.seq.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&s.value, &value, sizeof(T));
+        s.seq.fetch_add(1, std::memory_order_release);
+        current.store(next, std::memory_order_release);
+    }
+
+    // Reader side, lock-free
+    T read() const {
+        T value;
+        for (;;) {
+            const slot &s = slots[current.load(std::memory_order_acquire)];
+            const unsigned int before = s.seq.load(std::memory_order_acquire);
+            if (before & 1)
+                continue;
+            std::memcpy(&value, &s.value, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) == before)
+                return value;
+        }
+    }
+
+    /**
+     * Single attempt of read(); false if the writer was publishing.
+     * For readers in another process, which must not spin forever on a
+     * writer that died halfway through publish().
+     */
+    bool try_read(T &value) const {
+        const slot &s = slots[current.load(std::memory_order_acquire)];
+        const unsigned int before = s.seq.load(std::memory_order_acquire);
+        if (before & 1)
+            return false;
+        std::memcpy(&value, &s.value, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return s.seq.load(std::memory_order_relaxed) == before;
+    }
+
+   private:
+    struct slot {
+        std::atomic<unsigned int> seq{0};
+        T value{};
+    };
+
+    slot slots[2];
+    std::atomic<unsigned int> current;
+};
+
+}  // namespace dsp
+
+#endif
@@ -0,0 +1,133 @@
+#include "spectrum.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace dsp {
+
+namespace {
+
+// Level reported for silence
+constexpr double floor_db = -200;
+
+// Lower edge of the analyzed bands, in Hz
+constexpr double lowest_band = 20;
+
+float decibels(double power) {
+    return static_cast<float>(power > 1e-20 ? 10 * std::log10(power) : floor_db);
+}
+
+}  // namespace
+
+stft_analyzer::stft_analyzer()
+    : rate(0), hop_size(1), since_frame(0), amplitude_scale(0), power_scale(0), result{} {}
+
+void stft_analyzer::validate(std::size_t size, std::size_t hop,
+                             unsigned int bands_per_octave) {
+    if (size < 16 || size > spectrum_frame::max_size || (size & (size - 1)) != 0) {
+        throw std::invalid_argument("The FFT size must be a power of two between 16 and " +
+                                    std::to_string(spectrum_frame::max_size));
+    }
+    if (hop == 0 || hop > size) {
+        throw std::invalid_argument("The hop must be between 1 and the FFT size");
+    }
+    if (bands_per_octave != 1 && bands_per_octave != 3) {
+        throw std::invalid_argument("Bands must be octaves or third octaves");
+    }
+}
+
+void stft_analyzer::prepare(float sample_rate, std::size_t size, std::size_t hop,
+                            unsigned int bands_per_octave) {
+    validate(size, hop, bands_per_octave);
+
+    rate = sample_rate;
+    hop_size = hop;
+    fft.resize(size);
+    history.reset(size);
+    since_frame = 0;
+
+    // Periodic Hann window, and the scales that undo its gain
+    window.resize(size);
+    double sum = 0;
+    double sum_squares = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+        window[i] = 0.5 - 0.5 * std::cos(2 * M_PI * i / size);
+        sum += window[i];
+        sum_squares += window[i] * window[i];
+    }
+    amplitude_scale = 2 / sum;
+    power_scale = 2 / (size * sum_squares);
+    windowed.assign(size, 0.0);
+    bins.assign(size / 2 + 1, real_fft::complex_t());
+
+    result = spectrum_frame{};
+    result.bins = size / 2 + 1;
+    result.bin_width = sample_rate / size;
+    std::fill(result.magnitude, result.magnitude + result.bins, static_cast<float>(floor_db));
+
+    // Bands whose edges are f * 2^(-+1 / (2 bands_per_octave)), from the
+    // first reaching 20 Hz to the last below Nyquist
+    const double edge = std::exp2(0.5 / bands_per_octave);
+    const double width = result.bin_width;
+    band_bins.clear();
+    for (int k = -10 * static_cast<int>(bands_per_octave);
+         result.bands < spectrum_frame::max_bands; ++k) {
+        const double center = 1000 * std::exp2(static_cast<double>(k) / bands_per_octave);
+        if (center * edge < lowest_band) {
+            continue;
+        }
+        if (center * edge > sample_rate / 2) {
+            break;
+        }
+        std::size_t first = static_cast<std::size_t>(std::ceil(center / edge / width));
+        std::size_t last = static_cast<std::size_t>(std::ceil(center * edge / width));
+        if (first >= last) {
+            first = static_cast<std::size_t>(std::lround(center / width));
+            last = first + 1;
+        }
+        band_bins.emplace_back(first, last);
+        result.band_center[result.bands] = static_cast<float>(center);
+        result.band_level[result.bands] = static_cast<float>(floor_db);
+        ++result.bands;
+    }
+}
+
+void stft_analyzer::clear() {
+    history.clear();
+    since_frame = 0;
+}
+
+void stft_analyzer::transform() {
+    const std::size_t n = fft.size();
+    const float *const x = history.window(history.size() - n, n).data();
+    for (std::size_t i = 0; i < n; ++i) {
+        windowed[i] = x[i] * window[i];
+    }
+    fft.forward(windowed.data(), bins.data());
+
+    const double amplitude = amplitude_scale * amplitude_scale;
+    std::size_t peak = 1;
+    double peak_power = 0;
+    for (std::size_t k = 0; k < result.bins; ++k) {
+        const double power = std::norm(bins[k]);
+        result.magnitude[k] = decibels(power * amplitude);
+        if (k > 0 && power > peak_power) {
+            peak_power = power;
+            peak = k;
+        }
+    }
+    result.peak_frequency = peak * result.bin_width;
+    result.peak_level = result.magnitude[peak];
+
+    for (std::uint32_t b = 0; b < result.bands; ++b) {
+        double power = 0;
+        for (std::size_t k = band_bins[b].first; k < band_bins[b].second; ++k) {
+            power += std::norm(bins[k]);
+        }
+        result.band_level[b] = decibels(power * power_scale);
+    }
+    ++result.sequence;
+}
+
+}  // namespace dsp
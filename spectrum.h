@@ -0,0 +1,133 @@
+#ifndef _SPECTRUM_H
+#define _SPECTRUM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "fft.h"
+#include "mirrored_ring.h"
+
+namespace dsp {
+
+/**
+ * One frame of a short-time spectrum.
+ *
+ * Trivially copyable, so that it can be published through a snapshot.
+ * Levels are in dB relative to full scale: a full-scale sine reads 0 dB
+ * at its bin of magnitude[], and -3 dB in the energy of its band.
+ */
+struct spectrum_frame {
+    static constexpr unsigned int max_size = 8192;  // Longest FFT
+    static constexpr unsigned int max_bins = max_size / 2 + 1;
+    static constexpr unsigned int max_bands = 32;
+
+    std::uint64_t sequence;  // Frames analyzed so far, 0 before the first
+    std::uint32_t bins;      // Valid entries of magnitude[]
+    std::uint32_t bands;     // Valid entries of band_center[] and band_level[]
+    float bin_width;         // In Hz
+    float peak_frequency;    // Of the largest bin above DC, in Hz
+    float peak_level;        // Of that bin, in dB
+    float magnitude[max_bins];
+    float band_center[max_bands];  // Nominal center frequency, in Hz
+    float band_level[max_bands];   // Mean square of the band, in dB
+};
+
+/**
+ * Hop-based short-time Fourier transform with band energies.
+ *
+ * push() appends samples to a history of one FFT length and, every hop
+ * samples, transforms the last FFT length of them through a Hann
+ * window.  The window, the FFT plan, the band table and every buffer
+ * are built by prepare(), so analysis never allocates.
+ *
+ * The bands are octaves or third octaves (base 2, centered on 1 kHz)
+ * from 20 Hz up to the Nyquist frequency, at most
+ * spectrum_frame::max_bands of them.  A band narrower than the bins of
+ * the FFT reads the bin nearest to its center.
+ */
+class stft_analyzer {
+   public:
+    stft_analyzer();
+    stft_analyzer(const stft_analyzer &) = delete;
+    stft_analyzer &operator=(const stft_analyzer &) = delete;
+
+    /**
+     * Analyze frames of size samples (a power of two, up to
+     * spectrum_frame::max_size) every hop samples, with bands_per_octave
+     * bands per octave (1 or 3).  Throws std::invalid_argument if the
+     * sizes are out of range.
+     */
+    void prepare(float sample_rate, std::size_t size, std::size_t hop,
+                 unsigned int bands_per_octave);
+
+    /// Throws what prepare() would for these sizes
+    static void validate(std::size_t size, std::size_t hop,
+                         unsigned int bands_per_octave);
+
+    /// Forget the history, the next frame needs size() new samples
+    void clear();
+
+    /**
+     * Append n samples.  Returns the number of frames completed, each of
+     * which is handed to publish(frame()) if given.
+     */
+    template <typename Publish>
+    std::size_t push(const float *src, std::size_t n, Publish &&publish) {
+        std::size_t frames = 0;
+        while (n > 0) {
+            const std::size_t k = std::min(n, hop_size - since_frame);
+            history.push(src, k);
+            src += k;
+            n -= k;
+            since_frame += k;
+            if (since_frame == hop_size) {
+                since_frame = 0;
+                if (history.size() >= fft.size()) {
+                    transform();
+                    publish(result);
+                    ++frames;
+                }
+            }
+        }
+        return frames;
+    }
+
+    std::size_t push(const float *src, std::size_t n) {
+        return push(src, n, [](const spectrum_frame &) {});
+    }
+
+    // Last frame analyzed
+    const spectrum_frame &frame() const { return result; }
+
+    std::size_t size() const { return fft.size(); }
+    std::size_t hop() const { return hop_size; }
+    // Frames per second
+    float frame_rate() const { return rate / hop_size; }
+
+   private:
+    float rate;
+    std::size_t hop_size;
+    std::size_t since_frame;  // Samples pushed since the last frame
+    mirrored_ring history;
+
+    real_fft fft;
+    std::vector<double> window;
+    std::vector<double> windowed;
+    std::vector<real_fft::complex_t> bins;
+    double amplitude_scale;  // Bin magnitude of a unit sine to 1
+    double power_scale;      // Sum of squared bins to mean square
+
+    // Bins [first, last) of each band
+    std::vector<std::pair<std::size_t, std::size_t>> band_bins;
+
+    spectrum_frame result;
+
+    void transform();
+};
+
+}  // namespace dsp
+
+#endif
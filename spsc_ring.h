@@ -0,0 +1,90 @@
+#ifndef _SPSC_RING_H
+#define _SPSC_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * Lock-free single producer / single consumer ring.
+ *
+ * The producer (the JACK process thread) only writes the head index and
+ * the consumer (the analysis thread) only writes the tail index, so
+ * neither side ever waits for the other.  If the consumer falls behind,
+ * push() writes what fits and reports how many elements were dropped.
+ *
+ * reset() allocates and must not run concurrently with push() or consume().
+ */
+template <typename T>
+class spsc_ring {
+   public:
+    spsc_ring() : mask(0), head(0), tail(0) {}
+
+    void reset(std::size_t capacity) {
+        data.assign(std::bit_ceil(std::max<std::size_t>(capacity, 2)), T());
+        mask = data.size() - 1;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    std::size_t capacity() const { return data.size(); }
+
+    // Number of elements ready to be consumed
+    std::size_t size() const {
+        return head.load(std::memory_order_acquire) -
+               tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Producer side: copy up to n elements into the ring.  Returns the
+     * number of elements actually written.
+     */
+    std::size_t push(const T *const src, std::size_t n) {
+        const std::size_t h = head.load(std::memory_order_relaxed);
+        const std::size_t t = tail.load(std::memory_order_acquire);
+        n = std::min(n, data.size() - (h - t));
+
+        const std::size_t first = std::min(n, data.size() - (h & mask));
+        std::copy(src, src + first, data.begin() + (h & mask));
+        std::copy(src + first, src + n, data.begin());
+
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    /**
+     * Consumer side: hand every available element to f(ptr, count),
+     * in at most two contiguous segments, and release them.  Returns
+     * the number of elements consumed.
+     */
+    template <class Function>
+    std::size_t consume(Function &&f) {
+        const std::size_t t = tail.load(std::memory_order_relaxed);
+        const std::size_t n = head.load(std::memory_order_acquire) - t;
+
+        const std::size_t first = std::min(n, data.size() - (t & mask));
+        if (first > 0)
+            f(data.data() + (t & mask), first);
+        if (n > first)
+            f(data.data(), n - first);
+
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+   private:
+    std::vector<T> data;
+    std::size_t mask;
+
+    // Keep each index in its own cache line to avoid false sharing
+    alignas(64) std::atomic<std::size_t> head;  // Written by the producer
+    alignas(64) std::atomic<std::size_t> tail;  // Written by the consumer
+};
+
+}  // namespace dsp
+
+#endif
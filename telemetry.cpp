@@ -0,0 +1,236 @@
+#include "telemetry.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include "callback_stats.h"
+#include "note_table.h"
+
+namespace dsp {
+
+namespace {
+
+sockaddr_un socket_address(const std::string &path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Invalid telemetry socket path: " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+}  // namespace
+
+telemetry_publisher::telemetry_publisher()
+    : segment(nullptr), sock(-1), address{}, sequence(0), lost(0) {}
+
+telemetry_publisher::~telemetry_publisher() {
+    close();
+}
+
+void telemetry_publisher::open_shared_memory(const std::string &name) {
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create the telemetry segment " + name);
+    }
+    if (ftruncate(fd, sizeof(telemetry_segment)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot size the telemetry segment " + name);
+    }
+    void *area = mmap(nullptr, sizeof(telemetry_segment),
+                      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (area == MAP_FAILED) {
+        throw std::runtime_error("Cannot map the telemetry segment " + name);
+    }
+
+    // Readers ignore the segment until the header is complete
+    telemetry_segment *s = static_cast<telemetry_segment *>(area);
+    __atomic_store_n(&s->magic, 0, __ATOMIC_RELEASE);
+    new (&s->frame) snapshot<telemetry_frame>();
+    s->version = telemetry_frame::version_value;
+    s->frame_size = sizeof(telemetry_frame);
+    s->reserved = 0;
+    __atomic_store_n(&s->magic, telemetry_frame::magic_value, __ATOMIC_RELEASE);
+
+    segment = s;
+    segment_name = name;
+}
+
+void telemetry_publisher::open_socket(const std::string &path) {
+    address = socket_address(path);
+    sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        throw std::runtime_error("Cannot create the telemetry socket");
+    }
+}
+
+void telemetry_publisher::stamp(telemetry_frame &frame) {
+    frame.magic = telemetry_frame::magic_value;
+    frame.version = telemetry_frame::version_value;
+    frame.pid = static_cast<std::uint32_t>(getpid());
+    frame.sequence = ++sequence;
+    frame.timestamp_ns = jack::callback_stats::now_ns();
+}
+
+void telemetry_publisher::publish(telemetry_frame &frame) {
+    stamp(frame);
+
+    if (segment != nullptr) {
+        segment->frame.publish(frame);
+    }
+    if (sock >= 0 &&
+        sendto(sock, &frame, sizeof(frame), MSG_DONTWAIT,
+               reinterpret_cast<const sockaddr *>(&address),
+               sizeof(address)) != static_cast<ssize_t>(sizeof(frame))) {
+        // No reader bound (ENOENT, ECONNREFUSED) or its queue is full
+        ++lost;
+    }
+}
+
+void telemetry_publisher::close() {
+    if (segment != nullptr) {
+        munmap(segment, sizeof(telemetry_segment));
+        shm_unlink(segment_name.c_str());
+        segment = nullptr;
+    }
+    if (sock >= 0) {
+        ::close(sock);
+        sock = -1;
+    }
+}
+
+void write_json(std::ostream &out, const telemetry_frame &f, double age_ms) {
+    out << "{\"pid\": " << f.pid << ", \"sequence\": " << f.sequence
+        << ", \"age_ms\": " << age_ms
+        << ", \"sample_rate\": " << f.sample_rate
+        << ", \"buffer_size\": " << f.buffer_size
+        << ", \"mode\": \"" << f.mode << "\""
+        << ", \"volume\": " << f.volume
+        << ", \"energy_mode\": " << (f.energy_mode ? "true" : "false")
+        << ", \"period_mode\": " << (f.period_mode ? "true" : "false")
+        << ", \"cycles\": " << f.cycles << ", \"xruns\": " << f.xruns
+        << ", \"load\": " << f.load << ", \"p99_load\": " << f.p99_load
+        << ", \"worst_load\": " << f.worst_load
+        << ", \"worst_us\": " << f.worst_us
+        << ", \"loudness_mode\": " << (f.loudness_mode ? "true" : "false")
+        << ", \"momentary\": " << f.momentary
+        << ", \"short_term\": " << f.short_term
+        << ", \"integrated\": " << f.integrated
+        << ", \"loudness_range\": " << f.loudness_range << ", \"channels\": [";
+    for (unsigned int ch = 0; ch < f.channels; ++ch) {
+        const telemetry_channel &c = f.channel[ch];
+        out << (ch ? ", " : "") << "{\"energy\": " << c.energy
+            << ", \"power\": " << c.power << ", \"period\": " << c.period
+            << ", \"frequency\": " << c.frequency
+            << ", \"confidence\": " << c.confidence
+            << ", \"note\": \"" << (c.note < 0 ? "" : note_table::name(c.note))
+            << "\", \"freq_tuned\": " << c.freq_tuned
+            << ", \"cents\": " << c.cents << "}";
+    }
+    out << "]}";
+}
+
+telemetry_reader::telemetry_reader()
+    : segment(nullptr), sock(-1), last_sequence(0) {}
+
+telemetry_reader::~telemetry_reader() {
+    close();
+}
+
+void telemetry_reader::open_shared_memory(const std::string &name) {
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error("No telemetry segment " + name);
+    }
+    void *area = mmap(nullptr, sizeof(telemetry_segment), PROT_READ,
+                      MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (area == MAP_FAILED) {
+        throw std::runtime_error("Cannot map the telemetry segment " + name);
+    }
+    segment = static_cast<const telemetry_segment *>(area);
+}
+
+void telemetry_reader::open_socket(const std::string &path) {
+    const sockaddr_un address = socket_address(path);
+    sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        throw std::runtime_error("Cannot create the telemetry socket");
+    }
+    // A stale socket file of a previous reader would make bind() fail
+    unlink(path.c_str());
+    if (bind(sock, reinterpret_cast<const sockaddr *>(&address),
+             sizeof(address)) != 0) {
+        ::close(sock);
+        sock = -1;
+        throw std::runtime_error("Cannot bind the telemetry socket " + path);
+    }
+    socket_path = path;
+}
+
+bool telemetry_reader::read(telemetry_frame &frame, int timeout_ms) {
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(timeout_ms);
+
+    if (sock >= 0) {
+        for (;;) {
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            pollfd p{sock, POLLIN, 0};
+            if (poll(&p, 1, std::max<int>(0, left.count())) <= 0) {
+                return false;
+            }
+            if (recv(sock, &frame, sizeof(frame), 0) == sizeof(frame) &&
+                frame.magic == telemetry_frame::magic_value &&
+                frame.version == telemetry_frame::version_value) {
+                last_sequence = frame.sequence;
+                return true;
+            }
+        }
+    }
+
+    if (segment == nullptr ||
+        __atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != telemetry_frame::magic_value ||
+        segment->version != telemetry_frame::version_value ||
+        segment->frame_size != sizeof(telemetry_frame)) {
+        return false;
+    }
+    // The segment has no notification, so poll it
+    for (;;) {
+        if (segment->frame.try_read(frame) && frame.sequence != last_sequence &&
+            frame.magic == telemetry_frame::magic_value) {
+            last_sequence = frame.sequence;
+            return true;
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+void telemetry_reader::close() {
+    if (segment != nullptr) {
+        munmap(const_cast<telemetry_segment *>(segment), sizeof(telemetry_segment));
+        segment = nullptr;
+    }
+    if (sock >= 0) {
+        ::close(sock);
+        unlink(socket_path.c_str());
+        sock = -1;
+    }
+}
+
+}  // namespace dsp
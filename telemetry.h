@@ -0,0 +1,179 @@
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#include <sys/un.h>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "snapshot.h"
+
+namespace dsp {
+
+/**
+ * Metrics of one channel
+ */
+struct telemetry_channel {
+    float energy;
+    float power;
+    float period;      // In seconds, -1 without pitch
+    float frequency;   // In Hz, 0 without pitch
+    float confidence;  // 0 to 1
+    float freq_tuned;  // Nearest note, -1 without sound
+    float cents;       // Of the frequency above the note
+    std::int32_t note; // MIDI number, -1 without sound
+};
+
+/**
+ * Metrics of the whole client at one point in time.
+ *
+ * Frames are exchanged as raw bytes between processes of the same host,
+ * so the layout is fixed: only fixed-size fields, native byte order.
+ * Any change to it must bump version.
+ */
+struct telemetry_frame {
+    static constexpr std::uint32_t magic_value = 0x44535054;  // "DSPT"
+    static constexpr std::uint16_t version_value = 2;
+    static constexpr unsigned int max_channels = 16;
+
+    std::uint32_t magic;
+    std::uint16_t version;
+    std::uint16_t channels;  // Valid entries of channel[]
+    std::uint32_t pid;
+    std::uint32_t sample_rate;
+    std::uint64_t sequence;      // Set by the publisher, from 1
+    std::int64_t timestamp_ns;   // CLOCK_MONOTONIC, set by the publisher
+    std::uint32_t buffer_size;
+    float volume;
+    char mode[16];  // Name of the mode, zero terminated
+    std::uint8_t energy_mode;
+    std::uint8_t period_mode;
+    std::uint8_t loudness_mode;
+    std::uint8_t reserved[5];
+    // Process callback statistics
+    std::uint64_t cycles;
+    std::uint64_t xruns;
+    float load;  // % of the period budget
+    float worst_load;
+    float p99_load;
+    float worst_us;
+    // EBU R128 loudness of all the channels, in LUFS and LU
+    float momentary;
+    float short_term;
+    float integrated;
+    float loudness_range;
+    telemetry_channel channel[max_channels];
+};
+
+static_assert(sizeof(telemetry_frame) == 624,
+              "The telemetry layout changed, bump telemetry_frame::version");
+
+/**
+ * Write frame as one JSON object, without a line end.  age_ms is how old
+ * the frame is for the reader.
+ */
+void write_json(std::ostream &out, const telemetry_frame &frame, double age_ms);
+
+/**
+ * Shared memory segment: a header to check before trusting the layout,
+ * then the last published frame behind a seqlock.
+ */
+struct telemetry_segment {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t frame_size;
+    std::uint32_t reserved;
+    snapshot<telemetry_frame> frame;
+};
+
+/**
+ * Publishes telemetry frames to a POSIX shared memory segment and/or a
+ * UNIX datagram socket.
+ *
+ * publish() never blocks: the segment is written with a seqlock that
+ * readers poll, and datagrams are sent with MSG_DONTWAIT, dropped if
+ * no reader is bound to the socket or its queue is full.  It is meant
+ * for the control thread, not for process().
+ */
+class telemetry_publisher {
+   public:
+    telemetry_publisher();
+    ~telemetry_publisher();
+
+    telemetry_publisher(const telemetry_publisher &) = delete;
+    telemetry_publisher &operator=(const telemetry_publisher &) = delete;
+
+    /**
+     * Create (or take over) the shared memory segment with the given
+     * name, like "/dsp1".  Throws std::runtime_error on failure.
+     */
+    void open_shared_memory(const std::string &name);
+
+    /**
+     * Send every frame as a datagram to the socket bound at path.
+     * Throws std::runtime_error on failure.
+     */
+    void open_socket(const std::string &path);
+
+    // True if some output is open
+    bool active() const { return segment != nullptr || sock >= 0; }
+
+    /**
+     * Stamp frame with the header, sequence number and time and publish
+     * it.
+     */
+    void publish(telemetry_frame &frame);
+
+    // Only stamp frame, for a copy sent some other way
+    void stamp(telemetry_frame &frame);
+
+    // Datagrams that could not be sent
+    std::uint64_t dropped() const { return lost; }
+
+    // Unlink the segment and close the socket
+    void close();
+
+   private:
+    telemetry_segment *segment;
+    std::string segment_name;
+    int sock;
+    sockaddr_un address;
+    std::uint64_t sequence;
+    std::uint64_t lost;
+};
+
+/**
+ * Reads the frames of a telemetry_publisher, from its shared memory
+ * segment or by binding its datagram socket.
+ */
+class telemetry_reader {
+   public:
+    telemetry_reader();
+    ~telemetry_reader();
+
+    telemetry_reader(const telemetry_reader &) = delete;
+    telemetry_reader &operator=(const telemetry_reader &) = delete;
+
+    // Throw std::runtime_error on failure
+    void open_shared_memory(const std::string &name);
+    void open_socket(const std::string &path);
+
+    /**
+     * Wait up to timeout_ms for a frame newer than the last one read.
+     * False on timeout, or if the segment does not hold a valid frame.
+     */
+    bool read(telemetry_frame &frame, int timeout_ms);
+
+    void close();
+
+   private:
+    const telemetry_segment *segment;
+    int sock;
+    std::string socket_path;
+    std::uint64_t last_sequence;
+};
+
+}  // namespace dsp
+
+#endif
@@ -0,0 +1,231 @@
+#include "wav_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace dsp {
+
+namespace {
+
+uint32_t le32(const unsigned char *p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+           (uint32_t(p[3]) << 24);
+}
+
+uint16_t le16(const unsigned char *p) {
+    return uint16_t(p[0] | (p[1] << 8));
+}
+
+void put32(std::ofstream &f, uint32_t v) {
+    const unsigned char b[4] = {static_cast<unsigned char>(v),
+                                static_cast<unsigned char>(v >> 8),
+                                static_cast<unsigned char>(v >> 16),
+                                static_cast<unsigned char>(v >> 24)};
+    f.write(reinterpret_cast<const char *>(b), 4);
+}
+
+void put16(std::ofstream &f, uint16_t v) {
+    const unsigned char b[2] = {static_cast<unsigned char>(v),
+                                static_cast<unsigned char>(v >> 8)};
+    f.write(reinterpret_cast<const char *>(b), 2);
+}
+
+}  // namespace
+
+mapped_audio_file::mapped_audio_file(const std::string &path,
+                                     unsigned int raw_sample_rate,
+                                     unsigned int raw_channels)
+    : map(MAP_FAILED), map_size(0), data(nullptr), n_frames(0), n_channels(raw_channels), rate(raw_sample_rate), bytes_per_sample(4), is_float(true) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot read " + path);
+    }
+    map_size = st.st_size;
+    map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("Cannot map " + path);
+    }
+    // The file is read front to back
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    data = static_cast<const unsigned char *>(map);
+    if (map_size >= 12 &&
+        (std::memcmp(data, "RIFF", 4) == 0 || std::memcmp(data, "RF64", 4) == 0) &&
+        std::memcmp(data + 8, "WAVE", 4) == 0) {
+        try {
+            parse_wav();
+        } catch (...) {
+            munmap(map, map_size);
+            throw;
+        }
+    } else if (rate == 0 || n_channels == 0) {
+        munmap(map, map_size);
+        throw std::runtime_error(path + " is not a WAV file; a sample rate is needed for raw floats");
+    } else {
+        n_frames = map_size / (sizeof(float) * n_channels);
+    }
+}
+
+mapped_audio_file::~mapped_audio_file() {
+    if (map != MAP_FAILED) {
+        munmap(map, map_size);
+    }
+}
+
+void mapped_audio_file::parse_wav() {
+    const unsigned char *const base = static_cast<const unsigned char *>(map);
+    std::size_t pos = 12;
+    bool have_format = false;
+    // RF64 keeps the size of the data chunk in the ds64 chunk
+    std::uint64_t rf64_data_size = 0;
+
+    // Walk the chunks until the data chunk is found
+    while (pos + 8 <= map_size) {
+        const unsigned char *chunk = base + pos;
+        const std::size_t size = le32(chunk + 4);
+        if (std::memcmp(chunk, "ds64", 4) == 0 && size >= 24) {
+            rf64_data_size = le32(chunk + 16) | (std::uint64_t(le32(chunk + 20)) << 32);
+        } else if (std::memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            uint16_t tag = le16(chunk + 8);
+            n_channels = le16(chunk + 10);
+            rate = le32(chunk + 12);
+            bytes_per_sample = le16(chunk + 22) / 8;
+            // WAVE_FORMAT_EXTENSIBLE keeps the real tag in the subformat
+            if (tag == 0xFFFE && size >= 26) {
+                tag = le16(chunk + 32);
+            }
+            if (tag == 3 && bytes_per_sample == 4) {
+                is_float = true;
+            } else if (tag == 1 && bytes_per_sample >= 2 && bytes_per_sample <= 4) {
+                is_float = false;
+            } else {
+                throw std::runtime_error("Unsupported WAV sample format");
+            }
+            have_format = true;
+        } else if (std::memcmp(chunk, "data", 4) == 0) {
+            if (!have_format || n_channels == 0) {
+                throw std::runtime_error("WAV data chunk before format chunk");
+            }
+            data = chunk + 8;
+            const std::size_t length = (size == UINT32_MAX && rf64_data_size > 0) ? rf64_data_size : size;
+            const std::size_t bytes = std::min(length, map_size - pos - 8);
+            n_frames = bytes / (bytes_per_sample * n_channels);
+            return;
+        }
+        // Chunks are padded to an even size
+        pos += 8 + size + (size & 1);
+    }
+    throw std::runtime_error("WAV file without data chunk");
+}
+
+bool mapped_audio_file::load() const {
+    madvise(map, map_size, MADV_WILLNEED);
+    if (mlock(map, map_size) == 0) {
+        return true;
+    }
+    // Over the locked memory limit: at least read every page once
+    const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const volatile unsigned char *p = static_cast<const unsigned char *>(map);
+    for (std::size_t i = 0; i < map_size; i += page) {
+        (void)p[i];
+    }
+    return false;
+}
+
+const float *mapped_audio_file::samples() const {
+    // The mapping is page aligned, data must also be float aligned
+    if (is_float && n_channels == 1 &&
+        reinterpret_cast<std::uintptr_t>(data) % alignof(float) == 0) {
+        return reinterpret_cast<const float *>(data);
+    }
+    return nullptr;
+}
+
+void mapped_audio_file::read(unsigned int ch, std::size_t first,
+                             std::size_t n, float *const dst) const {
+    const std::size_t available =
+        first < n_frames ? std::min(n, n_frames - first) : 0;
+    const std::size_t stride = bytes_per_sample * n_channels;
+    const unsigned char *p = data + first * stride + ch * bytes_per_sample;
+
+    for (std::size_t i = 0; i < available; ++i, p += stride) {
+        if (is_float) {
+            std::memcpy(dst + i, p, sizeof(float));
+        } else if (bytes_per_sample == 2) {
+            dst[i] = int16_t(le16(p)) / 32768.0f;
+        } else if (bytes_per_sample == 3) {
+            // Sign extend from the top of a 32 bit word
+            const int32_t v = int32_t((uint32_t(p[0]) << 8) |
+                                      (uint32_t(p[1]) << 16) |
+                                      (uint32_t(p[2]) << 24)) >> 8;
+            dst[i] = v / 8388608.0f;
+        } else {
+            dst[i] = int32_t(le32(p)) / 2147483648.0f;
+        }
+    }
+    std::fill(dst + available, dst + n, 0.0f);
+}
+
+wav_writer::wav_writer(const std::string &path, unsigned int sample_rate,
+                       unsigned int channels)
+    : file(path, std::ios::binary | std::ios::trunc), wav(path.size() >= 4 && path.compare(path.size() - 4, 4, ".wav") == 0), rate(sample_rate), n_channels(channels), n_frames(0) {
+    if (!file) {
+        throw std::runtime_error("Cannot create " + path);
+    }
+    if (wav) {
+        write_header();
+    }
+}
+
+wav_writer::~wav_writer() {
+    close();
+}
+
+void wav_writer::write(const float *const interleaved, std::size_t frames) {
+    file.write(reinterpret_cast<const char *>(interleaved),
+               frames * n_channels * sizeof(float));
+    n_frames += frames;
+}
+
+void wav_writer::close() {
+    if (!file.is_open()) {
+        return;
+    }
+    if (wav) {
+        // Patch the chunk sizes now that the length is known
+        file.seekp(0);
+        write_header();
+    }
+    file.close();
+}
+
+void wav_writer::write_header() {
+    const uint32_t data_bytes = n_frames * n_channels * sizeof(float);
+    file.write("RIFF", 4);
+    put32(file, 36 + data_bytes);
+    file.write("WAVEfmt ", 8);
+    put32(file, 16);
+    put16(file, 3);  // IEEE float
+    put16(file, n_channels);
+    put32(file, rate);
+    put32(file, rate * n_channels * sizeof(float));
+    put16(file, n_channels * sizeof(float));
+    put16(file, 32);
+    file.write("data", 4);
+    put32(file, data_bytes);
+}
+
+}  // namespace dsp
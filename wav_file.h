@@ -0,0 +1,98 @@
+#ifndef _WAV_FILE_H
+#define _WAV_FILE_H
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+namespace dsp {
+
+/**
+ * Read-only memory mapping of an audio file.
+ *
+ * WAV files with 16, 24 or 32 bit PCM or 32 bit float samples are
+ * recognized by their RIFF (or RF64) header.  Anything else is taken as raw 32
+ * bit float samples, for which the sample rate and number of channels
+ * must be given.
+ *
+ * Mono float files can be used directly from the mapping (samples());
+ * any other format is converted on demand with read().
+ */
+class mapped_audio_file {
+   public:
+    mapped_audio_file(const std::string &path,
+                      unsigned int raw_sample_rate = 0,
+                      unsigned int raw_channels = 1);
+    mapped_audio_file(const mapped_audio_file &) = delete;
+    mapped_audio_file &operator=(const mapped_audio_file &) = delete;
+    ~mapped_audio_file();
+
+    std::size_t frames() const { return n_frames; }
+    unsigned int channels() const { return n_channels; }
+    unsigned int sample_rate() const { return rate; }
+
+    /**
+     * Read the whole mapping into memory and lock it there (mlock), so
+     * that reading it later does not fault.  Returns false if it could
+     * not be locked (see ulimit -l); the pages were read anyway.
+     */
+    bool load() const;
+
+    /**
+     * Samples of a mono 32 bit float file, straight from the mapping.
+     * nullptr for any other format.
+     */
+    const float *samples() const;
+
+    /**
+     * Convert n frames of channel ch, starting at frame first, to
+     * float.  Frames past the end of the file are read as zeros.
+     */
+    void read(unsigned int ch, std::size_t first, std::size_t n,
+              float *const dst) const;
+
+   private:
+    void *map;
+    std::size_t map_size;
+    const unsigned char *data;  // First sample
+    std::size_t n_frames;
+    unsigned int n_channels;
+    unsigned int rate;
+    unsigned int bytes_per_sample;
+    bool is_float;
+
+    void parse_wav();
+};
+
+/**
+ * Streaming writer of interleaved 32 bit float audio.
+ *
+ * Paths ending in ".wav" get a WAV header (finished on close());
+ * anything else is written as raw floats.
+ */
+class wav_writer {
+   public:
+    wav_writer(const std::string &path, unsigned int sample_rate,
+               unsigned int channels = 1);
+    wav_writer(const wav_writer &) = delete;
+    wav_writer &operator=(const wav_writer &) = delete;
+    ~wav_writer();
+
+    void write(const float *const interleaved, std::size_t frames);
+    void close();
+
+    std::size_t frames() const { return n_frames; }
+
+   private:
+    std::ofstream file;
+    bool wav;
+    unsigned int rate;
+    unsigned int n_channels;
+    std::size_t n_frames;
+
+    void write_header();
+};
+
+}  // namespace dsp
+
+#endif